@@ -0,0 +1,287 @@
+#include "Bvh.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace gps {
+
+    namespace {
+
+        float surfaceArea(glm::vec3 min, glm::vec3 max) {
+
+            glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+            return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+        }
+
+        //entry distance of the ray into the box, FLT_MAX when missed
+        float intersectBox(glm::vec3 min, glm::vec3 max, glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance) {
+
+            glm::vec3 t0 = (min - origin) * inverseDirection;
+            glm::vec3 t1 = (max - origin) * inverseDirection;
+            glm::vec3 tNear = glm::min(t0, t1);
+            glm::vec3 tFar = glm::max(t0, t1);
+            float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+            float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+
+            return enter <= exit ? enter : FLT_MAX;
+        }
+    }
+
+    Bvh::Bvh() {
+    }
+
+    void Bvh::build(const std::vector<glm::vec3>& positions) {
+
+        this->positions = positions;
+        int triangleCount = (int)positions.size() / 3;
+
+        this->order.resize(triangleCount);
+        this->centroids.resize(triangleCount);
+        this->triangleMin.resize(triangleCount);
+        this->triangleMax.resize(triangleCount);
+        for (int i = 0; i < triangleCount; i++) {
+            glm::vec3 a = positions[3 * i], b = positions[3 * i + 1], c = positions[3 * i + 2];
+            this->order[i] = i;
+            this->triangleMin[i] = glm::min(a, glm::min(b, c));
+            this->triangleMax[i] = glm::max(a, glm::max(b, c));
+            this->centroids[i] = (this->triangleMin[i] + this->triangleMax[i]) * 0.5f;
+        }
+
+        this->nodes.clear();
+        this->nodes.reserve(std::max(2 * triangleCount / LEAF_SIZE, 1));
+        if (triangleCount > 0) {
+            buildNode(0, triangleCount, 0);
+        }
+
+        this->centroids.clear();
+        this->triangleMin.clear();
+        this->triangleMax.clear();
+    }
+
+    int Bvh::buildNode(int begin, int end, int depth) {
+
+        int index = (int)this->nodes.size();
+        this->nodes.push_back(Node());
+
+        glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+        glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+        for (int i = begin; i < end; i++) {
+            int triangle = this->order[i];
+            boundsMin = glm::min(boundsMin, this->triangleMin[triangle]);
+            boundsMax = glm::max(boundsMax, this->triangleMax[triangle]);
+            centroidMin = glm::min(centroidMin, this->centroids[triangle]);
+            centroidMax = glm::max(centroidMax, this->centroids[triangle]);
+        }
+        this->nodes[index].min = boundsMin;
+        this->nodes[index].max = boundsMax;
+
+        int count = end - begin;
+        glm::vec3 extent = centroidMax - centroidMin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+        //a leaf when small enough, when the centroids cannot be told apart or when the traversal stack would overflow
+        if (count <= LEAF_SIZE || extent[axis] <= 0.0f || depth == MAX_DEPTH - 1) {
+            this->nodes[index].offset = begin;
+            this->nodes[index].count = count;
+            return index;
+        }
+
+        //bin the centroids along the widest axis and pick the cheapest plane between bins
+        int binCount[BINS] = {};
+        glm::vec3 binMin[BINS], binMax[BINS];
+        for (int b = 0; b < BINS; b++) {
+            binMin[b] = glm::vec3(FLT_MAX);
+            binMax[b] = glm::vec3(-FLT_MAX);
+        }
+        float binScale = BINS / extent[axis];
+        for (int i = begin; i < end; i++) {
+            int triangle = this->order[i];
+            int b = std::min((int)((this->centroids[triangle][axis] - centroidMin[axis]) * binScale), BINS - 1);
+            binCount[b]++;
+            binMin[b] = glm::min(binMin[b], this->triangleMin[triangle]);
+            binMax[b] = glm::max(binMax[b], this->triangleMax[triangle]);
+        }
+
+        //areas of everything left of each plane, then sweep from the right
+        float leftArea[BINS - 1];
+        int leftCount[BINS - 1];
+        glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+        int sweepCount = 0;
+        for (int b = 0; b < BINS - 1; b++) {
+            sweepCount += binCount[b];
+            if (binCount[b] > 0) {
+                sweepMin = glm::min(sweepMin, binMin[b]);
+                sweepMax = glm::max(sweepMax, binMax[b]);
+            }
+            leftCount[b] = sweepCount;
+            leftArea[b] = sweepCount > 0 ? surfaceArea(sweepMin, sweepMax) : 0.0f;
+        }
+
+        int bestPlane = -1;
+        float bestCost = FLT_MAX;
+        sweepMin = glm::vec3(FLT_MAX);
+        sweepMax = glm::vec3(-FLT_MAX);
+        sweepCount = 0;
+        for (int b = BINS - 1; b > 0; b--) {
+            sweepCount += binCount[b];
+            if (binCount[b] > 0) {
+                sweepMin = glm::min(sweepMin, binMin[b]);
+                sweepMax = glm::max(sweepMax, binMax[b]);
+            }
+            if (leftCount[b - 1] == 0 || sweepCount == 0) {
+                continue;
+            }
+            float cost = leftArea[b - 1] * leftCount[b - 1] + surfaceArea(sweepMin, sweepMax) * sweepCount;
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestPlane = b;
+            }
+        }
+
+        //splitting has to beat intersecting every triangle of the node
+        float leafCost = surfaceArea(boundsMin, boundsMax) * count;
+        if (bestPlane < 0 || (bestCost >= leafCost && count <= 4 * LEAF_SIZE)) {
+            this->nodes[index].offset = begin;
+            this->nodes[index].count = count;
+            return index;
+        }
+
+        int* middle = std::partition(&this->order[begin], &this->order[0] + end, [&](int triangle) {
+            return std::min((int)((this->centroids[triangle][axis] - centroidMin[axis]) * binScale), BINS - 1) < bestPlane;
+        });
+        int split = (int)(middle - &this->order[0]);
+
+        buildNode(begin, split, depth + 1);
+        int second = buildNode(split, end, depth + 1);
+        this->nodes[index].offset = second;
+        this->nodes[index].count = 0;
+
+        return index;
+    }
+
+    bool Bvh::intersect(glm::vec3 origin, glm::vec3 direction, float maxDistance, RayHit& hit) const {
+
+        return traverse(origin, direction, maxDistance, false, hit);
+    }
+
+    bool Bvh::occluded(glm::vec3 origin, glm::vec3 direction, float maxDistance) const {
+
+        RayHit hit;
+        return traverse(origin, direction, maxDistance, true, hit);
+    }
+
+    bool Bvh::traverse(glm::vec3 origin, glm::vec3 direction, float maxDistance, bool anyHit, RayHit& hit) const {
+
+        if (this->nodes.empty()) {
+            return false;
+        }
+
+        glm::vec3 inverseDirection = 1.0f / direction;
+        bool found = false;
+        hit.t = maxDistance;
+
+        //one pending node per level at most
+        int stack[MAX_DEPTH];
+        int stackSize = 0;
+        int node = 0;
+
+        while (true) {
+            const Node& current = this->nodes[node];
+
+            if (current.count > 0) {
+                for (int i = current.offset; i < current.offset + current.count; i++) {
+                    if (intersectTriangle(this->order[i], origin, direction, hit.t, hit)) {
+                        found = true;
+                        if (anyHit) {
+                            return true;
+                        }
+                    }
+                }
+            }
+            else {
+                //visit the nearer child first, the other one may be culled by then
+                int first = node + 1;
+                int second = current.offset;
+                float firstDistance = intersectBox(this->nodes[first].min, this->nodes[first].max, origin, inverseDirection, hit.t);
+                float secondDistance = intersectBox(this->nodes[second].min, this->nodes[second].max, origin, inverseDirection, hit.t);
+                if (secondDistance < firstDistance) {
+                    std::swap(first, second);
+                    std::swap(firstDistance, secondDistance);
+                }
+
+                if (firstDistance != FLT_MAX) {
+                    if (secondDistance != FLT_MAX) {
+                        stack[stackSize++] = second;
+                    }
+                    node = first;
+                    continue;
+                }
+            }
+
+            //the closest hit may have moved past the boxes pushed earlier
+            node = -1;
+            while (stackSize > 0 && node < 0) {
+                int candidate = stack[--stackSize];
+                if (anyHit || intersectBox(this->nodes[candidate].min, this->nodes[candidate].max, origin, inverseDirection, hit.t) != FLT_MAX) {
+                    node = candidate;
+                }
+            }
+            if (node < 0) {
+                break;
+            }
+        }
+
+        return found;
+    }
+
+    bool Bvh::intersectTriangle(int triangle, glm::vec3 origin, glm::vec3 direction, float maxDistance, RayHit& hit) const {
+
+        //Moller-Trumbore
+        glm::vec3 a = this->positions[3 * triangle];
+        glm::vec3 edge1 = this->positions[3 * triangle + 1] - a;
+        glm::vec3 edge2 = this->positions[3 * triangle + 2] - a;
+
+        glm::vec3 p = glm::cross(direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (std::abs(determinant) < 1e-12f) {
+            return false;
+        }
+        float inverseDeterminant = 1.0f / determinant;
+
+        glm::vec3 s = origin - a;
+        float u = glm::dot(s, p) * inverseDeterminant;
+        if (u < 0.0f || u > 1.0f) {
+            return false;
+        }
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(direction, q) * inverseDeterminant;
+        if (v < 0.0f || u + v > 1.0f) {
+            return false;
+        }
+        float t = glm::dot(edge2, q) * inverseDeterminant;
+        if (t <= 0.0f || t >= maxDistance) {
+            return false;
+        }
+
+        hit.t = t;
+        hit.triangle = triangle;
+        hit.u = u;
+        hit.v = v;
+        return true;
+    }
+
+    int Bvh::getTriangleCount() const {
+        return (int)this->positions.size() / 3;
+    }
+
+    int Bvh::getNodeCount() const {
+        return (int)this->nodes.size();
+    }
+
+    glm::vec3 Bvh::getTriangleNormal(int triangle) const {
+
+        glm::vec3 a = this->positions[3 * triangle];
+        return glm::normalize(glm::cross(this->positions[3 * triangle + 1] - a, this->positions[3 * triangle + 2] - a));
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef Bvh_hpp
+#define Bvh_hpp
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    struct RayHit {
+
+        //distance along the ray
+        float t;
+        int triangle;
+        //barycentric weights of the second and third vertex
+        float u;
+        float v;
+    };
+
+    //bounding volume hierarchy over a triangle soup, for CPU ray casting (lightmap baking)
+    //built top-down with a binned surface area heuristic, nodes stored depth first in one array
+    //queries are read-only, any number of threads can trace at the same time
+    class Bvh {
+
+    public:
+        Bvh();
+
+        //three positions per triangle
+        void build(const std::vector<glm::vec3>& positions);
+
+        //closest hit with t in (0, maxDistance)
+        bool intersect(glm::vec3 origin, glm::vec3 direction, float maxDistance, RayHit& hit) const;
+        //any hit with t in (0, maxDistance), stops at the first one
+        bool occluded(glm::vec3 origin, glm::vec3 direction, float maxDistance) const;
+
+        int getTriangleCount() const;
+        int getNodeCount() const;
+        //geometric normal, following the vertex winding
+        glm::vec3 getTriangleNormal(int triangle) const;
+
+    private:
+        static const int LEAF_SIZE = 4;
+        static const int BINS = 12;
+        static const int MAX_DEPTH = 64;
+
+        struct Node {
+            glm::vec3 min;
+            //leaf - first triangle in order, inner - index of the second child (the first follows the node)
+            int offset;
+            glm::vec3 max;
+            //triangles of a leaf, 0 for inner nodes
+            int count;
+        };
+
+        std::vector<glm::vec3> positions;
+        //triangle indices, leaves own contiguous ranges
+        std::vector<int> order;
+        std::vector<Node> nodes;
+
+        //per-triangle data used only while building
+        std::vector<glm::vec3> centroids;
+        std::vector<glm::vec3> triangleMin;
+        std::vector<glm::vec3> triangleMax;
+
+        int buildNode(int begin, int end, int depth);
+        bool traverse(glm::vec3 origin, glm::vec3 direction, float maxDistance, bool anyHit, RayHit& hit) const;
+        bool intersectTriangle(int triangle, glm::vec3 origin, glm::vec3 direction, float maxDistance, RayHit& hit) const;
+    };
+}
+
+#endif /* Bvh_hpp */
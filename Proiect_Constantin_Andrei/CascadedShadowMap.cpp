@@ -0,0 +1,446 @@
+#include "CascadedShadowMap.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    CascadedShadowMap::CascadedShadowMap() {
+
+        this->cascadeCount = 0;
+        this->resolution = 0;
+        this->splitLambda = 0.75f;
+        this->shadowDistance = 60.0f;
+        this->depthTexture = 0;
+        this->framebuffer = 0;
+        this->staticCaching = false;
+        this->guardBand = 0.2f;
+        this->staticDepthTexture = 0;
+        this->staticFramebuffer = 0;
+        this->staticRefreshCount = 0;
+        this->timeSlicing = false;
+        this->frameIndex = 0;
+        this->lightView = glm::mat4(1.0f);
+
+        for (int i = 0; i < MAX_CASCADES; i++) {
+            this->splitDistances[i] = 0.0f;
+            this->lightSpaceMatrices[i] = glm::mat4(1.0f);
+            this->lightViews[i] = glm::mat4(1.0f);
+            this->staticValid[i] = false;
+            this->scheduled[i] = false;
+            this->rendered[i] = false;
+        }
+    }
+
+    void CascadedShadowMap::init(int cascadeCount, int resolution) {
+
+        this->cascadeCount = std::max(1, std::min(cascadeCount, (int)MAX_CASCADES));
+        this->resolution = resolution;
+
+        //create depth texture array, one layer per cascade
+        this->depthTexture = createDepthArray();
+
+        //sampled through sampler2DArrayShadow: the hardware compares and filters 2x2 texels per lookup
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->depthTexture);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        //the layer is attached by beginCascade
+        glGenFramebuffers(1, &this->framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->depthTexture, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        for (int i = 0; i < this->cascadeCount; i++) {
+            this->cascadeTimers[i].create();
+        }
+    }
+
+    GLuint CascadedShadowMap::createDepthArray() {
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+            this->resolution, this->resolution, this->cascadeCount, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        return texture;
+    }
+
+    void CascadedShadowMap::destroy() {
+
+        for (int i = 0; i < this->cascadeCount; i++) {
+            this->cascadeTimers[i].destroy();
+        }
+        glDeleteFramebuffers(1, &this->framebuffer);
+        glDeleteTextures(1, &this->depthTexture);
+        this->framebuffer = 0;
+        this->depthTexture = 0;
+
+        if (this->staticFramebuffer) {
+            glDeleteFramebuffers(1, &this->staticFramebuffer);
+            glDeleteTextures(1, &this->staticDepthTexture);
+            this->staticFramebuffer = 0;
+            this->staticDepthTexture = 0;
+        }
+    }
+
+    void CascadedShadowMap::setSplitLambda(float lambda) {
+        this->splitLambda = glm::clamp(lambda, 0.0f, 1.0f);
+    }
+
+    void CascadedShadowMap::setShadowDistance(float distance) {
+        this->shadowDistance = distance;
+        invalidateStatic();
+    }
+
+    void CascadedShadowMap::setSceneBounds(gps::BoundingBox bounds) {
+        this->sceneBounds = bounds;
+    }
+
+    void CascadedShadowMap::setStaticCaching(bool enabled, float guardBand) {
+
+        this->staticCaching = enabled;
+        this->guardBand = guardBand;
+
+        if (enabled && !this->staticFramebuffer) {
+
+            this->staticDepthTexture = createDepthArray();
+            glGenFramebuffers(1, &this->staticFramebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, this->staticFramebuffer);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->staticDepthTexture, 0, 0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        invalidateStatic();
+    }
+
+    bool CascadedShadowMap::isStaticCaching() {
+        return this->staticCaching;
+    }
+
+    void CascadedShadowMap::invalidateStatic() {
+
+        for (int i = 0; i < MAX_CASCADES; i++) {
+            this->staticValid[i] = false;
+        }
+    }
+
+    void CascadedShadowMap::invalidateStatic(gps::BoundingBox bounds) {
+
+        if (bounds.isEmpty()) {
+            return;
+        }
+
+        for (int i = 0; i < this->cascadeCount; i++) {
+
+            gps::BoundingBox lightBounds = bounds.transform(this->lightViews[i]);
+            const CascadeWindow& window = this->windows[i];
+            //the light looks down -z, depths are negated z
+            bool overlaps = lightBounds.max.x >= window.left && lightBounds.min.x <= window.left + window.size
+                && lightBounds.max.y >= window.bottom && lightBounds.min.y <= window.bottom + window.size
+                && -lightBounds.min.z >= window.nearDepth && -lightBounds.max.z <= window.farDepth;
+            if (overlaps) {
+                this->staticValid[i] = false;
+            }
+        }
+    }
+
+    void CascadedShadowMap::setTimeSlicing(bool enabled) {
+        this->timeSlicing = enabled;
+    }
+
+    bool CascadedShadowMap::isTimeSlicing() {
+        return this->timeSlicing;
+    }
+
+    void CascadedShadowMap::update(glm::mat4 view, float fovy, float aspect, float nearPlane, glm::vec3 lightDir) {
+
+        glm::vec3 lightDirN = glm::normalize(lightDir);
+        glm::vec3 up = std::fabs(lightDirN.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+        //the light orientation depends only on the light, so the texel grid below is fixed in the world
+        this->lightView = glm::lookAt(glm::vec3(0.0f), -lightDirN, up);
+        this->frameIndex++;
+
+        //cached and time sliced windows get a guard band so small camera moves stay inside them
+        float guard = (this->staticCaching || this->timeSlicing) ? this->guardBand : 0.0f;
+
+        float farPlane = this->shadowDistance;
+        float previousSplit = nearPlane;
+        glm::vec3 corners[MAX_CASCADES][8];
+
+        for (int i = 0; i < this->cascadeCount; i++) {
+
+            //practical split scheme: blend of the logarithmic and the uniform split
+            float p = (float)(i + 1) / this->cascadeCount;
+            float logSplit = nearPlane * std::pow(farPlane / nearPlane, p);
+            float linearSplit = nearPlane + (farPlane - nearPlane) * p;
+            this->splitDistances[i] = this->splitLambda * logSplit + (1.0f - this->splitLambda) * linearSplit;
+
+            computeFrustumCorners(view, fovy, aspect, previousSplit, this->splitDistances[i], corners[i]);
+            previousSplit = this->splitDistances[i];
+        }
+
+        //pick the cascades rendered this frame
+        for (int i = 0; i < this->cascadeCount; i++) {
+            this->scheduled[i] = !this->timeSlicing || i == 0;
+        }
+
+        if (this->timeSlicing && this->cascadeCount > 1) {
+
+            //every stale cascade whose old window (in its old light view) no longer covers the slice is
+            //rendered now, receivers outside it would get no shadow; only covered ones wait their turn
+            bool uncovered = false;
+            for (int i = 1; i < this->cascadeCount; i++) {
+                if (!this->rendered[i] || !contains(this->windows[i], computeNeededWindow(this->lightViews[i], corners[i]))) {
+                    this->scheduled[i] = true;
+                    uncovered = true;
+                }
+            }
+            if (!uncovered) {
+                int slot = roundRobinCascade(this->frameIndex);
+                if (slot > 0 && slot < this->cascadeCount) {
+                    this->scheduled[slot] = true;
+                }
+            }
+        }
+
+        for (int i = 0; i < this->cascadeCount; i++) {
+
+            //stale cascades keep the matrix their depth was rendered with
+            if (!this->scheduled[i]) {
+                continue;
+            }
+
+            //cached windows are expressed in the old light view, a turning light invalidates them
+            if (this->lightViews[i] != this->lightView) {
+                this->lightViews[i] = this->lightView;
+                this->staticValid[i] = false;
+            }
+
+            CascadeWindow needed = computeNeededWindow(this->lightView, corners[i]);
+
+            //a valid cached window is kept while it still covers what is needed
+            //(and is not much larger, which would waste resolution)
+            bool keep = this->staticCaching && this->staticValid[i] && contains(this->windows[i], needed)
+                && this->windows[i].size <= needed.size * (1.0f + 2.0f * guard) * 1.5f;
+
+            if (!keep) {
+
+                CascadeWindow window;
+                window.size = needed.size * (1.0f + 2.0f * guard);
+
+                //move the window in whole texels so the rasterized depth does not shimmer
+                float texel = window.size / this->resolution;
+                window.left = std::floor((needed.left - needed.size * guard) / texel) * texel;
+                window.bottom = std::floor((needed.bottom - needed.size * guard) / texel) * texel;
+
+                float depthGuard = guard * (needed.farDepth - needed.nearDepth);
+                window.nearDepth = needed.nearDepth;
+                window.farDepth = needed.farDepth + depthGuard;
+
+                this->windows[i] = window;
+                this->staticValid[i] = false;
+            }
+
+            const CascadeWindow& window = this->windows[i];
+            glm::mat4 lightProjection = glm::ortho(window.left, window.left + window.size,
+                window.bottom, window.bottom + window.size, window.nearDepth, window.farDepth);
+            this->lightSpaceMatrices[i] = lightProjection * this->lightView;
+            this->rendered[i] = true;
+        }
+    }
+
+    CascadedShadowMap::CascadeWindow CascadedShadowMap::computeNeededWindow(glm::mat4 cascadeLightView, const glm::vec3 corners[8]) {
+
+        gps::BoundingBox sceneLight = this->sceneBounds.transform(cascadeLightView);
+
+        //light space bounds of the slice and the diameter of its bounding sphere
+        //the diameter does not change when the camera rotates
+        gps::BoundingBox slice;
+        glm::vec3 center(0.0f);
+        for (int c = 0; c < 8; c++) {
+            slice.extend(glm::vec3(cascadeLightView * glm::vec4(corners[c], 1.0f)));
+            center += corners[c];
+        }
+        center /= 8.0f;
+
+        float diameter = 0.0f;
+        for (int c = 0; c < 8; c++) {
+            diameter = std::max(diameter, 2.0f * glm::length(corners[c] - center));
+        }
+
+        //casters sit anywhere towards the light, receivers only inside the slice
+        float nearZ = slice.max.z + this->shadowDistance;
+
+        if (!sceneLight.isEmpty()) {
+
+            //only the part of the slice that contains geometry needs texels
+            gps::BoundingBox clipped = slice;
+            clipped.min = glm::max(slice.min, sceneLight.min);
+            clipped.max = glm::min(slice.max, sceneLight.max);
+            if (!clipped.isEmpty()) {
+                slice = clipped;
+            }
+            nearZ = std::max(sceneLight.max.z, slice.max.z);
+        }
+
+        float step = diameter / SIZE_STEPS;
+        float size = std::max(slice.max.x - slice.min.x, slice.max.y - slice.min.y);
+        size = std::min(std::max(std::ceil(size / step), 1.0f) * step, diameter);
+
+        //the light looks down -z, so the depth range is the negated view space z
+        float depthPadding = 0.01f * (nearZ - slice.min.z) + 0.01f;
+
+        CascadeWindow needed;
+        needed.size = size;
+        needed.left = (slice.min.x + slice.max.x) * 0.5f - size * 0.5f;
+        needed.bottom = (slice.min.y + slice.max.y) * 0.5f - size * 0.5f;
+        needed.nearDepth = -nearZ - depthPadding;
+        needed.farDepth = -slice.min.z + depthPadding;
+
+        return needed;
+    }
+
+    int CascadedShadowMap::roundRobinCascade(unsigned int frame) {
+
+        //ruler sequence 1 2 1 3 1 2 1 - ...
+        if (frame % 2 == 1) {
+            return 1;
+        }
+        if (frame % 4 == 2) {
+            return 2;
+        }
+        if (frame % 8 == 4) {
+            return 3;
+        }
+        return -1;
+    }
+
+    bool CascadedShadowMap::isCascadeScheduled(int cascade) {
+        return this->scheduled[cascade];
+    }
+
+    bool CascadedShadowMap::contains(const CascadeWindow& outer, const CascadeWindow& inner) {
+
+        return outer.left <= inner.left && outer.left + outer.size >= inner.left + inner.size
+            && outer.bottom <= inner.bottom && outer.bottom + outer.size >= inner.bottom + inner.size
+            && outer.nearDepth <= inner.nearDepth && outer.farDepth >= inner.farDepth;
+    }
+
+    void CascadedShadowMap::computeFrustumCorners(glm::mat4 view, float fovy, float aspect, float nearDistance, float farDistance, glm::vec3 corners[8]) {
+
+        glm::mat4 inverseView = glm::inverse(view);
+        float tanHalfY = std::tan(fovy * 0.5f);
+        float tanHalfX = tanHalfY * aspect;
+
+        float distances[2] = { nearDistance, farDistance };
+        int corner = 0;
+        for (int d = 0; d < 2; d++) {
+            for (int y = -1; y <= 1; y += 2) {
+                for (int x = -1; x <= 1; x += 2) {
+
+                    //the camera looks down -z in view space
+                    glm::vec4 viewCorner(x * tanHalfX * distances[d], y * tanHalfY * distances[d], -distances[d], 1.0f);
+                    corners[corner++] = glm::vec3(inverseView * viewCorner);
+                }
+            }
+        }
+    }
+
+    void CascadedShadowMap::beginCascade(int cascade) {
+
+        if (cascade == 0) {
+            this->staticRefreshCount = 0;
+        }
+
+        this->cascadeTimers[cascade].begin();
+        glViewport(0, 0, this->resolution, this->resolution);
+    }
+
+    bool CascadedShadowMap::beginStaticCasters(int cascade) {
+
+        if (!this->staticCaching || this->staticValid[cascade]) {
+            return false;
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, this->staticFramebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->staticDepthTexture, 0, cascade);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        return true;
+    }
+
+    void CascadedShadowMap::endStaticCasters(int cascade) {
+
+        this->staticValid[cascade] = true;
+        this->staticRefreshCount++;
+    }
+
+    void CascadedShadowMap::beginDynamicCasters(int cascade) {
+
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->depthTexture, 0, cascade);
+
+        if (!this->staticCaching) {
+            glClear(GL_DEPTH_BUFFER_BIT);
+            return;
+        }
+
+        //start from the cached static depth, the dynamic casters are depth tested against it
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, this->staticFramebuffer);
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->staticDepthTexture, 0, cascade);
+        glBlitFramebuffer(0, 0, this->resolution, this->resolution, 0, 0, this->resolution, this->resolution,
+            GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, this->framebuffer);
+    }
+
+    void CascadedShadowMap::endCascade(int cascade) {
+
+        this->cascadeTimers[cascade].end();
+    }
+
+    int CascadedShadowMap::getCascadeCount() {
+        return this->cascadeCount;
+    }
+
+    int CascadedShadowMap::getResolution() {
+        return this->resolution;
+    }
+
+    GLuint CascadedShadowMap::getDepthTexture() {
+        return this->depthTexture;
+    }
+
+    glm::mat4 CascadedShadowMap::getLightSpaceMatrix(int cascade) {
+        return this->lightSpaceMatrices[cascade];
+    }
+
+    float CascadedShadowMap::getSplitDistance(int cascade) {
+        return this->splitDistances[cascade];
+    }
+
+    double CascadedShadowMap::getCascadeMilliseconds(int cascade) {
+        return this->cascadeTimers[cascade].getMilliseconds();
+    }
+
+    int CascadedShadowMap::getStaticRefreshCount() {
+        return this->staticRefreshCount;
+    }
+}
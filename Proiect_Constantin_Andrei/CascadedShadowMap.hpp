@@ -0,0 +1,151 @@
+#ifndef CascadedShadowMap_hpp
+#define CascadedShadowMap_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "GpuTimer.hpp"
+#include "Mesh.hpp"
+
+namespace gps {
+
+    //directional light shadows split over several depth maps along the camera frustum
+    //all the cascades are layers of one GL_TEXTURE_2D_ARRAY depth texture
+    //
+    //with static caching, static casters are rendered into a second array that is only
+    //refreshed when the light turns, the cascade window moves or invalidateStatic is called;
+    //every frame the cached depth is copied into the live layer and the dynamic casters
+    //are drawn on top with the usual depth test, which keeps the minimum of both
+    //
+    //with time slicing, only the near cascade is rendered every frame; the far ones take turns
+    //in a single extra slot (every 2nd, 4th and 8th frame), so usually two cascades are rendered
+    //per frame. A stale cascade keeps the matrix it was rendered with, receivers are projected
+    //with it, and every cascade whose window no longer covers the camera slice is rendered at once
+    class CascadedShadowMap {
+
+    public:
+        static const int MAX_CASCADES = 4;
+
+        CascadedShadowMap();
+
+        //cascadeCount is clamped to [1, MAX_CASCADES], resolution is the size of every layer
+        void init(int cascadeCount, int resolution);
+        void destroy();
+
+        //lambda of the practical split scheme, 0 = linear splits, 1 = logarithmic splits
+        void setSplitLambda(float lambda);
+        //view distance covered by the cascades, fragments further away are unshadowed
+        void setShadowDistance(float distance);
+        //world space bounds of everything that casts or receives shadows
+        //the cascades are clipped to it and the depth range is set from it
+        void setSceneBounds(gps::BoundingBox bounds);
+
+        //keeps static casters in a cached depth array
+        //guardBand is the extra margin (fraction of the window size on each side) of cached windows,
+        //the camera can move inside it without the cache being refreshed
+        void setStaticCaching(bool enabled, float guardBand = 0.2f);
+        bool isStaticCaching();
+        //forces every cascade to re-render its static casters
+        void invalidateStatic();
+        //re-renders only the cascades whose window overlaps the world space box
+        void invalidateStatic(gps::BoundingBox bounds);
+
+        //renders the far cascades round-robin instead of every frame
+        void setTimeSlicing(bool enabled);
+        bool isTimeSlicing();
+
+        //recomputes the split distances and the light matrices for the current camera
+        //and picks the cascades rendered this frame; lightDir points towards the light
+        void update(glm::mat4 view, float fovy, float aspect, float nearPlane, glm::vec3 lightDir);
+        //false when the cascade keeps last frame's depth, skip beginCascade..endCascade for it
+        bool isCascadeScheduled(int cascade);
+
+        //starts the cascade (and its timer)
+        void beginCascade(int cascade);
+        //with caching, binds the cached layer when it is stale and returns true: draw the static casters then
+        //call endStaticCasters; returns false when the cache is still valid or caching is off
+        bool beginStaticCasters(int cascade);
+        void endStaticCasters(int cascade);
+        //binds the live layer: a copy of the cached static depth, or cleared when caching is off
+        //draw the dynamic casters (or everything without caching) after it
+        void beginDynamicCasters(int cascade);
+        void endCascade(int cascade);
+
+        int getCascadeCount();
+        int getResolution();
+        GLuint getDepthTexture();
+        glm::mat4 getLightSpaceMatrix(int cascade);
+        //view space distance where the cascade ends
+        float getSplitDistance(int cascade);
+        //GPU time spent rendering the cascade, in milliseconds
+        double getCascadeMilliseconds(int cascade);
+        //number of cascades whose static casters were re-rendered in the last frame
+        int getStaticRefreshCount();
+
+    private:
+        //light space window of a cascade, in the coordinates of the light view it was fitted in
+        struct CascadeWindow {
+
+            float left;
+            float bottom;
+            float size;
+            float nearDepth;
+            float farDepth;
+        };
+
+        int cascadeCount;
+        int resolution;
+        float splitLambda;
+        float shadowDistance;
+        gps::BoundingBox sceneBounds;
+
+        GLuint depthTexture;
+        GLuint framebuffer;
+
+        bool staticCaching;
+        float guardBand;
+        GLuint staticDepthTexture;
+        GLuint staticFramebuffer;
+        bool staticValid[MAX_CASCADES];
+        int staticRefreshCount;
+
+        bool timeSlicing;
+        unsigned int frameIndex;
+        bool scheduled[MAX_CASCADES];
+        bool rendered[MAX_CASCADES];
+
+        glm::mat4 lightView;
+        //light view every cascade was last fitted (and rendered) with
+        glm::mat4 lightViews[MAX_CASCADES];
+        CascadeWindow windows[MAX_CASCADES];
+        float splitDistances[MAX_CASCADES];
+        glm::mat4 lightSpaceMatrices[MAX_CASCADES];
+        gps::GpuTimer cascadeTimers[MAX_CASCADES];
+
+        //the cascade extent only grows or shrinks in steps of 1/SIZE_STEPS of the slice diameter
+        //so the texel size stays the same while the camera moves
+        static const int SIZE_STEPS = 16;
+
+        GLuint createDepthArray();
+
+        //true when the window covers the other one
+        static bool contains(const CascadeWindow& outer, const CascadeWindow& inner);
+
+        //smallest window of the given light view that shadows the slice
+        CascadeWindow computeNeededWindow(glm::mat4 cascadeLightView, const glm::vec3 corners[8]);
+        //far cascade owning the shared slot of a frame: 1 on odd frames, 2 every 4th, 3 every 8th, -1 otherwise
+        int roundRobinCascade(unsigned int frame);
+
+        //world space corners of the camera frustum between two view distances
+        void computeFrustumCorners(glm::mat4 view, float fovy, float aspect, float nearDistance, float farDistance, glm::vec3 corners[8]);
+    };
+}
+
+#endif /* CascadedShadowMap_hpp */
@@ -0,0 +1,139 @@
+#include "GBuffer.hpp"
+
+namespace gps {
+
+    GBuffer::GBuffer() {
+
+        this->width = 0;
+        this->height = 0;
+        this->framebuffer = 0;
+        this->albedoTexture = 0;
+        this->normalTexture = 0;
+        this->specularTexture = 0;
+        this->ambientTexture = 0;
+        this->depthTexture = 0;
+    }
+
+    void GBuffer::init(int width, int height) {
+
+        this->width = width;
+        this->height = height;
+
+        glGenFramebuffers(1, &this->framebuffer);
+        createAttachments();
+    }
+
+    void GBuffer::resize(int width, int height) {
+
+        if (width == this->width && height == this->height) {
+            return;
+        }
+
+        this->width = width;
+        this->height = height;
+        deleteAttachments();
+        createAttachments();
+    }
+
+    void GBuffer::destroy() {
+
+        deleteAttachments();
+        if (this->framebuffer) {
+            glDeleteFramebuffers(1, &this->framebuffer);
+            this->framebuffer = 0;
+        }
+    }
+
+    void GBuffer::begin() {
+
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glViewport(0, 0, this->width, this->height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    void GBuffer::end() {
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void GBuffer::createAttachments() {
+
+        //8 bits are enough for texture colors, the normal needs more to keep the specular highlights smooth
+        this->albedoTexture = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        this->normalTexture = createTexture(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT);
+        this->specularTexture = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        //the baked light never goes above an open sky, so it fits in 8 bits too
+        this->ambientTexture = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        //float depth, the far plane is very far and the positions are rebuilt from it
+        this->depthTexture = createTexture(GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->albedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->normalTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, this->specularTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, this->ambientTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->depthTexture, 0);
+
+        GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+        glDrawBuffers(4, drawBuffers);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "ERROR: G-buffer framebuffer is incomplete" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void GBuffer::deleteAttachments() {
+
+        GLuint textures[] = { this->albedoTexture, this->normalTexture, this->specularTexture, this->ambientTexture, this->depthTexture };
+        glDeleteTextures(5, textures);
+        this->albedoTexture = 0;
+        this->normalTexture = 0;
+        this->specularTexture = 0;
+        this->ambientTexture = 0;
+        this->depthTexture = 0;
+    }
+
+    GLuint GBuffer::createTexture(GLenum internalFormat, GLenum format, GLenum type) {
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, this->width, this->height, 0, format, type, NULL);
+        //read with texelFetch, one texel per pixel
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    GLuint GBuffer::getAlbedoTexture() {
+        return this->albedoTexture;
+    }
+
+    GLuint GBuffer::getNormalTexture() {
+        return this->normalTexture;
+    }
+
+    GLuint GBuffer::getSpecularTexture() {
+        return this->specularTexture;
+    }
+
+    GLuint GBuffer::getAmbientTexture() {
+        return this->ambientTexture;
+    }
+
+    GLuint GBuffer::getDepthTexture() {
+        return this->depthTexture;
+    }
+
+    int GBuffer::getWidth() {
+        return this->width;
+    }
+
+    int GBuffer::getHeight() {
+        return this->height;
+    }
+}
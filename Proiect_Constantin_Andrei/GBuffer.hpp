@@ -0,0 +1,61 @@
+#ifndef GBuffer_hpp
+#define GBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <iostream>
+
+namespace gps {
+
+    //surface attributes of the visible fragments, written by the geometry pass of the deferred path
+    //and read back by one full-screen lighting pass, so every pixel is lit once whatever the overdraw
+    class GBuffer {
+
+    public:
+        GBuffer();
+
+        void init(int width, int height);
+        //reallocates the attachments when the framebuffer size changed
+        void resize(int width, int height);
+        void destroy();
+
+        //binds and clears the framebuffer, the geometry pass draws into it
+        void begin();
+        void end();
+
+        //rgb - diffuse texture
+        GLuint getAlbedoTexture();
+        //rgb - world space normal
+        GLuint getNormalTexture();
+        //rgb - specular texture
+        GLuint getSpecularTexture();
+        //rgb - baked sky light, a - ambient occlusion, see LightmapBaker
+        GLuint getAmbientTexture();
+        //window depth, the lighting pass rebuilds the position from it
+        GLuint getDepthTexture();
+        int getWidth();
+        int getHeight();
+
+    private:
+        int width;
+        int height;
+        GLuint framebuffer;
+        GLuint albedoTexture;
+        GLuint normalTexture;
+        GLuint specularTexture;
+        GLuint ambientTexture;
+        GLuint depthTexture;
+
+        void createAttachments();
+        void deleteAttachments();
+        GLuint createTexture(GLenum internalFormat, GLenum format, GLenum type);
+    };
+}
+
+#endif /* GBuffer_hpp */
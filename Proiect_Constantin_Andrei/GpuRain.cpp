@@ -0,0 +1,204 @@
+#include "GpuRain.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    const glm::vec4 GpuRain::DROP_COLOR = glm::vec4(1.0f, 1.0f, 1.0f, 0.6f);
+    const glm::vec2 GpuRain::DROP_SIZE = glm::vec2(0.1f, 0.004f);
+
+    GpuRain::GpuRain() {
+
+        this->startVelocityLoc = -1;
+        this->slowdownLoc = -1;
+        this->seedLoc = -1;
+        this->updateCameraPositionLoc = -1;
+        this->hasHeightMapLoc = -1;
+        this->heightMapMatrixLoc = -1;
+        this->heightMapLoc = -1;
+        this->heightMap = NULL;
+        this->drawShader = NULL;
+        this->positionScaleLoc = -1;
+        this->motionScaleLoc = -1;
+        this->viewportHeightLoc = -1;
+        this->originLoc = -1;
+        this->particleSizeLoc = -1;
+        this->colorLoc = -1;
+        this->motionScale = 0.0f;
+        this->buffers[0] = this->buffers[1] = 0;
+        this->updateVAOs[0] = this->updateVAOs[1] = 0;
+        this->drawVAOs[0] = this->drawVAOs[1] = 0;
+        this->current = 0;
+        this->step = 0;
+        this->particleCount = 0;
+    }
+
+    void GpuRain::beginLoadShaders(std::vector<gps::Shader*>& shaders) {
+
+        std::vector<std::string> varyings;
+        varyings.push_back("outPositionLife");
+        varyings.push_back("outVelocityFade");
+        this->updateShader.beginLoadTransformFeedbackShader("shaders/rainUpdate.vert", varyings);
+        shaders.push_back(&this->updateShader);
+    }
+
+    void GpuRain::init(int particleCount, const gps::Shader& drawShader) {
+
+        //nothing left to wait for when the batch finished it
+        this->updateShader.finishLoad();
+        this->startVelocityLoc = glGetUniformLocation(this->updateShader.shaderProgram, "startVelocity");
+        this->slowdownLoc = glGetUniformLocation(this->updateShader.shaderProgram, "slowdown");
+        this->seedLoc = glGetUniformLocation(this->updateShader.shaderProgram, "seed");
+        this->updateCameraPositionLoc = glGetUniformLocation(this->updateShader.shaderProgram, "cameraPosition");
+        this->hasHeightMapLoc = glGetUniformLocation(this->updateShader.shaderProgram, "hasHeightMap");
+        this->heightMapMatrixLoc = glGetUniformLocation(this->updateShader.shaderProgram, "heightMapMatrix");
+        this->heightMapLoc = glGetUniformLocation(this->updateShader.shaderProgram, "heightMap");
+
+        this->drawShader = &drawShader;
+        this->originLoc = glGetUniformLocation(this->drawShader->shaderProgram, "origin");
+        this->positionScaleLoc = glGetUniformLocation(this->drawShader->shaderProgram, "positionScale");
+        this->motionScaleLoc = glGetUniformLocation(this->drawShader->shaderProgram, "motionScale");
+        this->viewportHeightLoc = glGetUniformLocation(this->drawShader->shaderProgram, "viewportHeight");
+        this->particleSizeLoc = glGetUniformLocation(this->drawShader->shaderProgram, "particleSize");
+        this->colorLoc = glGetUniformLocation(this->drawShader->shaderProgram, "color");
+
+        setParticleCount(particleCount);
+    }
+
+    void GpuRain::destroy() {
+
+        deleteBuffers();
+        glDeleteProgram(this->updateShader.shaderProgram);
+    }
+
+    void GpuRain::setParticleCount(int particleCount) {
+
+        deleteBuffers();
+        this->particleCount = particleCount > 0 ? particleCount : 0;
+        createBuffers();
+    }
+
+    int GpuRain::getParticleCount() {
+
+        return this->particleCount;
+    }
+
+    void GpuRain::setHeightMap(HeightMap* heightMap) {
+
+        this->heightMap = heightMap;
+    }
+
+    void GpuRain::update(float startVelocity, float slowdown, glm::vec3 cameraPosition) {
+
+        if (this->particleCount == 0) {
+            return;
+        }
+
+        this->updateShader.useShaderProgram();
+        glUniform1f(this->startVelocityLoc, startVelocity);
+        glUniform1f(this->slowdownLoc, slowdown);
+        glUniform1ui(this->seedLoc, this->step++);
+        this->motionScale = 1.0f / (slowdown * 1000.0f);
+        glUniform3fv(this->updateCameraPositionLoc, 1, glm::value_ptr(cameraPosition));
+
+        bool hasHeightMap = this->heightMap && this->heightMap->isValid();
+        glUniform1i(this->hasHeightMapLoc, hasHeightMap ? 1 : 0);
+        if (hasHeightMap) {
+            glUniformMatrix4fv(this->heightMapMatrixLoc, 1, GL_FALSE, glm::value_ptr(this->heightMap->getMatrix()));
+            glActiveTexture(GL_TEXTURE0 + HEIGHT_MAP_TEXTURE_UNIT);
+            glBindTexture(GL_TEXTURE_2D, this->heightMap->getTexture());
+            glUniform1i(this->heightMapLoc, HEIGHT_MAP_TEXTURE_UNIT);
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        //one point per drop in, one out, nothing reaches the rasterizer
+        int next = 1 - this->current;
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(this->updateVAOs[this->current]);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, this->buffers[next]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, this->particleCount);
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glBindVertexArray(0);
+        glDisable(GL_RASTERIZER_DISCARD);
+
+        this->current = next;
+    }
+
+    void GpuRain::draw(glm::vec3 cameraPosition, int viewportHeight) {
+
+        if (this->particleCount == 0) {
+            return;
+        }
+
+        this->drawShader->useShaderProgram();
+        //the drops follow the camera
+        glUniform3fv(this->originLoc, 1, glm::value_ptr(cameraPosition));
+        //the buffers hold plain floats
+        glUniform1f(this->positionScaleLoc, 1.0f);
+        glUniform1f(this->motionScaleLoc, this->motionScale);
+        glUniform1f(this->viewportHeightLoc, (GLfloat)viewportHeight);
+        glUniform2fv(this->particleSizeLoc, 1, glm::value_ptr(DROP_SIZE));
+        glUniform4fv(this->colorLoc, 1, glm::value_ptr(DROP_COLOR));
+
+        //a quad (triangle strip) per drop instance
+        glBindVertexArray(this->drawVAOs[this->current]);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, this->particleCount);
+        glBindVertexArray(0);
+    }
+
+    void GpuRain::createBuffers() {
+
+        if (this->particleCount == 0) {
+            return;
+        }
+
+        //every drop starts dead, the first update spawns them all
+        std::vector<GLfloat> initial((size_t)this->particleCount * PARTICLE_FLOATS, 0.0f);
+        for (int i = 0; i < this->particleCount; i++) {
+            initial[(size_t)i * PARTICLE_FLOATS + 3] = -1.0f;
+        }
+
+        GLsizei stride = PARTICLE_FLOATS * sizeof(GLfloat);
+        glGenBuffers(2, this->buffers);
+        glGenVertexArrays(2, this->updateVAOs);
+        glGenVertexArrays(2, this->drawVAOs);
+        for (int i = 0; i < 2; i++) {
+            glBindBuffer(GL_ARRAY_BUFFER, this->buffers[i]);
+            glBufferData(GL_ARRAY_BUFFER, initial.size() * sizeof(GLfloat), initial.data(), GL_DYNAMIC_COPY);
+
+            glBindVertexArray(this->updateVAOs[i]);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(4 * sizeof(GLfloat)));
+
+            //the draw reads the same two attributes, advanced once per drop (the fade in w goes unused)
+            glBindVertexArray(this->drawVAOs[i]);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)0);
+            glVertexAttribDivisor(0, 1);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(4 * sizeof(GLfloat)));
+            glVertexAttribDivisor(1, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        this->current = 0;
+    }
+
+    void GpuRain::deleteBuffers() {
+
+        if (this->buffers[0]) {
+            glDeleteVertexArrays(2, this->updateVAOs);
+            glDeleteVertexArrays(2, this->drawVAOs);
+            glDeleteBuffers(2, this->buffers);
+            this->buffers[0] = this->buffers[1] = 0;
+            this->updateVAOs[0] = this->updateVAOs[1] = 0;
+            this->drawVAOs[0] = this->drawVAOs[1] = 0;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef GpuRain_hpp
+#define GpuRain_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "HeightMap.hpp"
+#include "Shader.hpp"
+
+namespace gps {
+
+    //rain simulated entirely on the GPU: the drops live in two vertex buffers, a vertex shader with
+    //transform feedback reads the current one and writes the next step into the other, and the draw
+    //reads the result as per-instance data, so the CPU never touches a drop whatever their number
+    class GpuRain {
+
+    public:
+        //position relative to the camera and life, then velocity and fade (rainUpdate.vert)
+        static const int PARTICLE_FLOATS = 8;
+
+        GpuRain();
+
+        //queues the compile and link of the update program and adds it to shaders, to be finished
+        //with the rest of the startup batch (Shader::finishLoads) before init
+        void beginLoadShaders(std::vector<gps::Shader*>& shaders);
+        //allocates particleCount drops and looks up the update program's locations
+        //drawShader - rainShader.vert/.frag with FrameUniforms bound, shared with ParticleSystem and
+        //owned by the caller, it has to outlive the rain
+        void init(int particleCount, const gps::Shader& drawShader);
+        void destroy();
+
+        //reallocates the drops, they all start falling again
+        void setParticleCount(int particleCount);
+        int getParticleCount();
+
+        //drops also die on the surface of the height map (one texture fetch each), NULL for none
+        void setHeightMap(HeightMap* heightMap);
+
+        //moves every drop one step, with the rasterizer off
+        //startVelocity and slowdown are the same knobs as the CPU rain
+        void update(float startVelocity, float slowdown, glm::vec3 cameraPosition);
+        //one camera facing streak per drop around the camera (rainShader.vert), stretched along the drop's
+        //motion; view/projection come from FrameUniforms, blending is up to the caller
+        void draw(glm::vec3 cameraPosition, int viewportHeight);
+
+    private:
+        //the height map is bound here during the update
+        static const int HEIGHT_MAP_TEXTURE_UNIT = 14;
+        //the look of the CPU rain, see ParticleSystem
+        static const glm::vec4 DROP_COLOR;
+        static const glm::vec2 DROP_SIZE;
+
+        gps::Shader updateShader;
+        const gps::Shader* drawShader;
+        GLint startVelocityLoc;
+        GLint slowdownLoc;
+        GLint seedLoc;
+        GLint updateCameraPositionLoc;
+        GLint hasHeightMapLoc;
+        GLint heightMapMatrixLoc;
+        GLint heightMapLoc;
+        HeightMap* heightMap;
+        GLint positionScaleLoc;
+        GLint motionScaleLoc;
+        GLint viewportHeightLoc;
+        GLint originLoc;
+        GLint particleSizeLoc;
+        GLint colorLoc;
+        //velocity to distance per step, from the last update's slowdown
+        float motionScale;
+
+        //ping-pong state, current holds the latest step
+        GLuint buffers[2];
+        //per buffer: the update reads it as vertices, the draw as instances
+        GLuint updateVAOs[2];
+        GLuint drawVAOs[2];
+        int current;
+        //seeds the respawn hash, so every step draws new random numbers
+        GLuint step;
+        int particleCount;
+
+        void createBuffers();
+        void deleteBuffers();
+    };
+}
+
+#endif /* GpuRain_hpp */
@@ -0,0 +1,83 @@
+#include "GpuTimer.hpp"
+
+namespace gps {
+
+    GpuTimer::GpuTimer() {
+
+        for (int i = 0; i < LATENCY; i++) {
+            this->queries[2 * i] = 0;
+            this->queries[2 * i + 1] = 0;
+            this->pending[i] = false;
+        }
+        this->current = 0;
+        this->milliseconds = 0.0;
+    }
+
+    void GpuTimer::create() {
+
+        glGenQueries(2 * LATENCY, this->queries);
+    }
+
+    void GpuTimer::destroy() {
+
+        if (this->queries[0]) {
+            glDeleteQueries(2 * LATENCY, this->queries);
+            for (int i = 0; i < LATENCY; i++) {
+                this->queries[2 * i] = 0;
+                this->queries[2 * i + 1] = 0;
+                this->pending[i] = false;
+            }
+        }
+    }
+
+    void GpuTimer::begin() {
+
+        //the slot is reused LATENCY measurements later, its result is almost always ready by then
+        if (this->pending[this->current]) {
+            collect(this->current, true);
+        }
+
+        glQueryCounter(this->queries[2 * this->current], GL_TIMESTAMP);
+    }
+
+    void GpuTimer::end() {
+
+        glQueryCounter(this->queries[2 * this->current + 1], GL_TIMESTAMP);
+        this->pending[this->current] = true;
+        this->current = (this->current + 1) % LATENCY;
+    }
+
+    double GpuTimer::getMilliseconds() {
+
+        //oldest first so the newest available result wins
+        for (int i = 0; i < LATENCY; i++) {
+
+            int query = (this->current + i) % LATENCY;
+            if (this->pending[query]) {
+                collect(query, false);
+            }
+        }
+
+        return this->milliseconds;
+    }
+
+    void GpuTimer::collect(int query, bool wait) {
+
+        if (!wait) {
+
+            //the end timestamp completes last
+            GLint available = 0;
+            glGetQueryObjectiv(this->queries[2 * query + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                return;
+            }
+        }
+
+        GLuint64 start = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(this->queries[2 * query], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(this->queries[2 * query + 1], GL_QUERY_RESULT, &end);
+        this->milliseconds = (end - start) / 1000000.0;
+        this->pending[query] = false;
+    }
+}
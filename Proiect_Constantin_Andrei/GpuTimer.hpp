@@ -0,0 +1,44 @@
+#ifndef GpuTimer_hpp
+#define GpuTimer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    //measures the GPU time of a block of commands with a pair of GL_TIMESTAMP queries
+    //results are read a few frames later so measuring never stalls the pipeline
+    //timestamps (unlike GL_TIME_ELAPSED) let timers nest, e.g. a whole pass and its parts
+    class GpuTimer {
+
+    public:
+        GpuTimer();
+
+        void create();
+        void destroy();
+
+        void begin();
+        void end();
+
+        //latest finished measurement in milliseconds
+        double getMilliseconds();
+
+    private:
+        static const int LATENCY = 4;
+
+        //begin/end timestamp pairs
+        GLuint queries[2 * LATENCY];
+        bool pending[LATENCY];
+        int current;
+        double milliseconds;
+
+        void collect(int query, bool wait);
+    };
+}
+
+#endif /* GpuTimer_hpp */
@@ -0,0 +1,158 @@
+#include "HeightMap.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cfloat>
+
+namespace gps {
+
+    HeightMap::HeightMap() {
+
+        this->resolution = 0;
+        this->gridResolution = 0;
+        this->valid = false;
+        this->framebuffer = 0;
+        this->depthTexture = 0;
+        this->matrix = glm::mat4(1.0f);
+        this->cullFace = true;
+        this->areaMin = glm::vec2(0.0f);
+        this->areaSize = glm::vec2(0.0f);
+        this->top = 0.0f;
+        this->depthRange = 0.0f;
+    }
+
+    void HeightMap::init(int resolution, int gridResolution) {
+
+        this->resolution = resolution;
+        this->gridResolution = std::min(gridResolution, resolution);
+        this->valid = false;
+
+        //plain depth values, the rain update does its own comparison
+        glGenTextures(1, &this->depthTexture);
+        glBindTexture(GL_TEXTURE_2D, this->depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, resolution, resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &this->framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void HeightMap::destroy() {
+
+        glDeleteFramebuffers(1, &this->framebuffer);
+        glDeleteTextures(1, &this->depthTexture);
+        this->framebuffer = 0;
+        this->depthTexture = 0;
+        this->valid = false;
+    }
+
+    void HeightMap::invalidate() {
+
+        this->valid = false;
+    }
+
+    bool HeightMap::isValid() {
+
+        return this->valid;
+    }
+
+    glm::mat4 HeightMap::begin(const gps::BoundingBox& bounds) {
+
+        //a little above the highest point, looking down with x to the right and -z up
+        glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+        glm::vec3 halfSize = (bounds.max - bounds.min) * 0.5f;
+        this->top = bounds.max.y + 1.0f;
+        this->depthRange = this->top - bounds.min.y + 1.0f;
+        this->areaMin = glm::vec2(bounds.min.x, bounds.min.z);
+        this->areaSize = glm::max(glm::vec2(halfSize.x, halfSize.z) * 2.0f, glm::vec2(1.0e-3f));
+
+        glm::mat4 lightView = glm::lookAt(glm::vec3(center.x, this->top, center.z), glm::vec3(center.x, bounds.min.y, center.z),
+            glm::vec3(0.0f, 0.0f, -1.0f));
+        glm::mat4 lightProjection = glm::ortho(-this->areaSize.x * 0.5f, this->areaSize.x * 0.5f,
+            -this->areaSize.y * 0.5f, this->areaSize.y * 0.5f, 0.0f, this->depthRange);
+        this->matrix = lightProjection * lightView;
+
+        //both sides of every surface count, a roof seen from above may well face down
+        this->cullFace = glIsEnabled(GL_CULL_FACE) == GL_TRUE;
+        glDisable(GL_CULL_FACE);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glViewport(0, 0, this->resolution, this->resolution);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        return this->matrix;
+    }
+
+    void HeightMap::end() {
+
+        //the one readback of the capture, rows run from +z (bottom) to -z (top)
+        std::vector<GLfloat> depth((size_t)this->resolution * this->resolution);
+        glReadPixels(0, 0, this->resolution, this->resolution, GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (this->cullFace) {
+            glEnable(GL_CULL_FACE);
+        }
+
+        //the highest texel under every cell, grid rows run from -z to +z
+        int block = this->resolution / this->gridResolution;
+        this->heights.assign((size_t)this->gridResolution * this->gridResolution, -FLT_MAX);
+        for (int y = 0; y < this->resolution; y++) {
+            int row = std::min((this->resolution - 1 - y) / block, this->gridResolution - 1);
+            for (int x = 0; x < this->resolution; x++) {
+                int column = std::min(x / block, this->gridResolution - 1);
+                float height = this->top - depth[(size_t)y * this->resolution + x] * this->depthRange;
+                float& cell = this->heights[(size_t)row * this->gridResolution + column];
+                cell = std::max(cell, height);
+            }
+        }
+
+        this->valid = true;
+    }
+
+    GLuint HeightMap::getTexture() {
+
+        return this->depthTexture;
+    }
+
+    glm::mat4 HeightMap::getMatrix() {
+
+        return this->matrix;
+    }
+
+    float HeightMap::getHeight(float x, float z) const {
+
+        if (this->heights.empty()) {
+            return -FLT_MAX;
+        }
+
+        //grid coordinates with the cell centers on whole numbers
+        float u = (x - this->areaMin.x) / this->areaSize.x * this->gridResolution - 0.5f;
+        float v = (z - this->areaMin.y) / this->areaSize.y * this->gridResolution - 0.5f;
+        if (u < -0.5f || v < -0.5f || u > this->gridResolution - 0.5f || v > this->gridResolution - 0.5f) {
+            return -FLT_MAX;
+        }
+
+        int last = this->gridResolution - 1;
+        float column = glm::clamp(u, 0.0f, (float)last);
+        float row = glm::clamp(v, 0.0f, (float)last);
+        int column0 = std::min((int)column, last);
+        int row0 = std::min((int)row, last);
+        int column1 = std::min(column0 + 1, last);
+        int row1 = std::min(row0 + 1, last);
+        float s = column - column0;
+        float t = row - row0;
+
+        const float* heights = this->heights.data();
+        float top = heights[row0 * this->gridResolution + column0] * (1.0f - s) + heights[row0 * this->gridResolution + column1] * s;
+        float bottom = heights[row1 * this->gridResolution + column0] * (1.0f - s) + heights[row1 * this->gridResolution + column1] * s;
+        return top * (1.0f - t) + bottom * t;
+    }
+}
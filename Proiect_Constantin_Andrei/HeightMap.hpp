@@ -0,0 +1,70 @@
+#ifndef HeightMap_hpp
+#define HeightMap_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //highest surface of the static scene seen from straight above, for rain that stops on roofs
+    //
+    //the depth of a top-down orthographic view is captured once, like a static shadow map, and kept
+    //until invalidate(); the GPU compares against the depth texture, the CPU reads a smaller grid of
+    //heights made of the highest texel under every cell, so thin roofs survive the downsampling
+    class HeightMap {
+
+    public:
+        HeightMap();
+
+        //resolution - side of the depth texture, gridResolution - side of the CPU grid (at most resolution)
+        void init(int resolution, int gridResolution);
+        void destroy();
+
+        //the scene changed, capture again
+        void invalidate();
+        //true once a capture is done and nothing invalidated it
+        bool isValid();
+
+        //binds the depth target for a view from above bounds and returns the matrix to draw the scene with
+        glm::mat4 begin(const gps::BoundingBox& bounds);
+        //reads the depth back into the grid, leaves the default framebuffer bound
+        void end();
+
+        //depth of the highest surface, compare with the depth of a point through getMatrix
+        GLuint getTexture();
+        glm::mat4 getMatrix();
+        //highest surface at x, z (bilinear between grid cells), -FLT_MAX outside the captured area
+        float getHeight(float x, float z) const;
+
+    private:
+        int resolution;
+        int gridResolution;
+        bool valid;
+
+        GLuint framebuffer;
+        GLuint depthTexture;
+        glm::mat4 matrix;
+        bool cullFace;
+
+        //captured area, the top of the view and its depth range
+        glm::vec2 areaMin;
+        glm::vec2 areaSize;
+        float top;
+        float depthRange;
+        //gridResolution x gridResolution heights, rows along z
+        std::vector<float> heights;
+    };
+}
+
+#endif /* HeightMap_hpp */
@@ -0,0 +1,218 @@
+#include "LightClusters.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace gps {
+
+    LightClusters::LightClusters() {
+
+        this->nearPlane = 0.1f;
+        this->farPlane = 100.0f;
+        this->threadPool = NULL;
+        this->tileScale = glm::vec2(0.0f);
+        this->depthScale = glm::vec2(0.0f);
+        this->milliseconds = 0.0;
+    }
+
+    void LightClusters::init(float nearPlane, float farPlane, ThreadPool* threadPool) {
+
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+        this->threadPool = threadPool;
+
+        //slice = log(depth / near) * GRID_Z / log(far / near), as a single multiply-add of log(depth)
+        float scale = GRID_Z / std::log(farPlane / nearPlane);
+        this->depthScale = glm::vec2(scale, -std::log(nearPlane) * scale);
+
+        this->ranges.assign(CLUSTER_COUNT * 2, 0);
+        this->sliceIndices.resize(GRID_Z);
+
+        this->rangeBuffer.create(GL_RG32UI, CLUSTER_COUNT * 2 * sizeof(GLuint));
+        this->indexBuffer.create(GL_R16UI, CLUSTER_COUNT * 8 * sizeof(GLushort));
+    }
+
+    void LightClusters::destroy() {
+
+        this->rangeBuffer.destroy();
+        this->indexBuffer.destroy();
+    }
+
+    void LightClusters::update(const glm::mat4& view, const glm::mat4& projection, int width, int height, LightManager& lights) {
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        this->tileScale = glm::vec2((float)GRID_X / std::max(width, 1), (float)GRID_Y / std::max(height, 1));
+
+        int lightCount = lights.getPointLightCount();
+        this->cells.resize(lightCount);
+
+        //the light bounds are independent, then every slice builds its own lists
+        std::function<void(int, int)> computeTask = [&](int begin, int end) {
+            computeCells(view, projection, lights, begin, end);
+        };
+        std::function<void(int, int)> fillTask = [&](int begin, int end) {
+            for (int slice = begin; slice < end; slice++) {
+                fillSlice(slice, lightCount);
+            }
+        };
+        if (this->threadPool) {
+            this->threadPool->parallelFor(lightCount, 64, computeTask);
+            this->threadPool->parallelFor(GRID_Z, 1, fillTask);
+        }
+        else {
+            computeTask(0, lightCount);
+            fillTask(0, GRID_Z);
+        }
+
+        //slices were filled with local offsets, shift them to where each slice lands
+        this->indices.clear();
+        for (int slice = 0; slice < GRID_Z; slice++) {
+            GLuint base = (GLuint)this->indices.size();
+            for (int cluster = slice * GRID_X * GRID_Y; cluster < (slice + 1) * GRID_X * GRID_Y; cluster++) {
+                this->ranges[cluster * 2] += base;
+            }
+            this->indices.insert(this->indices.end(), this->sliceIndices[slice].begin(), this->sliceIndices[slice].end());
+        }
+
+        this->rangeBuffer.update(this->ranges.data(), this->ranges.size() * sizeof(GLuint));
+        this->indexBuffer.update(this->indices.data(), this->indices.size() * sizeof(GLushort));
+
+        this->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void LightClusters::computeCells(const glm::mat4& view, const glm::mat4& projection, LightManager& lights, int begin, int end) {
+
+        for (int i = begin; i < end; i++) {
+            LightCells& cell = this->cells[i];
+            glm::vec3 center = glm::vec3(view * glm::vec4(lights.getPointLight(i).position, 1.0f));
+            float radius = lights.getPointLightRange(i);
+
+            //empty until proven otherwise
+            cell.minX = cell.minY = cell.minZ = 1;
+            cell.maxX = cell.maxY = cell.maxZ = 0;
+
+            float depth = -center.z;
+            if (depth + radius < this->nearPlane) {
+                continue;
+            }
+            cell.minZ = sliceOf(depth - radius);
+            cell.maxZ = sliceOf(depth + radius);
+
+            //the tile borders are planes through the eye: clip.x = u * clip.w for u = -1 + 2 * column / GRID_X,
+            //the signed distance to each is positive on the right; a column is touched when the light
+            //is not entirely left of its left border nor entirely right of its right border
+            cell.minX = GRID_X;
+            cell.maxX = -1;
+            float previous = 0.0f;
+            for (int column = 0; column <= GRID_X; column++) {
+                float u = -1.0f + 2.0f * column / GRID_X;
+                glm::vec2 normal = glm::vec2(projection[0][0], projection[2][0] + u);
+                float distance = (normal.x * center.x + normal.y * center.z) / glm::length(normal);
+                if (column > 0 && previous > -radius && distance < radius) {
+                    cell.minX = std::min(cell.minX, column - 1);
+                    cell.maxX = column - 1;
+                }
+                previous = distance;
+            }
+
+            cell.minY = GRID_Y;
+            cell.maxY = -1;
+            for (int row = 0; row <= GRID_Y; row++) {
+                float v = -1.0f + 2.0f * row / GRID_Y;
+                glm::vec2 normal = glm::vec2(projection[1][1], projection[2][1] + v);
+                float distance = (normal.x * center.y + normal.y * center.z) / glm::length(normal);
+                if (row > 0 && previous > -radius && distance < radius) {
+                    cell.minY = std::min(cell.minY, row - 1);
+                    cell.maxY = row - 1;
+                }
+                previous = distance;
+            }
+        }
+    }
+
+    void LightClusters::fillSlice(int slice, int lightCount) {
+
+        const int sliceClusters = GRID_X * GRID_Y;
+        GLuint* sliceRanges = &this->ranges[slice * sliceClusters * 2];
+        std::vector<GLushort>& sliceList = this->sliceIndices[slice];
+
+        //count, then place every light at its cluster's running offset
+        for (int cluster = 0; cluster < sliceClusters; cluster++) {
+            sliceRanges[cluster * 2 + 1] = 0;
+        }
+        for (int i = 0; i < lightCount; i++) {
+            const LightCells& cell = this->cells[i];
+            if (slice < cell.minZ || slice > cell.maxZ) {
+                continue;
+            }
+            for (int y = cell.minY; y <= cell.maxY; y++) {
+                for (int x = cell.minX; x <= cell.maxX; x++) {
+                    sliceRanges[(y * GRID_X + x) * 2 + 1]++;
+                }
+            }
+        }
+
+        GLuint offset = 0;
+        for (int cluster = 0; cluster < sliceClusters; cluster++) {
+            sliceRanges[cluster * 2] = offset;
+            offset += sliceRanges[cluster * 2 + 1];
+            sliceRanges[cluster * 2 + 1] = 0;
+        }
+        sliceList.resize(offset);
+
+        for (int i = 0; i < lightCount; i++) {
+            const LightCells& cell = this->cells[i];
+            if (slice < cell.minZ || slice > cell.maxZ) {
+                continue;
+            }
+            for (int y = cell.minY; y <= cell.maxY; y++) {
+                for (int x = cell.minX; x <= cell.maxX; x++) {
+                    GLuint* range = &sliceRanges[(y * GRID_X + x) * 2];
+                    sliceList[range[0] + range[1]++] = (GLushort)i;
+                }
+            }
+        }
+    }
+
+    int LightClusters::sliceOf(float depth) {
+
+        if (depth <= this->nearPlane) {
+            return 0;
+        }
+        int slice = (int)(std::log(depth) * this->depthScale.x + this->depthScale.y);
+        return std::min(std::max(slice, 0), GRID_Z - 1);
+    }
+
+    GLuint LightClusters::getRangeTexture() {
+        return this->rangeBuffer.getTexture();
+    }
+
+    GLuint LightClusters::getIndexTexture() {
+        return this->indexBuffer.getTexture();
+    }
+
+    glm::vec2 LightClusters::getTileScale() {
+        return this->tileScale;
+    }
+
+    glm::vec2 LightClusters::getDepthScale() {
+        return this->depthScale;
+    }
+
+    int LightClusters::getIndexCount() {
+        return (int)this->indices.size();
+    }
+
+    double LightClusters::getMilliseconds() {
+        return this->milliseconds;
+    }
+
+    std::string LightClusters::getShaderDefines() {
+
+        return "#define CLUSTER_GRID_X " + std::to_string(GRID_X) + "\n"
+            + "#define CLUSTER_GRID_Y " + std::to_string(GRID_Y) + "\n"
+            + "#define CLUSTER_GRID_Z " + std::to_string(GRID_Z);
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef LightClusters_hpp
+#define LightClusters_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "LightManager.hpp"
+#include "TextureBuffer.hpp"
+#include "ThreadPool.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //clustered light assignment: the view frustum is split into GRID_X x GRID_Y screen tiles
+    //and GRID_Z exponential depth slices, and every cluster gets the list of point lights whose
+    //range reaches it, so a fragment only shades the lights of its own cluster
+    //the lists are built on the CPU, spread over a thread pool, and read by basic.frag from
+    //two buffer textures: (offset, count) per cluster and the concatenated light indices
+    class LightClusters {
+
+    public:
+        static const int GRID_X = 16;
+        static const int GRID_Y = 9;
+        static const int GRID_Z = 24;
+        static const int CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+
+        LightClusters();
+
+        //nearPlane - view depth where the first slice starts, farPlane - where the last slice ends,
+        //fragments and lights beyond it go to the last slice
+        void init(float nearPlane, float farPlane, ThreadPool* threadPool);
+        void destroy();
+
+        //assigns the point lights to the clusters of this view, width and height in pixels
+        void update(const glm::mat4& view, const glm::mat4& projection, int width, int height, LightManager& lights);
+
+        GLuint getRangeTexture();
+        GLuint getIndexTexture();
+        //clusters per pixel, multiplies gl_FragCoord.xy
+        glm::vec2 getTileScale();
+        //slice = log(view depth) * x + y
+        glm::vec2 getDepthScale();
+        //light indices over all clusters, after the last update
+        int getIndexCount();
+        //CPU time of the last update
+        double getMilliseconds();
+
+        //#define lines with the grid size, for the programs that read the clusters
+        static std::string getShaderDefines();
+
+    private:
+        //clusters touched by one light, inclusive, empty when max < min
+        struct LightCells {
+            int minX, maxX;
+            int minY, maxY;
+            int minZ, maxZ;
+        };
+
+        float nearPlane;
+        float farPlane;
+        ThreadPool* threadPool;
+        glm::vec2 tileScale;
+        glm::vec2 depthScale;
+
+        std::vector<LightCells> cells;
+        //(offset, count) of every cluster
+        std::vector<GLuint> ranges;
+        //light indices of each depth slice, concatenated after all slices are done
+        std::vector<std::vector<GLushort>> sliceIndices;
+        std::vector<GLushort> indices;
+        double milliseconds;
+
+        TextureBuffer rangeBuffer;
+        TextureBuffer indexBuffer;
+
+        void computeCells(const glm::mat4& view, const glm::mat4& projection, LightManager& lights, int begin, int end);
+        void fillSlice(int slice, int lightCount);
+        int sliceOf(float depth);
+    };
+}
+
+#endif /* LightClusters_hpp */
@@ -0,0 +1,164 @@
+#include "LightManager.hpp"
+
+#include <cmath>
+#include <iostream>
+
+namespace gps {
+
+    LightManager::LightManager() {
+
+        this->data = LightUniforms();
+        this->dirty = true;
+        this->pointLightsDirty = true;
+    }
+
+    void LightManager::create(GLuint bindingPoint) {
+
+        this->buffer.create(sizeof(LightUniforms), bindingPoint);
+        this->pointLightBuffer.create(GL_RGBA32F, sizeof(PointLightData) * 64);
+        this->dirty = true;
+        this->pointLightsDirty = true;
+    }
+
+    void LightManager::destroy() {
+
+        this->pointLightBuffer.destroy();
+        this->buffer.destroy();
+    }
+
+    int LightManager::addPointLight(const PointLight& light) {
+
+        if ((int)this->pointLights.size() >= MAX_POINT_LIGHTS) {
+            std::cerr << "WARNING: more than " << MAX_POINT_LIGHTS << " point lights, ignoring the new one" << std::endl;
+            return -1;
+        }
+
+        this->pointLights.push_back(light);
+        this->pointLightData.push_back(PointLightData());
+        int index = (int)this->pointLights.size() - 1;
+        setPointLight(index, light);
+        return index;
+    }
+
+    int LightManager::addSpotLight(const SpotLight& light) {
+
+        if ((int)this->spotLights.size() >= MAX_SPOT_LIGHTS) {
+            std::cerr << "WARNING: more than " << MAX_SPOT_LIGHTS << " spot lights, ignoring the new one" << std::endl;
+            return -1;
+        }
+
+        this->spotLights.push_back(light);
+        int index = (int)this->spotLights.size() - 1;
+        setSpotLight(index, light);
+        setSpotShadow(index, glm::mat4(1.0f), glm::vec4(0.0f));
+        return index;
+    }
+
+    void LightManager::setPointLight(int index, const PointLight& light) {
+
+        this->pointLights[index] = light;
+
+        PointLightData& gpu = this->pointLightData[index];
+        gpu.position = glm::vec4(light.position, computeRange(light.constant, light.linear, light.quadratic));
+        gpu.attenuation = glm::vec4(light.constant, light.linear, light.quadratic, 0.0f);
+        gpu.ambient = glm::vec4(light.ambient, 0.0f);
+        gpu.diffuse = glm::vec4(light.diffuse, 0.0f);
+        gpu.specular = glm::vec4(light.specular, 0.0f);
+
+        this->data.counts.x = (int)this->pointLights.size();
+        this->dirty = true;
+        this->pointLightsDirty = true;
+    }
+
+    void LightManager::setSpotLight(int index, const SpotLight& light) {
+
+        this->spotLights[index] = light;
+
+        SpotLightData& gpu = this->data.spotLights[index];
+        gpu.position = glm::vec4(light.position, computeRange(light.constant, light.linear, light.quadratic));
+        gpu.direction = glm::vec4(glm::normalize(light.direction), light.cutOff);
+        gpu.attenuation = glm::vec4(light.constant, light.linear, light.quadratic, light.outerCutOff);
+        gpu.ambient = glm::vec4(light.ambient, 0.0f);
+        gpu.diffuse = glm::vec4(light.diffuse, 0.0f);
+        gpu.specular = glm::vec4(light.specular, 0.0f);
+
+        this->data.counts.y = (int)this->spotLights.size();
+        this->dirty = true;
+    }
+
+    void LightManager::setSpotShadow(int index, glm::mat4 shadowMatrix, glm::vec4 shadowRect) {
+
+        SpotLightData& gpu = this->data.spotLights[index];
+        if (gpu.shadowMatrix != shadowMatrix || gpu.shadowRect != shadowRect) {
+            gpu.shadowMatrix = shadowMatrix;
+            gpu.shadowRect = shadowRect;
+            this->dirty = true;
+        }
+    }
+
+    void LightManager::removePointLights() {
+
+        this->pointLights.clear();
+        this->pointLightData.clear();
+        this->data.counts.x = 0;
+        this->dirty = true;
+        this->pointLightsDirty = true;
+    }
+
+    void LightManager::clear() {
+
+        removePointLights();
+        this->spotLights.clear();
+        this->data.counts.y = 0;
+    }
+
+    const PointLight& LightManager::getPointLight(int index) {
+        return this->pointLights[index];
+    }
+
+    const SpotLight& LightManager::getSpotLight(int index) {
+        return this->spotLights[index];
+    }
+
+    int LightManager::getPointLightCount() {
+        return (int)this->pointLights.size();
+    }
+
+    int LightManager::getSpotLightCount() {
+        return (int)this->spotLights.size();
+    }
+
+    float LightManager::getPointLightRange(int index) {
+        return this->pointLightData[index].position.w;
+    }
+
+    GLuint LightManager::getPointLightTexture() {
+        return this->pointLightBuffer.getTexture();
+    }
+
+    void LightManager::upload() {
+
+        if (this->dirty) {
+            this->buffer.update(&this->data, sizeof(LightUniforms));
+            this->dirty = false;
+        }
+        if (this->pointLightsDirty) {
+            this->pointLightBuffer.update(this->pointLightData.data(), this->pointLightData.size() * sizeof(PointLightData));
+            this->pointLightsDirty = false;
+        }
+    }
+
+    std::string LightManager::getShaderDefines() {
+
+        return "#define MAX_SPOT_LIGHTS " + std::to_string(MAX_SPOT_LIGHTS);
+    }
+
+    float LightManager::computeRange(float constant, float linear, float quadratic) {
+
+        const float threshold = 256.0f / 5.0f;
+        if (quadratic <= 0.0f) {
+            return linear > 0.0f ? (threshold - constant) / linear : 1000.0f;
+        }
+        return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * (constant - threshold))) / (2.0f * quadratic);
+    }
+}
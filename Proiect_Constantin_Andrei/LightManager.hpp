@@ -0,0 +1,144 @@
+#ifndef LightManager_hpp
+#define LightManager_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "UniformBuffer.hpp"
+#include "TextureBuffer.hpp"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //positions and directions in world space
+    struct PointLight {
+
+        glm::vec3 position;
+
+        float constant;
+        float linear;
+        float quadratic;
+
+        glm::vec3 ambient;
+        glm::vec3 diffuse;
+        glm::vec3 specular;
+    };
+
+    struct SpotLight {
+
+        glm::vec3 position;
+        glm::vec3 direction;
+
+        float constant;
+        float linear;
+        float quadratic;
+
+        glm::vec3 ambient;
+        glm::vec3 diffuse;
+        glm::vec3 specular;
+
+        //cosines of the inner and outer cone angles
+        float cutOff;
+        float outerCutOff;
+    };
+
+    //point and spot lights of the scene
+    //the spot lights and the live counts are one std140 uniform block (LightUniforms in basic.frag),
+    //the point lights - too many for a uniform block - a buffer texture of POINT_LIGHT_TEXELS vec4s each;
+    //any change is sent with a single update of each buffer per frame, whatever the number of lights
+    class LightManager {
+
+    public:
+        static const int MAX_POINT_LIGHTS = 1024;
+        //the spot lights fit in the 16 KB every GL implementation guarantees for a uniform block
+        static const int MAX_SPOT_LIGHTS = 32;
+        static const int POINT_LIGHT_TEXELS = 5;
+
+        LightManager();
+
+        void create(GLuint bindingPoint);
+        void destroy();
+
+        //return the index of the new light, -1 when the array is full
+        int addPointLight(const PointLight& light);
+        int addSpotLight(const SpotLight& light);
+        void setPointLight(int index, const PointLight& light);
+        void setSpotLight(int index, const SpotLight& light);
+        //light space matrix and atlas tile of the spot light shadow, a zero rect disables it
+        void setSpotShadow(int index, glm::mat4 shadowMatrix, glm::vec4 shadowRect);
+        void removePointLights();
+        void clear();
+
+        const PointLight& getPointLight(int index);
+        const SpotLight& getSpotLight(int index);
+        int getPointLightCount();
+        int getSpotLightCount();
+        //distance where the attenuation of the point light drops below 5/256
+        float getPointLightRange(int index);
+
+        //buffer texture with the point lights, read with texelFetch
+        GLuint getPointLightTexture();
+
+        //sends the block and the point lights if anything changed since the last upload
+        void upload();
+
+        //#define lines with the array capacities, for the programs that declare the block
+        static std::string getShaderDefines();
+
+        //distance where the attenuation drops below 5/256
+        static float computeRange(float constant, float linear, float quadratic);
+
+    private:
+        //mirrors of the structs in basic.frag
+        struct PointLightData {
+            //w - range
+            glm::vec4 position;
+            //constant, linear, quadratic
+            glm::vec4 attenuation;
+            glm::vec4 ambient;
+            glm::vec4 diffuse;
+            glm::vec4 specular;
+        };
+
+        struct SpotLightData {
+            //w - range
+            glm::vec4 position;
+            //w - cos of the inner cone angle
+            glm::vec4 direction;
+            //constant, linear, quadratic, cos of the outer cone angle
+            glm::vec4 attenuation;
+            glm::vec4 ambient;
+            glm::vec4 diffuse;
+            glm::vec4 specular;
+            glm::mat4 shadowMatrix;
+            //xy - offset, zw - size in the shadow atlas
+            glm::vec4 shadowRect;
+        };
+
+        struct LightUniforms {
+            //x - point lights, y - spot lights
+            glm::ivec4 counts;
+            SpotLightData spotLights[MAX_SPOT_LIGHTS];
+        };
+
+        std::vector<PointLight> pointLights;
+        std::vector<SpotLight> spotLights;
+        LightUniforms data;
+        std::vector<PointLightData> pointLightData;
+        bool dirty;
+        bool pointLightsDirty;
+        gps::UniformBuffer buffer;
+        gps::TextureBuffer pointLightBuffer;
+    };
+}
+
+#endif /* LightManager_hpp */
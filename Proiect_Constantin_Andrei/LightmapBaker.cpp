@@ -0,0 +1,437 @@
+#include "LightmapBaker.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    const float LightmapBaker::OCCLUSION_DISTANCE = 0.02f;
+    const float LightmapBaker::ALBEDO = 0.5f;
+    const float LightmapBaker::GROUND_RADIANCE = 0.2f;
+
+    namespace {
+
+        const float PI = 3.14159265358979f;
+        //density is shrunk by this much each time the charts do not fit, up to MAX_PACK_ATTEMPTS times
+        const float PACK_SHRINK = 0.9f;
+        const int MAX_PACK_ATTEMPTS = 100;
+        //fraction of the lightmap the first packing attempt aims to fill
+        const float PACK_FILL = 0.7f;
+
+        unsigned long long hashBytes(unsigned long long hash, const void* data, size_t size) {
+
+            //FNV-1a
+            const unsigned char* bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+    }
+
+    LightmapBaker::LightmapBaker() {
+
+        this->resolution = 1024;
+        this->samples = 64;
+        this->bounces = 2;
+        this->texture = 0;
+        this->milliseconds = 0.0;
+        this->occlusionDistance = 0.0f;
+        this->rayOffset = 0.0f;
+    }
+
+    void LightmapBaker::setResolution(int resolution) {
+
+        this->resolution = std::max(resolution, 16);
+    }
+
+    void LightmapBaker::setSamples(int samples) {
+
+        this->samples = std::max(samples, 1);
+    }
+
+    void LightmapBaker::setBounces(int bounces) {
+
+        this->bounces = std::max(bounces, 0);
+    }
+
+    bool LightmapBaker::bake(Model3D& model, const std::string& cachePath, ThreadPool* threadPool) {
+
+        destroy();
+        this->milliseconds = 0.0;
+
+        gatherTriangles(model);
+        if (this->positions.empty()) {
+            return false;
+        }
+        if (!packCharts()) {
+            std::cerr << "ERROR: lightmap charts do not fit in " << this->resolution << "x" << this->resolution << std::endl;
+            return false;
+        }
+        assignCoordinates(model);
+
+        unsigned long long hash = computeHash();
+        this->texels.assign((size_t)this->resolution * this->resolution, glm::vec4(0.0f));
+
+        if (!loadCache(cachePath, hash)) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            this->bvh.build(this->positions);
+
+            BoundingBox bounds;
+            for (size_t i = 0; i < this->positions.size(); i++) {
+                bounds.extend(this->positions[i]);
+            }
+            float diagonal = glm::length(bounds.max - bounds.min);
+            this->occlusionDistance = OCCLUSION_DISTANCE * diagonal;
+            this->rayOffset = 1e-4f * diagonal;
+
+            //charts own disjoint texels, so they are traced independently
+            std::function<void(int, int)> bakeTask = [&](int begin, int end) {
+                bakeCharts(begin, end);
+            };
+            if (threadPool) {
+                threadPool->parallelFor((int)this->charts.size(), 16, bakeTask);
+            }
+            else {
+                bakeTask(0, (int)this->charts.size());
+            }
+
+            this->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Baked a " << this->resolution << "x" << this->resolution << " lightmap for " << this->charts.size()
+                << " triangles in " << this->milliseconds << " ms" << std::endl;
+
+            saveCache(cachePath, hash);
+            //the BVH is only needed while tracing
+            this->bvh = Bvh();
+        }
+
+        upload();
+
+        //the texels now live in the texture, the coordinates in the meshes
+        std::vector<glm::vec4>().swap(this->texels);
+        std::vector<glm::vec3>().swap(this->positions);
+        std::vector<glm::vec3>().swap(this->normals);
+        std::vector<Chart>().swap(this->charts);
+        return true;
+    }
+
+    void LightmapBaker::destroy() {
+
+        if (this->texture) {
+            glDeleteTextures(1, &this->texture);
+            this->texture = 0;
+        }
+    }
+
+    GLuint LightmapBaker::getTexture() {
+
+        return this->texture;
+    }
+
+    double LightmapBaker::getMilliseconds() {
+
+        return this->milliseconds;
+    }
+
+    void LightmapBaker::gatherTriangles(Model3D& model) {
+
+        this->positions.clear();
+        this->normals.clear();
+
+        for (int m = 0; m < model.GetMeshCount(); m++) {
+            const Mesh& mesh = model.GetMesh(m);
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                for (int corner = 0; corner < 3; corner++) {
+                    const Vertex& vertex = mesh.vertices[mesh.indices[i + corner]];
+                    this->positions.push_back(vertex.Position);
+                    this->normals.push_back(vertex.Normal);
+                }
+            }
+        }
+    }
+
+    bool LightmapBaker::packCharts() {
+
+        int triangleCount = (int)this->positions.size() / 3;
+        std::vector<glm::vec2> flat(triangleCount * 3);
+        float totalArea = 0.0f;
+
+        for (int t = 0; t < triangleCount; t++) {
+            glm::vec3 p0 = this->positions[t * 3];
+            glm::vec3 edge1 = this->positions[t * 3 + 1] - p0;
+            glm::vec3 edge2 = this->positions[t * 3 + 2] - p0;
+            glm::vec3 normal = glm::cross(edge1, edge2);
+            float doubleArea = glm::length(normal);
+            totalArea += 0.5f * doubleArea;
+
+            //2D frame in the plane of the triangle, x along the first edge
+            float edgeLength = glm::length(edge1);
+            glm::vec3 axisX = edgeLength > 0.0f ? edge1 / edgeLength : glm::vec3(1.0f, 0.0f, 0.0f);
+            glm::vec3 axisY = doubleArea > 0.0f ? glm::cross(normal / doubleArea, axisX) : glm::vec3(0.0f);
+
+            glm::vec2 corners[3] = {
+                glm::vec2(0.0f),
+                glm::vec2(edgeLength, 0.0f),
+                glm::vec2(glm::dot(edge2, axisX), glm::dot(edge2, axisY))
+            };
+            glm::vec2 minCorner = glm::min(corners[0], glm::min(corners[1], corners[2]));
+            for (int corner = 0; corner < 3; corner++) {
+                flat[t * 3 + corner] = corners[corner] - minCorner;
+            }
+        }
+
+        if (totalArea <= 0.0f) {
+            return false;
+        }
+
+        //each chart's rectangle is about twice its triangle
+        float density = std::sqrt(PACK_FILL * this->resolution * this->resolution / (2.0f * totalArea));
+        for (int attempt = 0; attempt < MAX_PACK_ATTEMPTS; attempt++) {
+            if (tryPack(flat, density)) {
+                return true;
+            }
+            density *= PACK_SHRINK;
+        }
+        return false;
+    }
+
+    bool LightmapBaker::tryPack(const std::vector<glm::vec2>& flat, float density) {
+
+        int triangleCount = (int)flat.size() / 3;
+        this->charts.resize(triangleCount);
+
+        for (int t = 0; t < triangleCount; t++) {
+            Chart& chart = this->charts[t];
+            chart.triangle = t;
+            glm::vec2 extent = glm::max(flat[t * 3], glm::max(flat[t * 3 + 1], flat[t * 3 + 2])) * density;
+            //one texel of padding on every side, so bilinear filtering never reads a neighbouring chart
+            chart.width = std::max((int)std::ceil(extent.x), 1) + 2;
+            chart.height = std::max((int)std::ceil(extent.y), 1) + 2;
+            for (int corner = 0; corner < 3; corner++) {
+                chart.corners[corner] = flat[t * 3 + corner] * density + glm::vec2(1.0f);
+            }
+        }
+
+        //shelves, tallest charts first
+        std::vector<int> order(triangleCount);
+        for (int t = 0; t < triangleCount; t++) {
+            order[t] = t;
+        }
+        std::sort(order.begin(), order.end(), [this](int a, int b) {
+            return this->charts[a].height > this->charts[b].height;
+        });
+
+        int x = 0;
+        int y = 0;
+        int shelfHeight = 0;
+        for (size_t i = 0; i < order.size(); i++) {
+            Chart& chart = this->charts[order[i]];
+            if (x + chart.width > this->resolution) {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            if (chart.width > this->resolution || y + chart.height > this->resolution) {
+                return false;
+            }
+
+            chart.x = x;
+            chart.y = y;
+            x += chart.width;
+            shelfHeight = std::max(shelfHeight, chart.height);
+        }
+        return true;
+    }
+
+    void LightmapBaker::assignCoordinates(Model3D& model) {
+
+        int triangle = 0;
+        for (int m = 0; m < model.GetMeshCount(); m++) {
+            Mesh& mesh = model.GetMesh(m);
+            std::vector<glm::vec2> coords(mesh.vertices.size(), glm::vec2(0.0f));
+
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                const Chart& chart = this->charts[triangle++];
+                for (int corner = 0; corner < 3; corner++) {
+                    coords[mesh.indices[i + corner]] = (glm::vec2((float)chart.x, (float)chart.y) + chart.corners[corner]) / (float)this->resolution;
+                }
+            }
+            mesh.SetLightmapCoords(coords);
+        }
+    }
+
+    void LightmapBaker::bakeCharts(int begin, int end) {
+
+        for (int c = begin; c < end; c++) {
+            const Chart& chart = this->charts[c];
+            //seeded per chart, the result does not depend on how the charts were split between threads
+            std::minstd_rand random(chart.triangle + 1);
+
+            const glm::vec3* p = &this->positions[chart.triangle * 3];
+            const glm::vec3* n = &this->normals[chart.triangle * 3];
+            glm::vec3 faceNormal = glm::cross(p[1] - p[0], p[2] - p[0]);
+            float faceLength = glm::length(faceNormal);
+            faceNormal = faceLength > 0.0f ? faceNormal / faceLength : glm::vec3(0.0f, 1.0f, 0.0f);
+
+            glm::vec2 edge1 = chart.corners[1] - chart.corners[0];
+            glm::vec2 edge2 = chart.corners[2] - chart.corners[0];
+            float determinant = edge1.x * edge2.y - edge2.x * edge1.y;
+
+            for (int j = 0; j < chart.height; j++) {
+                for (int i = 0; i < chart.width; i++) {
+                    //barycentrics of the texel center, clamped onto the triangle so the padding repeats its border
+                    float u = 1.0f / 3.0f;
+                    float v = 1.0f / 3.0f;
+                    if (std::fabs(determinant) > 1e-12f) {
+                        glm::vec2 offset = glm::vec2(i + 0.5f, j + 0.5f) - chart.corners[0];
+                        u = std::max((offset.x * edge2.y - edge2.x * offset.y) / determinant, 0.0f);
+                        v = std::max((edge1.x * offset.y - offset.x * edge1.y) / determinant, 0.0f);
+                        if (u + v > 1.0f) {
+                            float sum = u + v;
+                            u /= sum;
+                            v /= sum;
+                        }
+                    }
+                    float w = 1.0f - u - v;
+
+                    glm::vec3 position = p[0] * w + p[1] * u + p[2] * v;
+                    glm::vec3 normal = n[0] * w + n[1] * u + n[2] * v;
+                    float normalLength = glm::length(normal);
+                    normal = normalLength > 0.0f ? normal / normalLength : faceNormal;
+                    //leave the surface along the face normal, on the side the shading normal points to
+                    glm::vec3 origin = position + (glm::dot(faceNormal, normal) < 0.0f ? -faceNormal : faceNormal) * this->rayOffset;
+
+                    glm::vec3 radiance(0.0f);
+                    int unoccluded = 0;
+                    for (int s = 0; s < this->samples; s++) {
+                        bool occluded = false;
+                        radiance += traceRadiance(origin, sampleCosine(normal, random), 0, random, &occluded);
+                        if (!occluded) {
+                            unoccluded++;
+                        }
+                    }
+
+                    size_t texel = (size_t)(chart.y + j) * this->resolution + (chart.x + i);
+                    this->texels[texel] = glm::vec4(radiance / (float)this->samples, (float)unoccluded / this->samples);
+                }
+            }
+        }
+    }
+
+    glm::vec3 LightmapBaker::traceRadiance(glm::vec3 origin, glm::vec3 direction, int bounce, std::minstd_rand& random, bool* occluded) const {
+
+        RayHit hit;
+        if (!this->bvh.intersect(origin, direction, FLT_MAX, hit)) {
+            //uniform sky above the horizon, dim ground below it
+            return direction.y >= 0.0f ? glm::vec3(1.0f) : glm::vec3(GROUND_RADIANCE);
+        }
+
+        if (occluded) {
+            *occluded = hit.t < this->occlusionDistance;
+        }
+        if (bounce >= this->bounces) {
+            return glm::vec3(0.0f);
+        }
+
+        //diffuse two-sided bounce, cosine sampling cancels the cosine and the 1/pi of the BRDF
+        glm::vec3 normal = this->bvh.getTriangleNormal(hit.triangle);
+        if (glm::dot(normal, direction) > 0.0f) {
+            normal = -normal;
+        }
+        glm::vec3 point = origin + direction * hit.t + normal * this->rayOffset;
+        return ALBEDO * traceRadiance(point, sampleCosine(normal, random), bounce + 1, random, NULL);
+    }
+
+    glm::vec3 LightmapBaker::sampleCosine(glm::vec3 normal, std::minstd_rand& random) {
+
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+        float angle = 2.0f * PI * uniform(random);
+        float radiusSquared = uniform(random);
+        float radius = std::sqrt(radiusSquared);
+
+        glm::vec3 helper = std::fabs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 tangent = glm::normalize(glm::cross(helper, normal));
+        glm::vec3 bitangent = glm::cross(normal, tangent);
+
+        return tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) + normal * std::sqrt(1.0f - radiusSquared);
+    }
+
+    unsigned long long LightmapBaker::computeHash() const {
+
+        unsigned long long hash = 14695981039346656037ULL;
+        int settings[4] = { CACHE_VERSION, this->resolution, this->samples, this->bounces };
+        hash = hashBytes(hash, settings, sizeof(settings));
+        hash = hashBytes(hash, this->positions.data(), this->positions.size() * sizeof(glm::vec3));
+        hash = hashBytes(hash, this->normals.data(), this->normals.size() * sizeof(glm::vec3));
+        return hash;
+    }
+
+    bool LightmapBaker::loadCache(const std::string& path, unsigned long long hash) {
+
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        char magic[4];
+        int version = 0;
+        unsigned long long fileHash = 0;
+        int width = 0;
+        int height = 0;
+        file.read(magic, sizeof(magic));
+        file.read((char*)&version, sizeof(version));
+        file.read((char*)&fileHash, sizeof(fileHash));
+        file.read((char*)&width, sizeof(width));
+        file.read((char*)&height, sizeof(height));
+        if (!file || std::memcmp(magic, "LMAP", 4) != 0 || version != CACHE_VERSION || fileHash != hash
+            || width != this->resolution || height != this->resolution) {
+            //stale cache, the model or the settings changed
+            return false;
+        }
+
+        file.read((char*)this->texels.data(), this->texels.size() * sizeof(glm::vec4));
+        if (!file) {
+            std::cerr << "ERROR: truncated lightmap cache " << path << std::endl;
+            std::fill(this->texels.begin(), this->texels.end(), glm::vec4(0.0f));
+            return false;
+        }
+        return true;
+    }
+
+    void LightmapBaker::saveCache(const std::string& path, unsigned long long hash) {
+
+        std::ofstream file(path.c_str(), std::ios::binary);
+        if (!file) {
+            std::cerr << "ERROR: could not write the lightmap cache " << path << std::endl;
+            return;
+        }
+
+        int version = CACHE_VERSION;
+        file.write("LMAP", 4);
+        file.write((const char*)&version, sizeof(version));
+        file.write((const char*)&hash, sizeof(hash));
+        file.write((const char*)&this->resolution, sizeof(this->resolution));
+        file.write((const char*)&this->resolution, sizeof(this->resolution));
+        file.write((const char*)this->texels.data(), this->texels.size() * sizeof(glm::vec4));
+    }
+
+    void LightmapBaker::upload() {
+
+        glGenTextures(1, &this->texture);
+        glBindTexture(GL_TEXTURE_2D, this->texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, this->resolution, this->resolution, 0, GL_RGBA, GL_FLOAT, this->texels.data());
+        //no mipmaps, smaller levels would blend neighbouring charts
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+}
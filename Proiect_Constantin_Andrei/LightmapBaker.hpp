@@ -0,0 +1,103 @@
+#ifndef LightmapBaker_hpp
+#define LightmapBaker_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Bvh.hpp"
+#include "Model3D.hpp"
+#include "ThreadPool.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    //bakes the sky light reaching a static model into a lightmap, path traced on the CPU against a BVH
+    //every triangle gets its own chart, so the model's vertices must not be shared between triangles
+    //(ReadOBJ already gives every face its own vertices); the result is cached next to the model
+    class LightmapBaker {
+
+    public:
+        LightmapBaker();
+
+        //side of the square lightmap in texels
+        void setResolution(int resolution);
+        //rays per texel
+        void setSamples(int samples);
+        //bounces after the first hit, 0 keeps only the direct sky light
+        void setBounces(int bounces);
+
+        //assigns lightmap coordinates to every mesh of the model, then loads the lightmap from cachePath
+        //or bakes it (and writes the cache); returns false when the charts do not fit
+        bool bake(Model3D& model, const std::string& cachePath, ThreadPool* threadPool);
+        void destroy();
+
+        //rgb - sky irradiance relative to an open surface facing up, a - ambient occlusion
+        GLuint getTexture();
+        //time of the last bake, 0 when it came from the cache
+        double getMilliseconds();
+
+    private:
+        static const int CACHE_VERSION = 1;
+        //rays hitting something closer than this fraction of the model diagonal count as occluded
+        static const float OCCLUSION_DISTANCE;
+        //gray surfaces, the material textures only live on the GPU
+        static const float ALBEDO;
+        static const float GROUND_RADIANCE;
+
+        struct Chart {
+
+            //triangle in the positions/normals arrays (three entries each)
+            int triangle;
+            //corners in texels relative to the chart origin, inside the 1 texel padding
+            glm::vec2 corners[3];
+            int width;
+            int height;
+            //origin in the lightmap
+            int x;
+            int y;
+        };
+
+        int resolution;
+        int samples;
+        int bounces;
+        GLuint texture;
+        double milliseconds;
+
+        //three entries per triangle, in mesh order
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> normals;
+        std::vector<Chart> charts;
+        std::vector<glm::vec4> texels;
+        Bvh bvh;
+        float occlusionDistance;
+        float rayOffset;
+
+        void gatherTriangles(Model3D& model);
+        //lays every triangle flat and packs the charts on shelves, shrinking the texel density until they fit
+        bool packCharts();
+        //flat - corners of every triangle in its own plane, in model units
+        bool tryPack(const std::vector<glm::vec2>& flat, float density);
+        void assignCoordinates(Model3D& model);
+
+        void bakeCharts(int begin, int end);
+        glm::vec3 traceRadiance(glm::vec3 origin, glm::vec3 direction, int bounce, std::minstd_rand& random, bool* occluded) const;
+        static glm::vec3 sampleCosine(glm::vec3 normal, std::minstd_rand& random);
+
+        unsigned long long computeHash() const;
+        bool loadCache(const std::string& path, unsigned long long hash);
+        void saveCache(const std::string& path, unsigned long long hash);
+        void upload();
+    };
+}
+
+#endif /* LightmapBaker_hpp */
@@ -1,6 +1,52 @@
 #include "Mesh.hpp"
+
+#include <cfloat>
+
 namespace gps {
 
+	BoundingBox::BoundingBox() {
+
+		this->min = glm::vec3(FLT_MAX);
+		this->max = glm::vec3(-FLT_MAX);
+	}
+
+	bool BoundingBox::isEmpty() const {
+
+		return this->min.x > this->max.x;
+	}
+
+	void BoundingBox::extend(glm::vec3 point) {
+
+		this->min = glm::min(this->min, point);
+		this->max = glm::max(this->max, point);
+	}
+
+	void BoundingBox::extend(const BoundingBox& box) {
+
+		if (!box.isEmpty()) {
+			this->extend(box.min);
+			this->extend(box.max);
+		}
+	}
+
+	BoundingBox BoundingBox::transform(const glm::mat4& matrix) const {
+
+		BoundingBox result;
+		if (this->isEmpty()) {
+			return result;
+		}
+
+		for (int i = 0; i < 8; i++) {
+
+			glm::vec3 corner((i & 1) ? this->max.x : this->min.x,
+				(i & 2) ? this->max.y : this->min.y,
+				(i & 4) ? this->max.z : this->min.z);
+			result.extend(glm::vec3(matrix * glm::vec4(corner, 1.0f)));
+		}
+
+		return result;
+	}
+
 	/* Mesh Constructor */
 	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures) {
 
@@ -8,6 +54,14 @@ namespace gps {
 		this->indices = indices;
 		this->textures = textures;
 
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			this->layerUniforms.push_back(this->textures[i].type + "Layer");
+		}
+
+		for (size_t i = 0; i < this->vertices.size(); i++) {
+			this->bounds.extend(this->vertices[i].Position);
+		}
+
 		this->setupMesh();
 	}
 
@@ -15,30 +69,82 @@ namespace gps {
 	    return this->buffers;
 	}
 
+	BoundingBox Mesh::getBounds() {
+	    return this->bounds;
+	}
+
+	void Mesh::SetLightmapCoords(const std::vector<glm::vec2>& coords) {
+
+		for (size_t i = 0; i < this->vertices.size() && i < coords.size(); i++) {
+			this->vertices[i].LightmapCoords = coords[i];
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, this->vertices.size() * sizeof(Vertex), &this->vertices[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)	{
+	void Mesh::Draw(const gps::Shader& shader)	{
+
+		std::vector<GLuint> boundTextures;
+		this->Draw(shader, boundTextures);
+
+        for(GLuint i = 0; i < boundTextures.size(); i++) {
+
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+    }
+
+	/* Mesh drawing function - only binds the texture arrays that changed since the previous mesh */
+	void Mesh::Draw(const gps::Shader& shader, std::vector<GLuint>& boundTextures) {
 
 		shader.useShaderProgram();
 
 		//set textures
 		for (GLuint i = 0; i < textures.size(); i++) {
 
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			GLuint unit = TextureUnit(this->textures[i].type);
+			if (boundTextures.size() <= unit) {
+				boundTextures.resize(unit + 1, 0);
+			}
+
+			if (boundTextures[unit] != this->textures[i].id) {
+
+				glActiveTexture(GL_TEXTURE0 + unit);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, this->textures[i].id);
+				boundTextures[unit] = this->textures[i].id;
+			}
+
+			// the locations are cached by the shader, no driver query per draw
+			glUniform1i(shader.getUniformLocation(this->textures[i].type), unit);
+			glUniform1f(shader.getUniformLocation(this->layerUniforms[i]), (GLfloat)this->textures[i].layer);
 		}
 
 		glBindVertexArray(this->buffers.VAO);
 		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
 		glBindVertexArray(0);
+	}
 
-        for(GLuint i = 0; i < this->textures.size(); i++) {
+	/* Depth-only drawing function - 12 byte position stream, nothing bound but the VAO */
+	void Mesh::DrawDepth() {
 
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		glBindVertexArray(this->buffers.depthVAO);
+		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+	}
 
-    }
+	GLuint Mesh::TextureUnit(const std::string& type) {
+
+		if (type == "diffuseTexture") {
+			return 1;
+		}
+		if (type == "specularTexture") {
+			return 2;
+		}
+		return 0;
+	}
 
 	// Initializes all the buffer objects/arrays
 	void Mesh::setupMesh() {
@@ -66,6 +172,29 @@ namespace gps {
 		// Vertex Texture Coords
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		// Vertex Lightmap Coords
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, LightmapCoords));
+
+		glBindVertexArray(0);
+
+		// Position-only copy for the shadow passes, so they do not fetch normals and texture coords
+		std::vector<glm::vec3> positions(this->vertices.size());
+		for (size_t i = 0; i < this->vertices.size(); i++) {
+			positions[i] = this->vertices[i].Position;
+		}
+
+		glGenVertexArrays(1, &this->buffers.depthVAO);
+		glGenBuffers(1, &this->buffers.positionVBO);
+
+		glBindVertexArray(this->buffers.depthVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
 
 		glBindVertexArray(0);
 	}
@@ -24,11 +24,16 @@ namespace gps {
         glm::vec3 Position;
         glm::vec3 Normal;
         glm::vec2 TexCoords;
+        //position in the baked lightmap, see LightmapBaker
+        glm::vec2 LightmapCoords;
     };
 
     struct Texture {
 
+        //GL_TEXTURE_2D_ARRAY the texture was packed into
         GLuint id;
+        //layer of the texture inside the array
+        GLint layer;
         //ambientTexture, diffuseTexture, specularTexture
         std::string type;
         std::string path;
@@ -41,10 +46,27 @@ namespace gps {
         glm::vec3 specular;
     };
 
+    struct BoundingBox {
+
+        glm::vec3 min;
+        glm::vec3 max;
+
+        // Empty box, extending it by any point makes it valid
+        BoundingBox();
+        bool isEmpty() const;
+        void extend(glm::vec3 point);
+        void extend(const BoundingBox& box);
+        // Axis aligned box enclosing this box after the transform
+        BoundingBox transform(const glm::mat4& matrix) const;
+    };
+
     struct Buffers {
         GLuint VAO;
         GLuint VBO;
         GLuint EBO;
+        //tightly packed positions for depth-only passes, shares the EBO
+        GLuint depthVAO;
+        GLuint positionVBO;
     };
 
     class Mesh {
@@ -58,11 +80,31 @@ namespace gps {
 
 	    Buffers getBuffers();
 
-	    void Draw(gps::Shader shader);
+	    // Object space bounds of the vertices
+	    BoundingBox getBounds();
+
+	    // Replaces the lightmap coordinates of every vertex and uploads them
+	    void SetLightmapCoords(const std::vector<glm::vec2>& coords);
+
+	    void Draw(const gps::Shader& shader);
+
+	    // Same as Draw, but skips binding arrays that are already bound on their unit
+	    // boundTextures holds the array bound on each texture unit and is updated by the call
+	    void Draw(const gps::Shader& shader, std::vector<GLuint>& boundTextures);
+
+	    // Draws only the positions, no textures or uniforms are touched
+	    // the depth program must already be in use
+	    void DrawDepth();
+
+	    // Texture unit used for each texture type, so consecutive meshes sharing an array need no rebind
+	    static GLuint TextureUnit(const std::string& type);
 
     private:
         /*  Render data  */
         Buffers buffers;
+        BoundingBox bounds;
+        // "<type>Layer" uniform of each texture, built once instead of on every draw
+        std::vector<std::string> layerUniforms;
 
 	    // Initializes all the buffer objects/arrays
 	    void setupMesh();
@@ -14,10 +14,74 @@ namespace gps {
 	}
 
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram) {
+	void Model3D::Draw(const gps::Shader& shaderProgram) {
+
+		// meshes sharing a texture array are drawn without rebinding it
+		std::vector<GLuint> boundTextures;
 
 		for (int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shaderProgram);
+			meshes[i].Draw(shaderProgram, boundTextures);
+	}
+
+	int Model3D::DrawDepth(const glm::mat4& model, const glm::mat4& lightSpaceMatrix) {
+
+		glm::mat4 objectToLight = lightSpaceMatrix * model;
+		int drawn = 0;
+
+		for (size_t i = 0; i < meshes.size(); i++) {
+
+			// clip space corners of the mesh bounds, w kept so perspective lights work too
+			gps::BoundingBox bounds = meshes[i].getBounds();
+			glm::vec4 corners[8];
+			for (int c = 0; c < 8; c++) {
+				glm::vec3 corner((c & 1) ? bounds.max.x : bounds.min.x,
+					(c & 2) ? bounds.max.y : bounds.min.y,
+					(c & 4) ? bounds.max.z : bounds.min.z);
+				corners[c] = objectToLight * glm::vec4(corner, 1.0f);
+			}
+
+			// culled when all the corners are outside one side plane or behind the far plane
+			// the near plane is not tested, casters in front of it are clamped onto it by GL_DEPTH_CLAMP
+			int outside[5] = { 0, 0, 0, 0, 0 };
+			for (int c = 0; c < 8; c++) {
+				outside[0] += corners[c].x < -corners[c].w;
+				outside[1] += corners[c].x > corners[c].w;
+				outside[2] += corners[c].y < -corners[c].w;
+				outside[3] += corners[c].y > corners[c].w;
+				outside[4] += corners[c].z > corners[c].w;
+			}
+			if (outside[0] == 8 || outside[1] == 8 || outside[2] == 8 || outside[3] == 8 || outside[4] == 8)
+				continue;
+
+			meshes[i].DrawDepth();
+			drawn++;
+		}
+
+		return drawn;
+	}
+
+	int Model3D::GetMeshCount() {
+
+		return (int)meshes.size();
+	}
+
+	gps::Mesh& Model3D::GetMesh(int index) {
+
+		return meshes[index];
+	}
+
+	gps::BoundingBox Model3D::GetBounds() {
+
+		gps::BoundingBox bounds;
+		for (size_t i = 0; i < meshes.size(); i++)
+			bounds.extend(meshes[i].getBounds());
+
+		return bounds;
+	}
+
+	void Model3D::SetTextureResampleMode(RESAMPLE_MODE mode, int uniformSize) {
+
+		texturePacker.setResampleMode(mode, uniformSize);
 	}
 
 	// Does the parsing of the .obj file and fills in the data structure
@@ -91,6 +155,8 @@ namespace gps {
 					currentVertex.Position = vertexPosition;
 					currentVertex.Normal = vertexNormal;
 					currentVertex.TexCoords = vertexTexCoords;
+					// filled in by LightmapBaker for the models that get one
+					currentVertex.LightmapCoords = glm::vec2(0.0f);
 
 					vertices.push_back(currentVertex);
 
@@ -148,6 +214,9 @@ namespace gps {
 
 			meshes.push_back(gps::Mesh(vertices, indices, textures));
 		}
+
+		// upload all the textures read above into their arrays
+		texturePacker.build();
 	}
 
 	// Retrieves a texture associated with the object - by its name and type
@@ -162,8 +231,11 @@ namespace gps {
 				}
 			}
 
+			gps::TextureLayer textureLayer = ReadTextureFromFile(path.c_str());
+
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			currentTexture.id = textureLayer.arrayId;
+			currentTexture.layer = textureLayer.layer;
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
 
@@ -172,8 +244,8 @@ namespace gps {
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+	// Reads the pixel data from an image file and queues it into a texture array
+	gps::TextureLayer Model3D::ReadTextureFromFile(const char* file_name) {
 
 		int x, y, n;
 		int force_channels = 4;
@@ -181,13 +253,9 @@ namespace gps {
 
 		if (!image_data) {
 			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
-		}
-		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
-			fprintf(
-				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
-			);
+			// 1x1 white layer so the mesh still samples something sensible
+			unsigned char white[4] = { 255, 255, 255, 255 };
+			return texturePacker.add(white, 1, 1);
 		}
 
 		int width_in_bytes = x * 4;
@@ -211,37 +279,17 @@ namespace gps {
 			}
 		}
 
-		GLuint textureID;
-		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		return textureID;
+		// the packer keeps its own copy until the arrays are built
+		gps::TextureLayer textureLayer = texturePacker.add(image_data, x, y);
+		stbi_image_free(image_data);
+
+		return textureLayer;
 	}
 
 	Model3D::~Model3D() {
 
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
-
-            glDeleteTextures(1, &loadedTextures.at(i).id);
-        }
+        // loaded textures share the packer's arrays
+        texturePacker.release();
 
         for (size_t i = 0; i < meshes.size(); i++) {
 
@@ -2,6 +2,7 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "TexturePacker.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
@@ -21,13 +22,31 @@ namespace gps {
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram);
+		void Draw(const gps::Shader& shaderProgram);
+
+		// Depth-only draw of the meshes that can cast a shadow into the light volume
+		// lightSpaceMatrix maps world space to the light clip space (orthographic or perspective),
+		// the volume is extruded towards the light
+		// Returns the number of meshes drawn
+		int DrawDepth(const glm::mat4& model, const glm::mat4& lightSpaceMatrix);
+
+		int GetMeshCount();
+
+		gps::Mesh& GetMesh(int index);
+
+		// Object space bounds of all the meshes
+		gps::BoundingBox GetBounds();
+
+		// Controls how textures are resized when packed into arrays, call before LoadModel
+		void SetTextureResampleMode(RESAMPLE_MODE mode, int uniformSize = 0);
 
     private:
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
 		// Associated textures
         std::vector<gps::Texture> loadedTextures;
+		// Packs the textures into GL_TEXTURE_2D_ARRAY layers
+		gps::TexturePacker texturePacker;
 
 		// Does the parsing of the .obj file and fills in the data structure
 		void ReadOBJ(std::string fileName, std::string basePath);
@@ -35,8 +54,8 @@ namespace gps {
 		// Retrieves a texture associated with the object - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
 
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// Reads the pixel data from an image file and queues it into a texture array
+		gps::TextureLayer ReadTextureFromFile(const char* file_name);
     };
 }
 
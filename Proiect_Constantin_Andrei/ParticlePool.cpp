@@ -0,0 +1,375 @@
+#include "ParticlePool.hpp"
+#include "HeightMap.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+
+//AVX2 when the build enables it (/arch:AVX2, -mavx2), otherwise SSE2, which every x64 target has
+#if defined(__AVX2__)
+#define PARTICLES_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARTICLES_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    ParticleStep::ParticleStep() {
+
+        this->positionScale = 1.0f;
+        this->gravity = glm::vec3(0.0f);
+        this->floorHeight = -FLT_MAX;
+        this->ground = NULL;
+        this->groundOffset = glm::vec3(0.0f);
+    }
+
+    Xorshift::Xorshift(unsigned int seed) {
+
+        //zero is the one state xorshift never leaves
+        this->state = seed ? seed : 2463534242u;
+    }
+
+    unsigned int Xorshift::next() {
+
+        this->state ^= this->state << 13;
+        this->state ^= this->state >> 17;
+        this->state ^= this->state << 5;
+        return this->state;
+    }
+
+    float Xorshift::nextFloat() {
+
+        return (next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    //spreads the bits of the pool seed, the spawn call and the chunk over the generator state
+    static unsigned int mixSeed(unsigned int seed, unsigned int generation, unsigned int chunk) {
+
+        unsigned int x = seed ^ (generation * 0x9E3779B9u) ^ (chunk * 0x85EBCA6Bu);
+        x ^= x >> 16;
+        x *= 0x7FEB352Du;
+        x ^= x >> 15;
+        x *= 0x846CA68Bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    //every component uniform in [-1, 1)
+    static glm::vec3 randomSigned(Xorshift& random) {
+
+        float x = random.nextFloat();
+        float y = random.nextFloat();
+        float z = random.nextFloat();
+        return glm::vec3(x, y, z) * 2.0f - 1.0f;
+    }
+
+    ParticlePool::ParticlePool() {
+
+        this->capacity = 0;
+        this->count = 0;
+        this->simd = true;
+        this->seed = 0;
+        this->generation = 0;
+        for (int a = 0; a < ATTRIBUTE_COUNT; a++) {
+            this->arrays[a] = NULL;
+        }
+        this->floors = NULL;
+    }
+
+    void ParticlePool::create(int capacity, unsigned int seed) {
+
+        //every array padded to whole registers, the floors last, plus room to align the first one
+        int stride = (capacity + LANES - 1) / LANES * LANES;
+        this->storage.assign((size_t)stride * (ATTRIBUTE_COUNT + 1) + LANES, 0.0f);
+        float* base = this->storage.data();
+        uintptr_t misalignment = (uintptr_t)base % (LANES * sizeof(float));
+        if (misalignment) {
+            base += (LANES * sizeof(float) - misalignment) / sizeof(float);
+        }
+        for (int a = 0; a < ATTRIBUTE_COUNT; a++) {
+            this->arrays[a] = base + (size_t)stride * a;
+        }
+        this->floors = base + (size_t)stride * ATTRIBUTE_COUNT;
+
+        this->capacity = capacity;
+        this->count = 0;
+        this->seed = seed;
+        this->generation = 0;
+        this->dead.resize(capacity);
+    }
+
+    void ParticlePool::setSimd(bool enabled) {
+
+        this->simd = enabled;
+    }
+
+    const char* ParticlePool::getSimdName() {
+
+#if defined(PARTICLES_AVX2)
+        return "AVX2";
+#elif defined(PARTICLES_SSE2)
+        return "SSE2";
+#else
+        return "none";
+#endif
+    }
+
+    void ParticlePool::update(const ParticleStep& step, ThreadPool* threadPool, std::vector<glm::vec3>* floorHits) {
+
+        int chunkCount = (this->count + CHUNK - 1) / CHUNK;
+        this->chunkDead.resize(chunkCount);
+        forEachChunk(chunkCount, threadPool, [&](int beginChunk, int endChunk) {
+            for (int chunk = beginChunk; chunk < endChunk; chunk++) {
+                int begin = chunk * CHUNK;
+                int end = std::min(begin + CHUNK, this->count);
+                int* chunkDead = this->dead.data() + begin;
+
+                //the surface under every particle, looked up before the SIMD step
+                const float* floors = NULL;
+                if (step.ground) {
+                    for (int i = begin; i < end; i++) {
+                        float ground = step.ground->getHeight(step.groundOffset.x + this->arrays[POSITION_X][i],
+                            step.groundOffset.z + this->arrays[POSITION_Z][i]) - step.groundOffset.y;
+                        this->floors[i] = std::max(step.floorHeight, ground);
+                    }
+                    floors = this->floors;
+                }
+
+                this->chunkDead[chunk] = this->simd ? integrateSimd(begin, end, step, floors, chunkDead)
+                    : integrateScalar(begin, end, step, floors, chunkDead);
+            }
+        });
+
+        //highest first, so the last particle moved into a slot is always a live one
+        for (int chunk = chunkCount - 1; chunk >= 0; chunk--) {
+            for (int d = this->chunkDead[chunk] - 1; d >= 0; d--) {
+                int index = this->dead[chunk * CHUNK + d];
+                float floor = step.ground ? this->floors[index] : step.floorHeight;
+                if (floorHits && this->arrays[POSITION_Y][index] <= floor) {
+                    floorHits->push_back(glm::vec3(this->arrays[POSITION_X][index], this->arrays[POSITION_Y][index],
+                        this->arrays[POSITION_Z][index]));
+                }
+                removeDead(index);
+            }
+        }
+    }
+
+    int ParticlePool::spawn(int count, const ParticleSpawn& spawn, ThreadPool* threadPool) {
+
+        if (count > this->capacity - this->count) {
+            count = this->capacity - this->count;
+        }
+        if (count <= 0) {
+            return 0;
+        }
+
+        int first = this->count;
+        unsigned int generation = this->generation++;
+        forEachChunk((count + CHUNK - 1) / CHUNK, threadPool, [&](int beginChunk, int endChunk) {
+            for (int chunk = beginChunk; chunk < endChunk; chunk++) {
+                Xorshift random(mixSeed(this->seed, generation, chunk));
+                int end = first + std::min((chunk + 1) * CHUNK, count);
+                for (int i = first + chunk * CHUNK; i < end; i++) {
+                    glm::vec3 offset = randomSigned(random);
+                    if (spawn.shape == SPAWN_SPHERE) {
+                        //rejection keeps the ball uniform, about half the tries land inside
+                        while (glm::dot(offset, offset) > 1.0f) {
+                            offset = randomSigned(random);
+                        }
+                        offset = offset * spawn.extent.x;
+                    }
+                    else {
+                        offset = offset * spawn.extent;
+                    }
+                    glm::vec3 velocity = spawn.velocity + randomSigned(random) * spawn.velocitySpread;
+                    this->arrays[POSITION_X][i] = spawn.center.x + offset.x;
+                    this->arrays[POSITION_Y][i] = spawn.center.y + offset.y;
+                    this->arrays[POSITION_Z][i] = spawn.center.z + offset.z;
+                    this->arrays[VELOCITY_X][i] = velocity.x;
+                    this->arrays[VELOCITY_Y][i] = velocity.y;
+                    this->arrays[VELOCITY_Z][i] = velocity.z;
+                    this->arrays[LIFE][i] = 1.0f;
+                    this->arrays[FADE][i] = spawn.fadeMin + random.nextFloat() * (spawn.fadeMax - spawn.fadeMin);
+                }
+            }
+        });
+        this->count += count;
+        return count;
+    }
+
+    int ParticlePool::getCount() {
+
+        return this->count;
+    }
+
+    int ParticlePool::getCapacity() {
+
+        return this->capacity;
+    }
+
+    const float* ParticlePool::getPositionX() {
+
+        return this->arrays[POSITION_X];
+    }
+
+    const float* ParticlePool::getPositionY() {
+
+        return this->arrays[POSITION_Y];
+    }
+
+    const float* ParticlePool::getPositionZ() {
+
+        return this->arrays[POSITION_Z];
+    }
+
+    const float* ParticlePool::getVelocityX() {
+
+        return this->arrays[VELOCITY_X];
+    }
+
+    const float* ParticlePool::getVelocityY() {
+
+        return this->arrays[VELOCITY_Y];
+    }
+
+    const float* ParticlePool::getVelocityZ() {
+
+        return this->arrays[VELOCITY_Z];
+    }
+
+    const float* ParticlePool::getLife() {
+
+        return this->arrays[LIFE];
+    }
+
+    int ParticlePool::integrateScalar(int begin, int end, const ParticleStep& step, const float* floors, int* dead) {
+
+        float* px = this->arrays[POSITION_X];
+        float* py = this->arrays[POSITION_Y];
+        float* pz = this->arrays[POSITION_Z];
+        float* vx = this->arrays[VELOCITY_X];
+        float* vy = this->arrays[VELOCITY_Y];
+        float* vz = this->arrays[VELOCITY_Z];
+        float* life = this->arrays[LIFE];
+        const float* fade = this->arrays[FADE];
+
+        int deadCount = 0;
+        for (int i = begin; i < end; i++) {
+            px[i] += vx[i] * step.positionScale;
+            py[i] += vy[i] * step.positionScale;
+            pz[i] += vz[i] * step.positionScale;
+            vx[i] += step.gravity.x;
+            vy[i] += step.gravity.y;
+            vz[i] += step.gravity.z;
+            life[i] -= fade[i];
+            if (life[i] < 0.0f || py[i] <= (floors ? floors[i] : step.floorHeight)) {
+                dead[deadCount++] = i;
+            }
+        }
+        return deadCount;
+    }
+
+    int ParticlePool::integrateSimd(int begin, int end, const ParticleStep& step, const float* floors, int* dead) {
+
+        float* px = this->arrays[POSITION_X];
+        float* py = this->arrays[POSITION_Y];
+        float* pz = this->arrays[POSITION_Z];
+        float* vx = this->arrays[VELOCITY_X];
+        float* vy = this->arrays[VELOCITY_Y];
+        float* vz = this->arrays[VELOCITY_Z];
+        float* life = this->arrays[LIFE];
+        const float* fade = this->arrays[FADE];
+
+        int deadCount = 0;
+        //begin is a multiple of LANES and the arrays start 32 byte aligned, so every register load is aligned
+        int i = begin;
+
+#if defined(PARTICLES_AVX2)
+        const __m256 scale = _mm256_set1_ps(step.positionScale);
+        const __m256 gravityX = _mm256_set1_ps(step.gravity.x);
+        const __m256 gravityY = _mm256_set1_ps(step.gravity.y);
+        const __m256 gravityZ = _mm256_set1_ps(step.gravity.z);
+        const __m256 floorHeight = _mm256_set1_ps(step.floorHeight);
+        const __m256 zero = _mm256_setzero_ps();
+
+        for (; i + 8 <= end; i += 8) {
+            __m256 velocityX = _mm256_load_ps(vx + i);
+            __m256 velocityY = _mm256_load_ps(vy + i);
+            __m256 velocityZ = _mm256_load_ps(vz + i);
+            __m256 positionY = _mm256_add_ps(_mm256_load_ps(py + i), _mm256_mul_ps(velocityY, scale));
+            _mm256_store_ps(px + i, _mm256_add_ps(_mm256_load_ps(px + i), _mm256_mul_ps(velocityX, scale)));
+            _mm256_store_ps(py + i, positionY);
+            _mm256_store_ps(pz + i, _mm256_add_ps(_mm256_load_ps(pz + i), _mm256_mul_ps(velocityZ, scale)));
+            _mm256_store_ps(vx + i, _mm256_add_ps(velocityX, gravityX));
+            _mm256_store_ps(vy + i, _mm256_add_ps(velocityY, gravityY));
+            _mm256_store_ps(vz + i, _mm256_add_ps(velocityZ, gravityZ));
+            __m256 age = _mm256_sub_ps(_mm256_load_ps(life + i), _mm256_load_ps(fade + i));
+            _mm256_store_ps(life + i, age);
+
+            __m256 floor = floors ? _mm256_load_ps(floors + i) : floorHeight;
+            int mask = _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(age, zero, _CMP_LT_OQ),
+                _mm256_cmp_ps(positionY, floor, _CMP_LE_OQ)));
+            for (int lane = 0; mask; lane++, mask >>= 1) {
+                if (mask & 1) {
+                    dead[deadCount++] = i + lane;
+                }
+            }
+        }
+#elif defined(PARTICLES_SSE2)
+        const __m128 scale = _mm_set1_ps(step.positionScale);
+        const __m128 gravityX = _mm_set1_ps(step.gravity.x);
+        const __m128 gravityY = _mm_set1_ps(step.gravity.y);
+        const __m128 gravityZ = _mm_set1_ps(step.gravity.z);
+        const __m128 floorHeight = _mm_set1_ps(step.floorHeight);
+        const __m128 zero = _mm_setzero_ps();
+
+        for (; i + 4 <= end; i += 4) {
+            __m128 velocityX = _mm_load_ps(vx + i);
+            __m128 velocityY = _mm_load_ps(vy + i);
+            __m128 velocityZ = _mm_load_ps(vz + i);
+            __m128 positionY = _mm_add_ps(_mm_load_ps(py + i), _mm_mul_ps(velocityY, scale));
+            _mm_store_ps(px + i, _mm_add_ps(_mm_load_ps(px + i), _mm_mul_ps(velocityX, scale)));
+            _mm_store_ps(py + i, positionY);
+            _mm_store_ps(pz + i, _mm_add_ps(_mm_load_ps(pz + i), _mm_mul_ps(velocityZ, scale)));
+            _mm_store_ps(vx + i, _mm_add_ps(velocityX, gravityX));
+            _mm_store_ps(vy + i, _mm_add_ps(velocityY, gravityY));
+            _mm_store_ps(vz + i, _mm_add_ps(velocityZ, gravityZ));
+            __m128 age = _mm_sub_ps(_mm_load_ps(life + i), _mm_load_ps(fade + i));
+            _mm_store_ps(life + i, age);
+
+            __m128 floor = floors ? _mm_load_ps(floors + i) : floorHeight;
+            int mask = _mm_movemask_ps(_mm_or_ps(_mm_cmplt_ps(age, zero), _mm_cmple_ps(positionY, floor)));
+            for (int lane = 0; mask; lane++, mask >>= 1) {
+                if (mask & 1) {
+                    dead[deadCount++] = i + lane;
+                }
+            }
+        }
+#endif
+
+        //the tail that does not fill a register
+        return deadCount + integrateScalar(i, end, step, floors, dead + deadCount);
+    }
+
+    void ParticlePool::removeDead(int index) {
+
+        int last = --this->count;
+        if (index != last) {
+            for (int a = 0; a < ATTRIBUTE_COUNT; a++) {
+                this->arrays[a][index] = this->arrays[a][last];
+            }
+        }
+    }
+
+    void ParticlePool::forEachChunk(int chunkCount, ThreadPool* threadPool, const std::function<void(int, int)>& task) {
+
+        if (threadPool) {
+            threadPool->parallelFor(chunkCount, 1, task);
+        }
+        else if (chunkCount > 0) {
+            task(0, chunkCount);
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef ParticlePool_hpp
+#define ParticlePool_hpp
+
+#include <glm/glm.hpp>
+
+#include "ThreadPool.hpp"
+
+#include <functional>
+#include <vector>
+
+namespace gps {
+
+    class HeightMap;
+
+    //small, fast generator for spawning (xorshift32), one per chunk of work so the
+    //particles do not depend on how many threads took part
+    struct Xorshift {
+
+        unsigned int state;
+
+        explicit Xorshift(unsigned int seed = 2463534242u);
+        unsigned int next();
+        //uniform in [0, 1)
+        float nextFloat();
+    };
+
+    //one simulation step, in frames like the original rain (not seconds)
+    struct ParticleStep {
+
+        //position += velocity * positionScale
+        float positionScale;
+        //added to the velocity every step
+        glm::vec3 gravity;
+        //particles at or below this height die
+        float floorHeight;
+        //when set, particles at or below its surface die too, looked up at groundOffset + position
+        //(groundOffset is where the positions start from in world space)
+        const HeightMap* ground;
+        glm::vec3 groundOffset;
+
+        ParticleStep();
+    };
+
+    enum SPAWN_SHAPE { SPAWN_BOX, SPAWN_SPHERE };
+
+    //where and how new particles start
+    struct ParticleSpawn {
+
+        //uniform in a box or a ball around center
+        SPAWN_SHAPE shape;
+        glm::vec3 center;
+        //half size of the box, or the radius of the ball in x
+        glm::vec3 extent;
+        glm::vec3 velocity;
+        //every velocity component varies by up to this much either way
+        glm::vec3 velocitySpread;
+        //life starts at 1 and loses a fade in [fadeMin, fadeMax) every step
+        float fadeMin;
+        float fadeMax;
+    };
+
+    //fixed capacity particles stored as structure of arrays (one aligned array per attribute),
+    //so the update kernel reads and writes whole SIMD registers; the live particles are always [0, count)
+    //update and spawn work in chunks of CHUNK particles, spread over a thread pool when one is given
+    class ParticlePool {
+
+    public:
+        //floats between the starts of two arrays are a multiple of this, 32 byte aligned for AVX
+        static const int LANES = 8;
+        //particles per task, a multiple of LANES
+        static const int CHUNK = 4096;
+
+        ParticlePool();
+
+        void create(int capacity, unsigned int seed);
+        //SIMD kernel (AVX2 or SSE2, whichever the build targets) or the plain loop
+        void setSimd(bool enabled);
+        //instruction set of the SIMD kernel, "none" when the build has no SIMD path
+        static const char* getSimdName();
+
+        //moves and ages every particle, then removes the dead by moving the last live ones into their slots
+        //the result is the same with or without threadPool, and for any number of threads
+        //floorHits - when given, the positions of the particles that died on the floor or the ground are appended
+        void update(const ParticleStep& step, ThreadPool* threadPool = NULL, std::vector<glm::vec3>* floorHits = NULL);
+        //appends up to count new particles, returns how many fit
+        int spawn(int count, const ParticleSpawn& spawn, ThreadPool* threadPool = NULL);
+
+        int getCount();
+        int getCapacity();
+
+        //attribute arrays, valid for [0, getCount())
+        const float* getPositionX();
+        const float* getPositionY();
+        const float* getPositionZ();
+        const float* getVelocityX();
+        const float* getVelocityY();
+        const float* getVelocityZ();
+        const float* getLife();
+
+    private:
+        enum ATTRIBUTE { POSITION_X, POSITION_Y, POSITION_Z, VELOCITY_X, VELOCITY_Y, VELOCITY_Z, LIFE, FADE, ATTRIBUTE_COUNT };
+
+        int capacity;
+        int count;
+        bool simd;
+        unsigned int seed;
+        //spawn calls so far, every call draws different numbers
+        unsigned int generation;
+
+        //all the arrays in one allocation, arrays[a] points at the aligned start of attribute a
+        std::vector<float> storage;
+        float* arrays[ATTRIBUTE_COUNT];
+        //floor of every particle when the step has a ground, aligned like the attributes (the last array
+        //in storage) but not moved by removeDead, it is filled again every update
+        //indices found dead by the kernel, ascending; every chunk writes from its own first index on
+        std::vector<int> dead;
+        std::vector<int> chunkDead;
+        float* floors;
+
+        //integrates [begin, end) and writes the indices that died to dead, returns how many
+        //the SIMD kernel uses aligned loads, so begin has to be a multiple of LANES (chunks start at one)
+        //floors - per particle floor, NULL for step.floorHeight everywhere
+        int integrateScalar(int begin, int end, const ParticleStep& step, const float* floors, int* dead);
+        int integrateSimd(int begin, int end, const ParticleStep& step, const float* floors, int* dead);
+        void removeDead(int index);
+        //runs task(beginChunk, endChunk) over chunkCount chunks
+        void forEachChunk(int chunkCount, ThreadPool* threadPool, const std::function<void(int, int)>& task);
+    };
+}
+
+#endif /* ParticlePool_hpp */
@@ -0,0 +1,317 @@
+#include "ParticleSystem.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+
+namespace gps {
+
+    const float ParticleSystem::MIN_DENSITY = 0.1f;
+
+    //value in [-1, 1] to a normalized signed integer with the given largest value
+    static int packSnorm(float value, int maximum) {
+
+        value = glm::clamp(value, -1.0f, 1.0f) * maximum;
+        return (int)(value < 0.0f ? value - 0.5f : value + 0.5f);
+    }
+
+    ParticleSystem::ParticleSystem() {
+
+        this->emitterCount = 0;
+        this->seed = 0;
+        this->particleBudget = -1;
+        this->timeBudget = 2.0;
+        this->density = 1.0f;
+        this->milliseconds = 0.0;
+        this->ground = NULL;
+        this->shader = NULL;
+        this->originLoc = -1;
+        this->positionScaleLoc = -1;
+        this->motionScaleLoc = -1;
+        this->viewportHeightLoc = -1;
+        this->particleSizeLoc = -1;
+        this->colorLoc = -1;
+    }
+
+    void ParticleSystem::init(const gps::Shader& shader, unsigned int seed) {
+
+        this->seed = seed;
+        this->random = Xorshift(seed);
+
+        this->shader = &shader;
+        this->originLoc = glGetUniformLocation(this->shader->shaderProgram, "origin");
+        this->positionScaleLoc = glGetUniformLocation(this->shader->shaderProgram, "positionScale");
+        this->motionScaleLoc = glGetUniformLocation(this->shader->shaderProgram, "motionScale");
+        this->viewportHeightLoc = glGetUniformLocation(this->shader->shaderProgram, "viewportHeight");
+        this->particleSizeLoc = glGetUniformLocation(this->shader->shaderProgram, "particleSize");
+        this->colorLoc = glGetUniformLocation(this->shader->shaderProgram, "color");
+    }
+
+    int ParticleSystem::addEmitter(const ParticleEmitter& emitter) {
+
+        if (this->emitterCount == MAX_EMITTERS) {
+            std::cerr << "ERROR: a particle system holds at most " << MAX_EMITTERS << " emitters" << std::endl;
+            return -1;
+        }
+        if (emitter.sourceEmitter >= this->emitterCount) {
+            std::cerr << "ERROR: the source of an emitter has to be added before it" << std::endl;
+            return -1;
+        }
+
+        int index = this->emitterCount++;
+        Emitter& added = this->emitters[index];
+        added.definition = emitter;
+        //every emitter draws its own numbers
+        added.pool.create(emitter.capacity, this->seed ^ ((index + 1) * 0x9E3779B9u));
+        added.instances.create(sizeof(PackedParticle), emitter.capacity, true);
+        added.instances.addAttribute(0, 4, offsetof(PackedParticle, positionLife), GL_SHORT, GL_TRUE);
+        added.instances.addAttribute(1, 4, offsetof(PackedParticle, motion), GL_BYTE, GL_TRUE);
+        added.enabled = true;
+        added.spawnCarry = 0.0f;
+        added.hits.clear();
+        added.hasTargets = false;
+
+        if (emitter.sourceEmitter >= 0) {
+            this->emitters[emitter.sourceEmitter].hasTargets = true;
+        }
+        return index;
+    }
+
+    void ParticleSystem::destroy() {
+
+        for (int i = 0; i < this->emitterCount; i++) {
+            this->emitters[i].instances.destroy();
+        }
+        this->emitterCount = 0;
+    }
+
+    void ParticleSystem::setEmitterEnabled(int emitter, bool enabled) {
+
+        this->emitters[emitter].enabled = enabled;
+        //no splashes from a source that stopped
+        if (!enabled) {
+            this->emitters[emitter].hits.clear();
+        }
+    }
+
+    const ParticleEmitter& ParticleSystem::getEmitter(int emitter) {
+
+        return this->emitters[emitter].definition;
+    }
+
+    int ParticleSystem::getEmitterParticleCount(int emitter) {
+
+        return this->emitters[emitter].pool.getCount();
+    }
+
+    void ParticleSystem::setParticleBudget(int particleBudget) {
+
+        this->particleBudget = particleBudget;
+    }
+
+    void ParticleSystem::setTimeBudget(double milliseconds) {
+
+        this->timeBudget = milliseconds;
+    }
+
+    void ParticleSystem::setGround(const HeightMap* ground) {
+
+        this->ground = ground;
+    }
+
+    void ParticleSystem::scatterHits(int emitter, int count, glm::vec3 cameraPosition) {
+
+        Emitter& source = this->emitters[emitter];
+        const ParticleEmitter& definition = source.definition;
+        source.hits.clear();
+        if (!source.hasTargets) {
+            return;
+        }
+
+        //the particles fall straight down from the spawn area, so their hits cover it evenly
+        glm::vec3 origin = getOrigin(source, cameraPosition);
+        const ParticleSpawn& spawn = definition.spawn;
+        bool sphere = spawn.shape == SPAWN_SPHERE;
+        glm::vec2 extent = sphere ? glm::vec2(spawn.extent.x) : glm::vec2(spawn.extent.x, spawn.extent.z);
+        float top = spawn.center.y + (sphere ? spawn.extent.x : spawn.extent.y);
+        for (int i = 0; i < count; i++) {
+            glm::vec2 offset = (glm::vec2(this->random.nextFloat(), this->random.nextFloat()) * 2.0f - 1.0f) * extent;
+            if (sphere && glm::dot(offset, offset) > extent.x * extent.x) {
+                continue;
+            }
+
+            glm::vec3 hit = glm::vec3(spawn.center.x + offset.x, definition.step.floorHeight, spawn.center.z + offset.y);
+            if (definition.hitsGround && this->ground) {
+                hit.y = std::max(hit.y, this->ground->getHeight(origin.x + hit.x, origin.z + hit.z) - origin.y);
+            }
+            //a floor the particles never reach
+            if (hit.y == -FLT_MAX || hit.y > top) {
+                continue;
+            }
+            source.hits.push_back(hit);
+        }
+    }
+
+    void ParticleSystem::update(glm::vec3 cameraPosition, ThreadPool* threadPool) {
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        //over the particle budget every emitter gets the same fraction of its capacity
+        int capacity = 0;
+        for (int i = 0; i < this->emitterCount; i++) {
+            if (this->emitters[i].enabled) {
+                capacity += this->emitters[i].definition.capacity;
+            }
+        }
+        float share = this->particleBudget >= 0 && capacity > this->particleBudget
+            ? (float)this->particleBudget / capacity : 1.0f;
+
+        //sources come before the emitters spawning from their hits
+        for (int i = 0; i < this->emitterCount; i++) {
+            Emitter& emitter = this->emitters[i];
+            if (!emitter.enabled) {
+                continue;
+            }
+
+            ParticleStep step = emitter.definition.step;
+            if (emitter.definition.hitsGround && this->ground) {
+                step.ground = this->ground;
+                step.groundOffset = getOrigin(emitter, cameraPosition);
+            }
+
+            emitter.hits.clear();
+            emitter.pool.update(step, threadPool, emitter.hasTargets ? &emitter.hits : NULL);
+            //a lower target only stops spawning, the particles above it die of old age
+            int target = (int)(emitter.definition.capacity * share * this->density);
+            spawn(emitter, cameraPosition, target - emitter.pool.getCount(), threadPool);
+            pack(emitter, threadPool);
+        }
+
+        this->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        //thin out quickly while over the budget, come back slowly
+        if (this->milliseconds > this->timeBudget) {
+            this->density = std::max(MIN_DENSITY, this->density * 0.9f);
+        }
+        else if (this->milliseconds < this->timeBudget * 0.75) {
+            this->density = std::min(1.0f, this->density + 0.02f);
+        }
+    }
+
+    void ParticleSystem::draw(glm::vec3 cameraPosition, int viewportHeight) {
+
+        this->shader->useShaderProgram();
+        glUniform1f(this->viewportHeightLoc, (GLfloat)viewportHeight);
+
+        for (int i = 0; i < this->emitterCount; i++) {
+            Emitter& emitter = this->emitters[i];
+            if (!emitter.enabled) {
+                continue;
+            }
+
+            const ParticleEmitter& definition = emitter.definition;
+            glm::vec3 origin = getOrigin(emitter, cameraPosition);
+            glUniform3fv(this->originLoc, 1, glm::value_ptr(origin));
+            glUniform1f(this->positionScaleLoc, definition.positionRange);
+            glUniform1f(this->motionScaleLoc, definition.motionRange);
+            glUniform2f(this->particleSizeLoc, definition.length, definition.halfWidth);
+            glUniform4fv(this->colorLoc, 1, glm::value_ptr(definition.color));
+            //a quad per particle
+            emitter.instances.drawInstanced(GL_TRIANGLE_STRIP, 4);
+        }
+    }
+
+    int ParticleSystem::getParticleCount() {
+
+        int count = 0;
+        for (int i = 0; i < this->emitterCount; i++) {
+            if (this->emitters[i].enabled) {
+                count += this->emitters[i].pool.getCount();
+            }
+        }
+        return count;
+    }
+
+    float ParticleSystem::getDensity() {
+
+        return this->density;
+    }
+
+    double ParticleSystem::getMilliseconds() {
+
+        return this->milliseconds;
+    }
+
+    glm::vec3 ParticleSystem::getOrigin(const Emitter& emitter, glm::vec3 cameraPosition) {
+
+        return emitter.definition.cameraRelative ? cameraPosition : emitter.definition.position;
+    }
+
+    void ParticleSystem::spawn(Emitter& emitter, glm::vec3 cameraPosition, int room, ThreadPool* threadPool) {
+
+        const ParticleEmitter& definition = emitter.definition;
+        int budget = std::min(definition.spawnBudget, room);
+
+        //particles from hits first, they mark where something just happened
+        if (definition.sourceEmitter >= 0) {
+            const Emitter& source = this->emitters[definition.sourceEmitter];
+            //hits are relative to the source's origin
+            glm::vec3 offset = getOrigin(source, cameraPosition) - getOrigin(emitter, cameraPosition);
+            ParticleSpawn spawn = definition.spawn;
+            for (size_t h = 0; h < source.hits.size() && budget > 0; h++) {
+                spawn.center = definition.spawn.center + source.hits[h] + offset;
+                budget -= emitter.pool.spawn(std::min(definition.spawnPerHit, budget), spawn);
+            }
+        }
+
+        emitter.spawnCarry += definition.spawnRate * this->density;
+        int count = std::min((int)emitter.spawnCarry, budget);
+        if (count > 0) {
+            emitter.pool.spawn(count, definition.spawn, threadPool);
+        }
+        //only the fraction carries over, so frames without room do not pile up a burst
+        emitter.spawnCarry -= (int)emitter.spawnCarry;
+    }
+
+    void ParticleSystem::pack(Emitter& emitter, ThreadPool* threadPool) {
+
+        ParticlePool& pool = emitter.pool;
+        const float* positionX = pool.getPositionX();
+        const float* positionY = pool.getPositionY();
+        const float* positionZ = pool.getPositionZ();
+        const float* velocityX = pool.getVelocityX();
+        const float* velocityY = pool.getVelocityY();
+        const float* velocityZ = pool.getVelocityZ();
+        const float* life = pool.getLife();
+        float positionScale = 1.0f / emitter.definition.positionRange;
+        float motionScale = emitter.definition.step.positionScale / emitter.definition.motionRange;
+
+        //every chunk writes its own range of the mapped stream
+        PackedParticle* particles = (PackedParticle*)emitter.instances.map();
+        std::function<void(int, int)> packTask = [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                PackedParticle& particle = particles[i];
+                particle.positionLife[0] = (GLshort)packSnorm(positionX[i] * positionScale, 32767);
+                particle.positionLife[1] = (GLshort)packSnorm(positionY[i] * positionScale, 32767);
+                particle.positionLife[2] = (GLshort)packSnorm(positionZ[i] * positionScale, 32767);
+                particle.positionLife[3] = (GLshort)packSnorm(life[i], 32767);
+                particle.motion[0] = (GLbyte)packSnorm(velocityX[i] * motionScale, 127);
+                particle.motion[1] = (GLbyte)packSnorm(velocityY[i] * motionScale, 127);
+                particle.motion[2] = (GLbyte)packSnorm(velocityZ[i] * motionScale, 127);
+                particle.motion[3] = 0;
+            }
+        };
+        if (threadPool) {
+            threadPool->parallelFor(pool.getCount(), ParticlePool::CHUNK, packTask);
+        }
+        else if (pool.getCount() > 0) {
+            packTask(0, pool.getCount());
+        }
+        emitter.instances.unmap(pool.getCount());
+    }
+}
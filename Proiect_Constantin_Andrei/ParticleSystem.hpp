@@ -0,0 +1,150 @@
+#ifndef ParticleSystem_hpp
+#define ParticleSystem_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "HeightMap.hpp"
+#include "ParticlePool.hpp"
+#include "Shader.hpp"
+#include "StreamingVertexBuffer.hpp"
+#include "ThreadPool.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //one kind of particle: where they start, how they move, how many there are and how they look
+    struct ParticleEmitter {
+
+        //positions are relative to the camera (they follow it, like the rain) or to position
+        bool cameraRelative;
+        glm::vec3 position;
+        ParticleSpawn spawn;
+        ParticleStep step;
+        //also die on the surface of the ground height map, when there is one
+        bool hitsGround;
+
+        //size of the pool, nothing is allocated after addEmitter
+        int capacity;
+        //new particles per frame at full density, fractions carry over to the next frame
+        float spawnRate;
+        //most particles spawned in one frame, from the rate and from hits together
+        int spawnBudget;
+        //an earlier emitter whose particles spawn spawnPerHit of these where they hit their floor
+        //(splashes), -1 for none
+        int sourceEmitter;
+        int spawnPerHit;
+
+        //rgb, a - opacity
+        glm::vec4 color;
+        //streak length at rest and half width
+        float length;
+        float halfWidth;
+        //packing ranges: farthest a particle gets from its origin, farthest it moves in one step
+        float positionRange;
+        float motionRange;
+    };
+
+    //CPU particle effects (rain, splashes, dust): every emitter owns a fixed capacity pool and a stream
+    //of packed instances, all drawn as streaks by rainShader.vert
+    //the density of every emitter drops while the update runs over its time budget and recovers when
+    //there is room again; the particle budget scales every emitter's share down the same way
+    class ParticleSystem {
+
+    public:
+        static const int MAX_EMITTERS = 8;
+
+        ParticleSystem();
+
+        //shader - rainShader.vert/.frag with FrameUniforms bound, shared with GpuRain and owned by the
+        //caller, it has to outlive the particle system
+        void init(const gps::Shader& shader, unsigned int seed);
+        //returns the index of the emitter, -1 when there are MAX_EMITTERS already
+        int addEmitter(const ParticleEmitter& emitter);
+        void destroy();
+
+        //disabled emitters neither update nor draw, their particles wait where they were
+        void setEmitterEnabled(int emitter, bool enabled);
+        const ParticleEmitter& getEmitter(int emitter);
+        int getEmitterParticleCount(int emitter);
+        //most live particles of all the emitters together, -1 for no limit
+        void setParticleBudget(int particleBudget);
+        //update time the density aims to stay under
+        void setTimeBudget(double milliseconds);
+        //surface the hitsGround emitters stop on, NULL for none
+        void setGround(const HeightMap* ground);
+        //for a disabled emitter whose particles are simulated elsewhere (the GPU rain): replaces its hits
+        //with count points spread evenly over its spawn area, on its floor or the ground under them,
+        //so the emitters spawning from it keep working; once per frame, before update
+        void scatterHits(int emitter, int count, glm::vec3 cameraPosition);
+
+        //moves, kills, spawns and packs every emitter's particles; once per frame, before draw
+        void update(glm::vec3 cameraPosition, ThreadPool* threadPool);
+        //blending is up to the caller
+        void draw(glm::vec3 cameraPosition, int viewportHeight);
+
+        int getParticleCount();
+        //fraction of every emitter's share in use
+        float getDensity();
+        //time of the last update
+        double getMilliseconds();
+
+    private:
+        //the time budget never thins the effects out further than this
+        static const float MIN_DENSITY;
+
+        //what rainShader.vert reads, 12 bytes
+        struct PackedParticle {
+
+            //position over positionRange, life
+            GLshort positionLife[4];
+            //motion of one step over motionRange, w unused
+            GLbyte motion[4];
+        };
+
+        struct Emitter {
+
+            ParticleEmitter definition;
+            ParticlePool pool;
+            StreamingVertexBuffer instances;
+            bool enabled;
+            float spawnCarry;
+            //where this frame's particles hit their floor, kept for the emitters spawning from them
+            std::vector<glm::vec3> hits;
+            bool hasTargets;
+        };
+
+        Emitter emitters[MAX_EMITTERS];
+        int emitterCount;
+        unsigned int seed;
+        int particleBudget;
+        double timeBudget;
+        float density;
+        double milliseconds;
+        const HeightMap* ground;
+        //for scatterHits, the pools draw their own numbers
+        Xorshift random;
+
+        const gps::Shader* shader;
+        GLint originLoc;
+        GLint positionScaleLoc;
+        GLint motionScaleLoc;
+        GLint viewportHeightLoc;
+        GLint particleSizeLoc;
+        GLint colorLoc;
+
+        glm::vec3 getOrigin(const Emitter& emitter, glm::vec3 cameraPosition);
+        void spawn(Emitter& emitter, glm::vec3 cameraPosition, int room, ThreadPool* threadPool);
+        void pack(Emitter& emitter, ThreadPool* threadPool);
+    };
+}
+
+#endif /* ParticleSystem_hpp */
@@ -0,0 +1,166 @@
+#include "RingBuffer.hpp"
+
+namespace gps {
+
+    RingBuffer::RingBuffer() {
+
+        this->target = GL_ARRAY_BUFFER;
+        this->bufferId = 0;
+        this->frameSize = 0;
+        this->alignment = 1;
+        this->persistent = false;
+        this->mapped = NULL;
+        this->frame = 0;
+        this->used = 0;
+        this->flushed = 0;
+
+        for (int i = 0; i < FRAMES; i++) {
+            this->fences[i] = 0;
+        }
+    }
+
+    void RingBuffer::create(GLenum target, GLsizeiptr frameSize, GLint alignment) {
+
+        this->target = target;
+        this->alignment = alignment > 0 ? alignment : 1;
+        //keep every region start aligned as well
+        this->frameSize = (frameSize + this->alignment - 1) / this->alignment * this->alignment;
+
+        glGenBuffers(1, &this->bufferId);
+        glBindBuffer(target, this->bufferId);
+
+#if defined (__APPLE__)
+        this->persistent = false;
+#else
+        this->persistent = GLEW_ARB_buffer_storage;
+
+        if (this->persistent) {
+
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(target, this->frameSize * FRAMES, NULL, flags);
+            this->mapped = (unsigned char*)glMapBufferRange(target, 0, this->frameSize * FRAMES, flags);
+        }
+#endif
+
+        if (!this->persistent) {
+
+            glBufferData(target, this->frameSize, NULL, GL_STREAM_DRAW);
+            this->staging.resize(this->frameSize);
+        }
+
+        glBindBuffer(target, 0);
+
+        //start on the last region so the first beginFrame lands on region 0
+        this->frame = FRAMES - 1;
+    }
+
+    void RingBuffer::destroy() {
+
+        for (int i = 0; i < FRAMES; i++) {
+
+            if (this->fences[i]) {
+                glDeleteSync(this->fences[i]);
+                this->fences[i] = 0;
+            }
+        }
+
+        if (this->bufferId) {
+
+            if (this->mapped) {
+                glBindBuffer(this->target, this->bufferId);
+                glUnmapBuffer(this->target);
+                glBindBuffer(this->target, 0);
+                this->mapped = NULL;
+            }
+            glDeleteBuffers(1, &this->bufferId);
+            this->bufferId = 0;
+        }
+    }
+
+    void RingBuffer::beginFrame() {
+
+        this->used = 0;
+        this->flushed = 0;
+
+        if (!this->persistent) {
+            return;
+        }
+
+        this->frame = (this->frame + 1) % FRAMES;
+
+        GLsync fence = this->fences[this->frame];
+        if (fence) {
+
+            //normally already signaled, the region was submitted FRAMES - 1 frames ago
+            GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            while (result == GL_TIMEOUT_EXPIRED) {
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            }
+            glDeleteSync(fence);
+            this->fences[this->frame] = 0;
+        }
+    }
+
+    void* RingBuffer::allocate(GLsizeiptr size, GLintptr* offset) {
+
+        GLsizeiptr start = (this->used + this->alignment - 1) / this->alignment * this->alignment;
+        if (start + size > this->frameSize) {
+            return NULL;
+        }
+        this->used = start + size;
+
+        if (this->persistent) {
+
+            *offset = this->frame * this->frameSize + start;
+            return this->mapped + *offset;
+        }
+
+        *offset = start;
+        return this->staging.data() + start;
+    }
+
+    void RingBuffer::release(GLsizeiptr size) {
+
+        this->used = size < this->used - this->flushed ? this->used - size : this->flushed;
+    }
+
+    void RingBuffer::flush() {
+
+        //coherent persistent mappings are visible without any call
+        if (this->persistent || this->used == this->flushed) {
+            return;
+        }
+
+        glBindBuffer(this->target, this->bufferId);
+        if (this->flushed == 0) {
+            //orphan: the GPU keeps the old storage for draws still in flight
+            glBufferData(this->target, this->frameSize, NULL, GL_STREAM_DRAW);
+        }
+        glBufferSubData(this->target, this->flushed, this->used - this->flushed, this->staging.data() + this->flushed);
+        glBindBuffer(this->target, 0);
+
+        this->flushed = this->used;
+    }
+
+    void RingBuffer::endFrame() {
+
+        if (!this->persistent) {
+            return;
+        }
+
+        this->fences[this->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    void RingBuffer::bindRange(GLuint bindingPoint, GLintptr offset, GLsizeiptr size) {
+
+        glBindBufferRange(this->target, bindingPoint, this->bufferId, offset, size);
+    }
+
+    GLuint RingBuffer::getId() {
+        return this->bufferId;
+    }
+
+    bool RingBuffer::isPersistent() {
+        return this->persistent;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef RingBuffer_hpp
+#define RingBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <vector>
+
+namespace gps {
+
+    //buffer for data rewritten every frame (per-draw constants, dynamic geometry)
+    //with GL_ARB_buffer_storage it is one persistently mapped buffer split into FRAMES regions,
+    //each guarded by a fence so the CPU never writes a region the GPU is still reading
+    //without it, writes go to a CPU copy that flush() uploads after orphaning the buffer
+    class RingBuffer {
+
+    public:
+        static const int FRAMES = 3;
+
+        RingBuffer();
+
+        //frameSize - bytes available per frame, alignment - offset alignment of every allocation
+        void create(GLenum target, GLsizeiptr frameSize, GLint alignment);
+        void destroy();
+
+        //moves to the next region, waiting for the GPU if it still reads it
+        void beginFrame();
+        //reserves size bytes of the current frame, returns where to write them
+        //offset receives the position to bind/draw from, NULL is returned when the frame is full
+        void* allocate(GLsizeiptr size, GLintptr* offset);
+        //gives back the last size bytes of the latest allocation, when fewer were written than reserved
+        void release(GLsizeiptr size);
+        //makes the bytes written since beginFrame visible to the GPU
+        void flush();
+        //fences the region once every command reading it has been issued
+        void endFrame();
+
+        //binds part of the buffer to an indexed target (uniform blocks)
+        void bindRange(GLuint bindingPoint, GLintptr offset, GLsizeiptr size);
+
+        GLuint getId();
+        bool isPersistent();
+
+    private:
+        GLenum target;
+        GLuint bufferId;
+        GLsizeiptr frameSize;
+        GLint alignment;
+        bool persistent;
+
+        //persistent path
+        unsigned char* mapped;
+        GLsync fences[FRAMES];
+        int frame;
+
+        //orphaning path
+        std::vector<unsigned char> staging;
+
+        GLsizeiptr used;
+        GLsizeiptr flushed;
+    };
+}
+
+#endif /* RingBuffer_hpp */
@@ -8,7 +8,83 @@
 
 #include "Shader.hpp"
 
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
 namespace gps {
+
+    std::string Shader::binaryCacheDirectory;
+    std::string Shader::sharedDefines;
+    bool Shader::parallelCompile = false;
+
+    namespace {
+
+        unsigned long long hashBytes(unsigned long long hash, const void* data, size_t size) {
+
+            //FNV-1a
+            const unsigned char* bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        unsigned long long hashString(unsigned long long hash, std::string text) {
+
+            //the terminator keeps "ab" + "c" apart from "a" + "bc"
+            return hashBytes(hash, text.c_str(), text.size() + 1);
+        }
+
+        std::string getGlString(GLenum name) {
+
+            const GLubyte* value = glGetString(name);
+            return value ? std::string((const char*)value) : std::string();
+        }
+    }
+
+    Shader::Shader() {
+
+        this->shaderProgram = 0;
+        this->loadPending = false;
+        this->loadCacheHit = false;
+        this->loadHash = 0;
+        this->locationProgram = 0;
+    }
+
+    void Shader::setBinaryCacheDirectory(std::string directory) {
+
+        if (!directory.empty() && directory.back() != '/' && directory.back() != '\\') {
+            directory += '/';
+        }
+        binaryCacheDirectory = directory;
+    }
+
+    void Shader::setSharedDefines(std::string defines) {
+
+        sharedDefines = defines;
+    }
+
+    bool Shader::enableParallelCompile() {
+
+#if defined (__APPLE__)
+        parallelCompile = false;
+#else
+        //0xFFFFFFFF leaves the number of compiler threads to the driver
+        if (GLEW_KHR_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            parallelCompile = true;
+        }
+        else if (GLEW_ARB_parallel_shader_compile) {
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+            parallelCompile = true;
+        }
+#endif
+        return parallelCompile;
+    }
+
     std::string Shader::readShaderFile(std::string fileName) {
 
         std::ifstream shaderFile;
@@ -30,6 +106,25 @@ namespace gps {
         return shaderString;
     }
     
+    std::string Shader::injectDefines(std::string source, std::string defines) {
+
+        if (!sharedDefines.empty()) {
+            defines = sharedDefines + "\n" + defines;
+        }
+        if (defines.empty()) {
+            return source;
+        }
+
+        //#version has to stay the first line
+        size_t insertAt = 0;
+        if (source.compare(0, 8, "#version") == 0) {
+            insertAt = source.find('\n');
+            insertAt = insertAt == std::string::npos ? source.size() : insertAt + 1;
+        }
+
+        return source.substr(0, insertAt) + defines + "\n" + source.substr(insertAt);
+    }
+
     void Shader::shaderCompileLog(GLuint shaderId) {
 
         GLint success;
@@ -58,42 +153,286 @@ namespace gps {
         }
     }
     
-    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName) {
-
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
-        const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
-        
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
-        const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
-        //check compilation status
-        shaderCompileLog(fragmentShader);
-        
-        //attach and link the shader programs
+    std::string Shader::getBinaryCachePath(std::string name) {
+
+        char fileName[32];
+        std::snprintf(fileName, sizeof(fileName), "%016llx.program", hashString(14695981039346656037ULL, name));
+        return binaryCacheDirectory + fileName;
+    }
+
+    unsigned long long Shader::computeBinaryHash(std::string sources) {
+
+        //a binary only loads on the driver that wrote it, an update usually changes the version string
+        int version = BINARY_CACHE_VERSION;
+        unsigned long long hash = hashBytes(14695981039346656037ULL, &version, sizeof(version));
+        hash = hashString(hash, getGlString(GL_RENDERER));
+        hash = hashString(hash, getGlString(GL_VERSION));
+        return hashString(hash, sources);
+    }
+
+    bool Shader::loadProgramBinary(std::string path, unsigned long long hash) {
+
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        char magic[4];
+        unsigned long long fileHash = 0;
+        GLenum format = 0;
+        GLint length = 0;
+        file.read(magic, sizeof(magic));
+        file.read((char*)&fileHash, sizeof(fileHash));
+        file.read((char*)&format, sizeof(format));
+        file.read((char*)&length, sizeof(length));
+        if (!file || std::memcmp(magic, "PROG", 4) != 0 || fileHash != hash || length <= 0) {
+            //the sources, the defines or the driver changed
+            return false;
+        }
+
+        std::vector<char> binary(length);
+        file.read(binary.data(), length);
+        if (!file) {
+            std::cerr << "ERROR: truncated program cache " << path << std::endl;
+            return false;
+        }
+
         this->shaderProgram = glCreateProgram();
-        glAttachShader(this->shaderProgram, vertexShader);
-        glAttachShader(this->shaderProgram, fragmentShader);
+        glProgramBinary(this->shaderProgram, format, binary.data(), length);
+        //the driver may still refuse a binary it wrote itself, then the sources are compiled as usual
+        GLint success;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &success);
+        if (!success) {
+            glDeleteProgram(this->shaderProgram);
+            this->shaderProgram = 0;
+            return false;
+        }
+        return true;
+    }
+
+    void Shader::saveProgramBinary(std::string path, unsigned long long hash) {
+
+        GLint success;
+        GLint length = 0;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &success);
+        glGetProgramiv(this->shaderProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (!success || length <= 0) {
+            //nothing worth caching, or a driver without binary formats
+            return;
+        }
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(this->shaderProgram, length, &length, &format, binary.data());
+
+        std::ofstream file(path.c_str(), std::ios::binary);
+        if (!file) {
+            std::cerr << "ERROR: could not write the program cache " << path << std::endl;
+            return;
+        }
+        file.write("PROG", 4);
+        file.write((const char*)&hash, sizeof(hash));
+        file.write((const char*)&format, sizeof(format));
+        file.write((const char*)&length, sizeof(length));
+        file.write(binary.data(), length);
+    }
+
+    void Shader::logProgram(std::string name, bool cacheHit, double milliseconds) {
+
+        std::cout << name << ": ";
+        if (binaryCacheDirectory.empty()) {
+            std::cout << "compiled";
+        }
+        else {
+            std::cout << (cacheHit ? "program cache hit" : "program cache miss, compiled");
+        }
+        std::cout << " in " << milliseconds << " ms" << std::endl;
+    }
+    
+    GLuint Shader::compileStage(GLenum type, const std::string& source) {
+
+        const GLchar* sourceString = source.c_str();
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &sourceString, NULL);
+        glCompileShader(shader);
+        this->loadShaders.push_back(shader);
+        return shader;
+    }
+
+    bool Shader::beginLoad(std::string name, std::string cacheName, std::string sources) {
+
+        this->loadPending = true;
+        this->loadCacheHit = false;
+        this->loadShaders.clear();
+        this->loadName = name;
+        this->loadCachePath.clear();
+        //a new program may well reuse the name of the one it replaces
+        this->uniformLocations.clear();
+        this->locationProgram = 0;
+
+        if (!binaryCacheDirectory.empty()) {
+            this->loadCachePath = getBinaryCachePath(cacheName);
+            this->loadHash = computeBinaryHash(sources);
+            this->loadCacheHit = loadProgramBinary(this->loadCachePath, this->loadHash);
+        }
+        return this->loadCacheHit;
+    }
+
+    void Shader::linkProgram() {
+
+        if (!this->loadCachePath.empty()) {
+            glProgramParameteri(this->shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
         glLinkProgram(this->shaderProgram);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-        //check linking info
-        shaderLinkLog(this->shaderProgram);
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines) {
+
+        beginLoadShader(vertexShaderFileName, fragmentShaderFileName, defines);
+        finishLoad();
     }
     
-    void Shader::useShaderProgram() {
+    void Shader::loadTransformFeedbackShader(std::string vertexShaderFileName, const std::vector<std::string>& varyings, std::string defines) {
+
+        beginLoadTransformFeedbackShader(vertexShaderFileName, varyings, defines);
+        finishLoad();
+    }
+
+    void Shader::beginLoadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines) {
+
+        this->loadStart = std::chrono::steady_clock::now();
+        std::string name = vertexShaderFileName + " + " + fragmentShaderFileName;
+
+        //read and parse both stages, the cache key covers the sources as compiled
+        std::string v = injectDefines(readShaderFile(vertexShaderFileName), defines);
+        std::string f = injectDefines(readShaderFile(fragmentShaderFileName), defines);
+        if (beginLoad(name, name + "\n" + defines, v + f)) {
+            return;
+        }
+
+        //compile both stages, attach and link, nothing here waits for the driver
+        GLuint vertexShader = compileStage(GL_VERTEX_SHADER, v);
+        GLuint fragmentShader = compileStage(GL_FRAGMENT_SHADER, f);
+        this->shaderProgram = glCreateProgram();
+        glAttachShader(this->shaderProgram, vertexShader);
+        glAttachShader(this->shaderProgram, fragmentShader);
+        linkProgram();
+    }
+
+    void Shader::beginLoadTransformFeedbackShader(std::string vertexShaderFileName, const std::vector<std::string>& varyings, std::string defines) {
+
+        this->loadStart = std::chrono::steady_clock::now();
+        std::string v = injectDefines(readShaderFile(vertexShaderFileName), defines);
+
+        //the captured outputs are part of the linked program
+        std::string captured;
+        for (size_t i = 0; i < varyings.size(); i++) {
+            captured += varyings[i] + "\n";
+        }
+        if (beginLoad(vertexShaderFileName, vertexShaderFileName + "\n" + captured + defines, v + captured)) {
+            return;
+        }
+
+        GLuint vertexShader = compileStage(GL_VERTEX_SHADER, v);
+        this->shaderProgram = glCreateProgram();
+        glAttachShader(this->shaderProgram, vertexShader);
+        //the captured outputs have to be known before linking
+        std::vector<const GLchar*> names;
+        for (size_t i = 0; i < varyings.size(); i++) {
+            names.push_back(varyings[i].c_str());
+        }
+        glTransformFeedbackVaryings(this->shaderProgram, (GLsizei)names.size(), names.data(), GL_INTERLEAVED_ATTRIBS);
+        linkProgram();
+    }
+
+    bool Shader::isLoadComplete() {
+
+        if (!this->loadPending || this->loadCacheHit || !parallelCompile) {
+            return true;
+        }
+
+        GLint complete = GL_TRUE;
+#if !defined (__APPLE__)
+        //the KHR and ARB versions share the enum
+        glGetProgramiv(this->shaderProgram, GL_COMPLETION_STATUS_KHR, &complete);
+#endif
+        return complete == GL_TRUE;
+    }
+
+    void Shader::finishLoad() {
+
+        if (!this->loadPending) {
+            return;
+        }
+        this->loadPending = false;
+
+        if (!this->loadCacheHit) {
+            //the first status query waits for the driver
+            for (size_t i = 0; i < this->loadShaders.size(); i++) {
+                shaderCompileLog(this->loadShaders[i]);
+                glDeleteShader(this->loadShaders[i]);
+            }
+            this->loadShaders.clear();
+            shaderLinkLog(this->shaderProgram);
+
+            if (!this->loadCachePath.empty()) {
+                saveProgramBinary(this->loadCachePath, this->loadHash);
+            }
+        }
+
+        logProgram(this->loadName, this->loadCacheHit,
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->loadStart).count());
+    }
+
+    void Shader::finishLoads(const std::vector<Shader*>& shaders) {
+
+        std::vector<Shader*> remaining = shaders;
+        while (!remaining.empty()) {
+            bool finished = false;
+            for (size_t i = 0; i < remaining.size(); ) {
+                if (remaining[i]->isLoadComplete()) {
+                    remaining[i]->finishLoad();
+                    remaining.erase(remaining.begin() + i);
+                    finished = true;
+                }
+                else {
+                    i++;
+                }
+            }
+            if (!finished) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void Shader::useShaderProgram() const {
 
         glUseProgram(this->shaderProgram);
     }
 
+    GLint Shader::getUniformLocation(const std::string& name) const {
+
+        if (this->locationProgram != this->shaderProgram) {
+            this->uniformLocations.clear();
+            this->locationProgram = this->shaderProgram;
+        }
+
+        std::unordered_map<std::string, GLint>::const_iterator found = this->uniformLocations.find(name);
+        if (found != this->uniformLocations.end()) {
+            return found->second;
+        }
+        GLint location = glGetUniformLocation(this->shaderProgram, name.c_str());
+        this->uniformLocations[name] = location;
+        return location;
+    }
+
+    void Shader::bindUniformBlock(std::string blockName, GLuint bindingPoint) {
+
+        GLuint blockIndex = glGetUniformBlockIndex(this->shaderProgram, blockName.c_str());
+        //programs that do not use the block simply skip it
+        if (blockIndex != GL_INVALID_INDEX) {
+            glUniformBlockBinding(this->shaderProgram, blockIndex, bindingPoint);
+        }
+    }
+
 }
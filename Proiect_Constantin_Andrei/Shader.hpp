@@ -17,9 +17,12 @@
     #include <GL/glew.h>
 #endif
 
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 
 
 namespace gps {
@@ -28,13 +31,77 @@ namespace gps {
 
     public:
         GLuint shaderProgram;
-        void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
-        void useShaderProgram();
+
+        Shader();
+        //defines are "#define" lines inserted after the #version line of both stages, for compile time variants
+        void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines = "");
+        //vertex shader only program whose outputs are captured with transform feedback, interleaved in the given order
+        void loadTransformFeedbackShader(std::string vertexShaderFileName, const std::vector<std::string>& varyings, std::string defines = "");
+
+        //the same loads split in two: begin only queues the compile and link work, finishLoad reads the
+        //logs (waiting for the driver if it is not done) and leaves the program ready to use
+        void beginLoadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, std::string defines = "");
+        void beginLoadTransformFeedbackShader(std::string vertexShaderFileName, const std::vector<std::string>& varyings, std::string defines = "");
+        //true when finishLoad will not wait, always true without parallel compilation
+        bool isLoadComplete();
+        void finishLoad();
+        //finishes the begun loads in the order the driver completes them
+        static void finishLoads(const std::vector<Shader*>& shaders);
+
+        void useShaderProgram() const;
+        //location of a uniform of the current program, asked from the driver once and then cached
+        GLint getUniformLocation(const std::string& name) const;
+        //connects the named uniform block to a buffer binding point (GLSL 4.10 has no layout(binding))
+        void bindUniformBlock(std::string blockName, GLuint bindingPoint);
+
+        //linked programs are kept in this directory and loaded from there while the sources, the defines
+        //and the driver stay the same; empty (the default) always compiles from source
+        static void setBinaryCacheDirectory(std::string directory);
+        //"#define" lines inserted into every program before its own defines, for declarations
+        //shared by all the shaders (the uniform block layouts); set before the first load
+        static void setSharedDefines(std::string defines);
+        //lets the driver compile on its own threads (GL_KHR_parallel_shader_compile or the ARB version)
+        //so begun loads run side by side; false when the driver has neither
+        static bool enableParallelCompile();
     
     private:
+        static const int BINARY_CACHE_VERSION = 1;
+        static std::string binaryCacheDirectory;
+        static std::string sharedDefines;
+        static bool parallelCompile;
+
+        //the begun load, until finishLoad
+        bool loadPending;
+        bool loadCacheHit;
+        std::vector<GLuint> loadShaders;
+        std::string loadName;
+        std::string loadCachePath;
+        unsigned long long loadHash;
+        std::chrono::steady_clock::time_point loadStart;
+
+        //program the cached locations belong to, the cache is dropped when shaderProgram changes
+        mutable GLuint locationProgram;
+        mutable std::unordered_map<std::string, GLint> uniformLocations;
+
         std::string readShaderFile(std::string fileName);
+        std::string injectDefines(std::string source, std::string defines);
         void shaderCompileLog(GLuint shaderId);
         void shaderLinkLog(GLuint shaderProgramId);
+        //queues the compilation, the log is read in finishLoad
+        GLuint compileStage(GLenum type, const std::string& source);
+        //tries the cache for the program; false when it still has to be compiled and linked
+        bool beginLoad(std::string name, std::string cacheName, std::string sources);
+        //links with the binary retrievable when it is going to be cached
+        void linkProgram();
+
+        //name - identifies the program (files and defines), the cached binary is replaced when it changes
+        std::string getBinaryCachePath(std::string name);
+        //hash of everything the binary depends on: the final sources and the driver
+        unsigned long long computeBinaryHash(std::string sources);
+        //creates the program from the cache, false (and no program) on a miss
+        bool loadProgramBinary(std::string path, unsigned long long hash);
+        void saveProgramBinary(std::string path, unsigned long long hash);
+        void logProgram(std::string name, bool cacheHit, double milliseconds);
     };
     
 }
@@ -0,0 +1,415 @@
+#include "ShadowAtlas.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    ShadowAtlas::ShadowAtlas() {
+
+        this->atlasSize = 0;
+        this->maxTile = 0;
+        this->minTile = 0;
+        this->levels = 0;
+        this->updateBudget = 4;
+        this->depthTexture = 0;
+        this->framebuffer = 0;
+    }
+
+    void ShadowAtlas::init(int atlasSize, int maxTile, int minTile) {
+
+        this->atlasSize = atlasSize;
+        this->maxTile = std::min(maxTile, atlasSize);
+        this->minTile = std::min(minTile, this->maxTile);
+        this->levels = 1;
+        while ((this->maxTile >> this->levels) >= this->minTile) {
+            this->levels++;
+        }
+
+        //the whole atlas starts as free tiles of the largest size
+        this->freeTiles.assign(this->levels, std::vector<Tile>());
+        for (int y = 0; y < atlasSize; y += this->maxTile) {
+            for (int x = 0; x < atlasSize; x += this->maxTile) {
+                Tile tile = { x, y, 0 };
+                this->freeTiles[0].push_back(tile);
+            }
+        }
+
+        //sampled through sampler2DShadow, one bilinear PCF lookup per fragment
+        glGenTextures(1, &this->depthTexture);
+        glBindTexture(GL_TEXTURE_2D, this->depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, atlasSize, atlasSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &this->framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void ShadowAtlas::destroy() {
+
+        glDeleteFramebuffers(1, &this->framebuffer);
+        glDeleteTextures(1, &this->depthTexture);
+        this->framebuffer = 0;
+        this->depthTexture = 0;
+    }
+
+    void ShadowAtlas::setUpdateBudget(int tiles) {
+        this->updateBudget = std::max(1, tiles);
+    }
+
+    int ShadowAtlas::addLight(bool isStatic, float importance) {
+
+        SpotShadow shadow;
+        shadow.isStatic = isStatic;
+        shadow.importance = importance;
+        shadow.position = glm::vec3(0.0f);
+        shadow.range = 0.0f;
+        shadow.lightSpaceMatrix = glm::mat4(1.0f);
+        shadow.renderedMatrix = glm::mat4(1.0f);
+        shadow.priority = 0.0f;
+        shadow.hasTile = false;
+        shadow.tile.x = 0;
+        shadow.tile.y = 0;
+        shadow.tile.level = 0;
+        shadow.hasDepth = false;
+        shadow.valid = false;
+        shadow.framesSinceRender = 0;
+
+        this->lights.push_back(shadow);
+        return (int)this->lights.size() - 1;
+    }
+
+    void ShadowAtlas::setLight(int light, glm::vec3 position, glm::vec3 direction, float outerCutOff, float range) {
+
+        SpotShadow& shadow = this->lights[light];
+
+        glm::vec3 directionN = glm::normalize(direction);
+        glm::vec3 up = std::fabs(directionN.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(position, position + directionN, up);
+        //the square frustum encloses the cone, a little wider so PCF at the cone edge stays inside the tile
+        float fov = std::min(2.0f * std::acos(glm::clamp(outerCutOff, -1.0f, 1.0f)) * 1.1f, glm::radians(170.0f));
+        glm::mat4 lightProjection = glm::perspective(fov, 1.0f, std::max(0.05f, range * 0.005f), range);
+        glm::mat4 lightSpaceMatrix = lightProjection * lightView;
+
+        //a light that moves needs a new render, static ones included
+        if (lightSpaceMatrix != shadow.lightSpaceMatrix) {
+            shadow.lightSpaceMatrix = lightSpaceMatrix;
+            shadow.valid = false;
+        }
+        shadow.position = position;
+        shadow.range = range;
+    }
+
+    void ShadowAtlas::setImportance(int light, float importance) {
+        this->lights[light].importance = importance;
+    }
+
+    void ShadowAtlas::invalidate(gps::BoundingBox bounds) {
+
+        if (bounds.isEmpty()) {
+            return;
+        }
+
+        for (size_t i = 0; i < this->lights.size(); i++) {
+
+            //distance from the light to the box against the range
+            glm::vec3 closest = glm::clamp(this->lights[i].position, bounds.min, bounds.max);
+            if (glm::length(closest - this->lights[i].position) <= this->lights[i].range) {
+                this->lights[i].valid = false;
+            }
+        }
+    }
+
+    void ShadowAtlas::invalidateAll() {
+
+        for (size_t i = 0; i < this->lights.size(); i++) {
+            this->lights[i].valid = false;
+        }
+    }
+
+    void ShadowAtlas::update(glm::mat4 view, glm::mat4 projection) {
+
+        //rank the lights
+        std::vector<int> order(this->lights.size());
+        for (size_t i = 0; i < this->lights.size(); i++) {
+            SpotShadow& shadow = this->lights[i];
+            shadow.priority = shadow.importance * screenCoverage(view, projection, shadow.position, shadow.range);
+            shadow.framesSinceRender++;
+            order[i] = (int)i;
+        }
+        std::sort(order.begin(), order.end(), [this](int a, int b) {
+            return this->lights[a].priority > this->lights[b].priority;
+        });
+
+        //tile edge proportional to the square root of the priority (the on-screen radius),
+        //scaled down together when the wanted tiles do not fit into the atlas
+        float wantedArea = 0.0f;
+        for (size_t i = 0; i < this->lights.size(); i++) {
+            float edge = this->maxTile * std::sqrt(std::min(this->lights[i].priority, 1.0f));
+            wantedArea += edge * edge;
+        }
+        //some headroom for the rounding to powers of two
+        float atlasArea = 0.8f * this->atlasSize * this->atlasSize;
+        float fit = wantedArea > atlasArea ? std::sqrt(atlasArea / wantedArea) : 1.0f;
+
+        //assign the tiles in priority order, evicting the least important lights when the atlas is full
+        int evictFrom = (int)order.size() - 1;
+        for (size_t i = 0; i < order.size(); i++) {
+
+            SpotShadow& shadow = this->lights[order[i]];
+            if (shadow.priority <= 0.0f) {
+                break;
+            }
+
+            int level = desiredLevel(shadow, fit * this->maxTile * std::sqrt(std::min(shadow.priority, 1.0f)));
+            if (shadow.hasTile && shadow.tile.level == level) {
+                continue;
+            }
+            releaseLight(order[i]);
+
+            //the desired size, or any smaller one that is still free
+            Tile tile;
+            bool allocated = false;
+            while (!allocated) {
+                for (int l = level; l < this->levels && !allocated; l++) {
+                    allocated = allocate(l, tile);
+                }
+                if (allocated || evictFrom <= (int)i) {
+                    break;
+                }
+                releaseLight(order[evictFrom--]);
+            }
+
+            if (allocated) {
+                shadow.hasTile = true;
+                shadow.tile = tile;
+                shadow.hasDepth = false;
+                shadow.valid = false;
+            }
+        }
+
+        //pick the tiles rendered this frame
+        std::vector<std::pair<float, int> > candidates;
+        for (size_t i = 0; i < this->lights.size(); i++) {
+
+            SpotShadow& shadow = this->lights[i];
+            if (!shadow.hasTile || shadow.priority <= 0.0f || (shadow.valid && shadow.isStatic)) {
+                continue;
+            }
+
+            //empty tiles first, then outdated ones, then the dynamic lights that waited the longest
+            float score = shadow.priority * shadow.framesSinceRender;
+            if (!shadow.valid) {
+                score += 1.0e6f;
+            }
+            if (!shadow.hasDepth) {
+                score += 1.0e7f;
+            }
+            candidates.push_back(std::make_pair(score, (int)i));
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+            return a.first > b.first;
+        });
+
+        this->updates.clear();
+        for (size_t i = 0; i < candidates.size() && (int)i < this->updateBudget; i++) {
+            this->updates.push_back(candidates[i].second);
+        }
+    }
+
+    int ShadowAtlas::desiredLevel(const SpotShadow& shadow, float desired) {
+
+        float levelF = std::log2((float)this->maxTile / std::max(desired, 1.0f));
+
+        //only move when the size is clearly off, each move costs a render
+        if (shadow.hasTile && std::fabs(levelF - shadow.tile.level) < 0.75f) {
+            return shadow.tile.level;
+        }
+
+        return std::max(0, std::min((int)std::floor(levelF + 0.5f), this->levels - 1));
+    }
+
+    bool ShadowAtlas::allocate(int level, Tile& tile) {
+
+        if (!this->freeTiles[level].empty()) {
+            tile = this->freeTiles[level].back();
+            this->freeTiles[level].pop_back();
+            return true;
+        }
+
+        //split a larger tile in four
+        Tile parent;
+        if (level == 0 || !allocate(level - 1, parent)) {
+            return false;
+        }
+
+        int size = tileSize(level);
+        for (int i = 1; i < 4; i++) {
+            Tile child = { parent.x + (i & 1) * size, parent.y + (i >> 1) * size, level };
+            this->freeTiles[level].push_back(child);
+        }
+        tile.x = parent.x;
+        tile.y = parent.y;
+        tile.level = level;
+        return true;
+    }
+
+    void ShadowAtlas::release(Tile tile) {
+
+        if (tile.level > 0) {
+
+            //the three other quarters of the parent tile
+            int parentSize = tileSize(tile.level - 1);
+            int parentX = tile.x / parentSize * parentSize;
+            int parentY = tile.y / parentSize * parentSize;
+
+            std::vector<Tile>& free = this->freeTiles[tile.level];
+            std::vector<size_t> buddies;
+            for (size_t i = 0; i < free.size(); i++) {
+                if (free[i].x / parentSize * parentSize == parentX && free[i].y / parentSize * parentSize == parentY) {
+                    buddies.push_back(i);
+                }
+            }
+
+            if (buddies.size() == 3) {
+                for (int i = 2; i >= 0; i--) {
+                    free.erase(free.begin() + buddies[i]);
+                }
+                Tile parent = { parentX, parentY, tile.level - 1 };
+                release(parent);
+                return;
+            }
+        }
+
+        this->freeTiles[tile.level].push_back(tile);
+    }
+
+    void ShadowAtlas::releaseLight(int light) {
+
+        SpotShadow& shadow = this->lights[light];
+        if (shadow.hasTile) {
+            release(shadow.tile);
+            shadow.hasTile = false;
+            shadow.hasDepth = false;
+            shadow.valid = false;
+        }
+    }
+
+    int ShadowAtlas::tileSize(int level) {
+        return this->maxTile >> level;
+    }
+
+    float ShadowAtlas::screenCoverage(glm::mat4 view, glm::mat4 projection, glm::vec3 center, float radius) {
+
+        //frustum planes of the camera (rows of the view projection matrix), w is the signed distance
+        glm::mat4 viewProjection = glm::transpose(projection * view);
+        glm::vec4 planes[6] = {
+            viewProjection[3] + viewProjection[0], viewProjection[3] - viewProjection[0],
+            viewProjection[3] + viewProjection[1], viewProjection[3] - viewProjection[1],
+            viewProjection[3] + viewProjection[2], viewProjection[3] - viewProjection[2]
+        };
+        for (int i = 0; i < 6; i++) {
+            float length = glm::length(glm::vec3(planes[i]));
+            if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius * length) {
+                return 0.0f;
+            }
+        }
+
+        //area of the projected sphere over the screen area, both in normalized device coordinates
+        float distance = glm::length(glm::vec3(view * glm::vec4(center, 1.0f)));
+        if (distance <= radius) {
+            return 1.0f;
+        }
+        float projectedY = radius * projection[1][1] / distance;
+        float projectedX = radius * projection[0][0] / distance;
+        return std::min(3.14159265f * projectedX * projectedY / 4.0f, 1.0f);
+    }
+
+    int ShadowAtlas::getUpdateCount() {
+        return (int)this->updates.size();
+    }
+
+    int ShadowAtlas::getUpdate(int i) {
+        return this->updates[i];
+    }
+
+    void ShadowAtlas::beginTile(int light) {
+
+        SpotShadow& shadow = this->lights[light];
+        int size = tileSize(shadow.tile.level);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glViewport(shadow.tile.x, shadow.tile.y, size, size);
+        glScissor(shadow.tile.x, shadow.tile.y, size, size);
+        glEnable(GL_SCISSOR_TEST);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    void ShadowAtlas::endTile(int light) {
+
+        glDisable(GL_SCISSOR_TEST);
+
+        SpotShadow& shadow = this->lights[light];
+        shadow.renderedMatrix = shadow.lightSpaceMatrix;
+        shadow.hasDepth = true;
+        shadow.valid = true;
+        shadow.framesSinceRender = 0;
+    }
+
+    glm::mat4 ShadowAtlas::getRenderMatrix(int light) {
+        return this->lights[light].lightSpaceMatrix;
+    }
+
+    bool ShadowAtlas::hasShadow(int light) {
+
+        //an outdated tile is still used (with the matrix of its render) until its turn comes
+        const SpotShadow& shadow = this->lights[light];
+        return shadow.hasTile && shadow.hasDepth;
+    }
+
+    glm::mat4 ShadowAtlas::getLightSpaceMatrix(int light) {
+        return this->lights[light].renderedMatrix;
+    }
+
+    glm::vec4 ShadowAtlas::getTileRect(int light) {
+
+        if (!hasShadow(light)) {
+            return glm::vec4(0.0f);
+        }
+
+        const Tile& tile = this->lights[light].tile;
+        float size = (float)tileSize(tile.level) / this->atlasSize;
+        return glm::vec4((float)tile.x / this->atlasSize, (float)tile.y / this->atlasSize, size, size);
+    }
+
+    GLuint ShadowAtlas::getDepthTexture() {
+        return this->depthTexture;
+    }
+
+    int ShadowAtlas::getAtlasSize() {
+        return this->atlasSize;
+    }
+
+    int ShadowAtlas::getAllocatedCount() {
+
+        int count = 0;
+        for (size_t i = 0; i < this->lights.size(); i++) {
+            if (this->lights[i].hasTile) {
+                count++;
+            }
+        }
+        return count;
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef ShadowAtlas_hpp
+#define ShadowAtlas_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //spot light shadows packed into tiles of one depth texture
+    //
+    //every frame the lights are ranked by screen coverage x importance, which also picks their tile size
+    //(power of two between the minimum and the maximum tile, handed out by a buddy allocator); tiles
+    //stay with their light while the size does not change, so their depth can be reused. At most
+    //updateBudget tiles are rendered per frame, highest priority first: tiles without valid depth,
+    //then dynamic lights by priority x frames since their last render. Static lights keep their tile
+    //until they move or invalidate() is called for a caster inside their range
+    class ShadowAtlas {
+
+    public:
+        ShadowAtlas();
+
+        //atlasSize, maxTile and minTile are powers of two, maxTile <= atlasSize
+        void init(int atlasSize, int maxTile, int minTile);
+        void destroy();
+
+        //tiles rendered per frame at most
+        void setUpdateBudget(int tiles);
+
+        //returns the handle of the new light
+        int addLight(bool isStatic, float importance);
+        //outerCutOff is the cosine of the outer cone angle, range is where the light fades out
+        void setLight(int light, glm::vec3 position, glm::vec3 direction, float outerCutOff, float range);
+        void setImportance(int light, float importance);
+        //re-renders every light whose range touches the world space box
+        void invalidate(gps::BoundingBox bounds);
+        void invalidateAll();
+
+        //ranks the lights for this camera, (re)assigns the tiles and picks the tiles rendered this frame
+        void update(glm::mat4 view, glm::mat4 projection);
+
+        int getUpdateCount();
+        //light to render for the i-th update of this frame
+        int getUpdate(int i);
+        //binds the atlas and restricts drawing to the tile of the light
+        void beginTile(int light);
+        void endTile(int light);
+
+        //matrix to draw the casters of the tile with, between beginTile and endTile
+        glm::mat4 getRenderMatrix(int light);
+
+        //true when the tile of the light holds depth, possibly from an older pose
+        bool hasShadow(int light);
+        //light space matrix the depth in the tile was rendered with, for the lookups
+        glm::mat4 getLightSpaceMatrix(int light);
+        //tile in atlas texture coordinates: xy - offset, zw - size; zero when the light has no shadow
+        glm::vec4 getTileRect(int light);
+
+        GLuint getDepthTexture();
+        int getAtlasSize();
+        //number of lights holding a tile
+        int getAllocatedCount();
+
+    private:
+        struct Tile {
+            int x;
+            int y;
+            //0 is the largest tile size
+            int level;
+        };
+
+        struct SpotShadow {
+            bool isStatic;
+            float importance;
+            glm::vec3 position;
+            float range;
+            //matrix of the current pose and the one the tile holds
+            glm::mat4 lightSpaceMatrix;
+            glm::mat4 renderedMatrix;
+
+            float priority;
+            bool hasTile;
+            Tile tile;
+            //the tile holds depth, rendered with renderedMatrix
+            bool hasDepth;
+            //and that depth matches the current pose and casters
+            bool valid;
+            int framesSinceRender;
+        };
+
+        int atlasSize;
+        int maxTile;
+        int minTile;
+        int levels;
+        int updateBudget;
+
+        GLuint depthTexture;
+        GLuint framebuffer;
+
+        std::vector<SpotShadow> lights;
+        //free tiles of every level
+        std::vector<std::vector<Tile> > freeTiles;
+        std::vector<int> updates;
+
+        bool allocate(int level, Tile& tile);
+        //gives the tile back, merging it with its free buddies
+        void release(Tile tile);
+        void releaseLight(int light);
+        int tileSize(int level);
+        //tile level for the wanted tile edge, with some hysteresis around the current level
+        int desiredLevel(const SpotShadow& shadow, float desired);
+
+        static float screenCoverage(glm::mat4 view, glm::mat4 projection, glm::vec3 center, float radius);
+    };
+}
+
+#endif /* ShadowAtlas_hpp */
@@ -8,28 +8,239 @@
 
 #include "SkyBox.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+
+//SSE2 is always there on x64, other targets take the scalar loop
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SKYBOX_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace gps {
     
+    namespace {
+
+        const float PI = 3.14159265358979f;
+        //9 coefficients x rgb, then the total solid angle
+        const int PROJECTION_SUMS = 28;
+
+        unsigned long long hashBytes(unsigned long long hash, const void* data, size_t size)
+        {
+            //FNV-1a over 8 byte words, the faces are tens of megabytes
+            const unsigned char* bytes = (const unsigned char*)data;
+            size_t i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                unsigned long long word;
+                std::memcpy(&word, bytes + i, sizeof(word));
+                hash ^= word;
+                hash *= 1099511628211ULL;
+            }
+            for (; i < size; i++)
+            {
+                hash ^= bytes[i];
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        //direction of the face texel (s, t) in [-1, 1] before normalizing: origin + s * sAxis + t * tAxis
+        //(the GL cube map layout, faces in +X -X +Y -Y +Z -Z order, t growing down the image)
+        struct FaceFrame
+        {
+            float origin[3];
+            float sAxis[3];
+            float tAxis[3];
+        };
+
+        const FaceFrame FACE_FRAMES[6] = {
+            { { 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f }, { 0.0f, -1.0f, 0.0f } },
+            { { -1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, -1.0f, 0.0f } },
+            { { 0.0f, 1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+            { { 0.0f, -1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f } },
+            { { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, -1.0f, 0.0f } },
+            { { 0.0f, 0.0f, -1.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, -1.0f, 0.0f } }
+        };
+
+        //real spherical harmonics up to band 2, same order as basic.frag
+        void EvaluateBasis(float x, float y, float z, float* basis)
+        {
+            basis[0] = 0.282095f;
+            basis[1] = 0.488603f * y;
+            basis[2] = 0.488603f * z;
+            basis[3] = 0.488603f * x;
+            basis[4] = 1.092548f * x * y;
+            basis[5] = 1.092548f * y * z;
+            basis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+            basis[7] = 1.092548f * x * z;
+            basis[8] = 0.546274f * (x * x - y * y);
+        }
+
+        //adds the radiance of every texel of one face times the basis and the texel's solid angle to sums
+        void ProjectFace(int face, const unsigned char* pixels, int width, int height, double* sums)
+        {
+            const FaceFrame& frame = FACE_FRAMES[face];
+            //texels are 2/width x 2/height on a face at distance 1, shrinking by 1/distance^3 towards the corners
+            const float texelArea = 4.0f / ((float)width * height);
+            const float colorScale = 1.0f / 255.0f;
+
+            for (int y = 0; y < height; y++)
+            {
+                const float t = 2.0f * (y + 0.5f) / height - 1.0f;
+                const unsigned char* row = pixels + (size_t)y * width * 3;
+                //a row is summed in float, the rows in double
+                float rowSums[PROJECTION_SUMS] = { 0.0f };
+                int x = 0;
+
+#ifdef SKYBOX_SSE2
+                //four texels of the row at a time, one lane each
+                __m128 accumulators[PROJECTION_SUMS];
+                for (int i = 0; i < PROJECTION_SUMS; i++)
+                    accumulators[i] = _mm_setzero_ps();
+
+                const __m128 one = _mm_set1_ps(1.0f);
+                const __m128 lanes = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+                const __m128 sStep = _mm_set1_ps(2.0f / width);
+                const __m128 tValue = _mm_set1_ps(t);
+                const __m128 baseX = _mm_set1_ps(frame.origin[0] + t * frame.tAxis[0]);
+                const __m128 baseY = _mm_set1_ps(frame.origin[1] + t * frame.tAxis[1]);
+                const __m128 baseZ = _mm_set1_ps(frame.origin[2] + t * frame.tAxis[2]);
+                const __m128 sAxisX = _mm_set1_ps(frame.sAxis[0]);
+                const __m128 sAxisY = _mm_set1_ps(frame.sAxis[1]);
+                const __m128 sAxisZ = _mm_set1_ps(frame.sAxis[2]);
+
+                for (; x + 4 <= width; x += 4)
+                {
+                    __m128 s = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), lanes), sStep), one);
+                    __m128 dx = _mm_add_ps(baseX, _mm_mul_ps(s, sAxisX));
+                    __m128 dy = _mm_add_ps(baseY, _mm_mul_ps(s, sAxisY));
+                    __m128 dz = _mm_add_ps(baseZ, _mm_mul_ps(s, sAxisZ));
+                    //the frame is orthonormal, so the squared length is 1 + s^2 + t^2
+                    __m128 lengthSquared = _mm_add_ps(_mm_add_ps(one, _mm_mul_ps(s, s)), _mm_mul_ps(tValue, tValue));
+                    __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+                    dx = _mm_mul_ps(dx, inverseLength);
+                    dy = _mm_mul_ps(dy, inverseLength);
+                    dz = _mm_mul_ps(dz, inverseLength);
+                    __m128 solidAngle = _mm_mul_ps(_mm_mul_ps(inverseLength, inverseLength), _mm_mul_ps(inverseLength, _mm_set1_ps(texelArea)));
+
+                    __m128 basis[9];
+                    basis[0] = _mm_set1_ps(0.282095f);
+                    basis[1] = _mm_mul_ps(_mm_set1_ps(0.488603f), dy);
+                    basis[2] = _mm_mul_ps(_mm_set1_ps(0.488603f), dz);
+                    basis[3] = _mm_mul_ps(_mm_set1_ps(0.488603f), dx);
+                    basis[4] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dx, dy));
+                    basis[5] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dy, dz));
+                    basis[6] = _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(dz, dz)), one));
+                    basis[7] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dx, dz));
+                    basis[8] = _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+
+                    //radiance times solid angle of each lane
+                    const unsigned char* texel = row + x * 3;
+                    __m128 weight = _mm_mul_ps(solidAngle, _mm_set1_ps(colorScale));
+                    __m128 red = _mm_mul_ps(weight, _mm_set_ps(texel[9], texel[6], texel[3], texel[0]));
+                    __m128 green = _mm_mul_ps(weight, _mm_set_ps(texel[10], texel[7], texel[4], texel[1]));
+                    __m128 blue = _mm_mul_ps(weight, _mm_set_ps(texel[11], texel[8], texel[5], texel[2]));
+
+                    for (int i = 0; i < 9; i++)
+                    {
+                        accumulators[i * 3] = _mm_add_ps(accumulators[i * 3], _mm_mul_ps(basis[i], red));
+                        accumulators[i * 3 + 1] = _mm_add_ps(accumulators[i * 3 + 1], _mm_mul_ps(basis[i], green));
+                        accumulators[i * 3 + 2] = _mm_add_ps(accumulators[i * 3 + 2], _mm_mul_ps(basis[i], blue));
+                    }
+                    accumulators[27] = _mm_add_ps(accumulators[27], solidAngle);
+                }
+
+                for (int i = 0; i < PROJECTION_SUMS; i++)
+                {
+                    float laneSums[4];
+                    _mm_storeu_ps(laneSums, accumulators[i]);
+                    rowSums[i] = laneSums[0] + laneSums[1] + laneSums[2] + laneSums[3];
+                }
+#endif
+
+                //the remaining texels (all of them without SSE2)
+                for (; x < width; x++)
+                {
+                    float s = 2.0f * (x + 0.5f) / width - 1.0f;
+                    float inverseLength = 1.0f / sqrtf(1.0f + s * s + t * t);
+                    float dx = (frame.origin[0] + s * frame.sAxis[0] + t * frame.tAxis[0]) * inverseLength;
+                    float dy = (frame.origin[1] + s * frame.sAxis[1] + t * frame.tAxis[1]) * inverseLength;
+                    float dz = (frame.origin[2] + s * frame.sAxis[2] + t * frame.tAxis[2]) * inverseLength;
+                    float solidAngle = texelArea * inverseLength * inverseLength * inverseLength;
+
+                    float basis[9];
+                    EvaluateBasis(dx, dy, dz, basis);
+                    const unsigned char* texel = row + x * 3;
+                    for (int i = 0; i < 9; i++)
+                    {
+                        for (int channel = 0; channel < 3; channel++)
+                            rowSums[i * 3 + channel] += basis[i] * solidAngle * texel[channel] * colorScale;
+                    }
+                    rowSums[27] += solidAngle;
+                }
+
+                for (int i = 0; i < PROJECTION_SUMS; i++)
+                    sums[i] += rowSums[i];
+            }
+        }
+    }
+
     SkyBox::SkyBox()
     {
-        
+        for (int i = 0; i < 9; i++)
+            irradiance.coefficients[i] = glm::vec3(0.0f);
     }
     
-    void SkyBox::Load(std::vector<const GLchar*> cubeMapFaces)
+    void SkyBox::Load(std::vector<const GLchar*> cubeMapFaces, ThreadPool* threadPool)
     {
-        cubemapTexture = LoadSkyBoxTextures(cubeMapFaces);
+        std::vector<Face> faces(cubeMapFaces.size());
+        //the cache key covers the decoded pixels, the images are decoded anyway for the cube map,
+        //so a repainted face is noticed even when its file keeps the same size
+        int version = IRRADIANCE_CACHE_VERSION;
+        unsigned long long key = hashBytes(14695981039346656037ULL, &version, sizeof(version));
+        for (size_t i = 0; i < cubeMapFaces.size(); i++)
+        {
+            int n;
+            faces[i].pixels = stbi_load(cubeMapFaces[i], &faces[i].width, &faces[i].height, &n, 3);
+            if (!faces[i].pixels) {
+                fprintf(stderr, "ERROR: could not load %s\n", cubeMapFaces[i]);
+            }
+            else {
+                int size[2] = { faces[i].width, faces[i].height };
+                key = hashBytes(key, size, sizeof(size));
+                key = hashBytes(key, faces[i].pixels, (size_t)faces[i].width * faces[i].height * 3);
+            }
+        }
+
+        cubemapTexture = LoadSkyBoxTextures(faces);
         InitSkyBox();
+
+        //irradiance.sh9 in the folder of the faces
+        std::string cachePath = cubeMapFaces.empty() ? std::string() : std::string(cubeMapFaces[0]);
+        size_t slash = cachePath.find_last_of("/\\");
+        cachePath = (slash == std::string::npos ? std::string() : cachePath.substr(0, slash + 1)) + "irradiance.sh9";
+
+        if (!LoadIrradiance(cachePath, key))
+        {
+            ComputeIrradiance(faces, threadPool);
+            if (cubemapTexture)
+                SaveIrradiance(cachePath, key);
+        }
+
+        for (size_t i = 0; i < faces.size(); i++)
+        {
+            if (faces[i].pixels)
+                stbi_image_free(faces[i].pixels);
+        }
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    void SkyBox::Draw(const gps::Shader& shader)
     {
         shader.useShaderProgram();
         
-        //set the view and projection matrices
-        glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-        
         glDepthFunc(GL_LEQUAL);
         
         glBindVertexArray(skyboxVAO);
@@ -42,27 +253,21 @@ namespace gps {
         glDepthFunc(GL_LESS);
     }
     
-    GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
+    GLuint SkyBox::LoadSkyBoxTextures(const std::vector<Face>& faces)
     {
         GLuint textureID;
         glGenTextures(1, &textureID);
         glActiveTexture(GL_TEXTURE0);
         
-        int width,height, n;
-        unsigned char* image;
-        int force_channels = 3;
-        
         glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for(GLuint i = 0; i < skyBoxFaces.size(); i++)
+        for(GLuint i = 0; i < faces.size(); i++)
         {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
-                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
+            if (!faces[i].pixels) {
                 return false;
             }
             glTexImage2D(
                          GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
+                         GL_RGB, faces[i].width, faces[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, faces[i].pixels
                          );
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -138,4 +343,77 @@ namespace gps {
     {
         return cubemapTexture;
     }
+    
+    const SphericalHarmonics& SkyBox::GetIrradiance()
+    {
+        return irradiance;
+    }
+    
+    void SkyBox::ComputeIrradiance(const std::vector<Face>& faces, ThreadPool* threadPool)
+    {
+        //faces are projected independently, then added up
+        int faceCount = (int)std::min(faces.size(), (size_t)6);
+        std::vector<double> sums(faceCount * PROJECTION_SUMS, 0.0);
+        std::function<void(int, int)> projectTask = [&](int begin, int end) {
+            for (int face = begin; face < end; face++)
+            {
+                if (faces[face].pixels)
+                    ProjectFace(face, faces[face].pixels, faces[face].width, faces[face].height, &sums[face * PROJECTION_SUMS]);
+            }
+        };
+        if (threadPool)
+            threadPool->parallelFor(faceCount, 1, projectTask);
+        else
+            projectTask(0, faceCount);
+
+        double total[PROJECTION_SUMS] = { 0.0 };
+        for (int face = 0; face < faceCount; face++)
+        {
+            for (int i = 0; i < PROJECTION_SUMS; i++)
+                total[i] += sums[face * PROJECTION_SUMS + i];
+        }
+
+        //the texel solid angles add up to 4 pi up to discretization, renormalize with the actual sum
+        double solidAngleScale = total[27] > 0.0 ? 4.0 * PI / total[27] : 0.0;
+        //cosine lobe convolution per band (pi, 2pi/3, pi/4), divided by pi so a white sky gives 1
+        const float bandScale[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+        for (int i = 0; i < 9; i++)
+        {
+            irradiance.coefficients[i] = glm::vec3((float)total[i * 3], (float)total[i * 3 + 1], (float)total[i * 3 + 2])
+                * (float)solidAngleScale * bandScale[i];
+        }
+    }
+    
+    bool SkyBox::LoadIrradiance(const std::string& path, unsigned long long key)
+    {
+        std::ifstream file(path.c_str());
+        std::string magic;
+        int version = 0;
+        unsigned long long fileKey = 0;
+        if (!(file >> magic >> version >> fileKey) || magic != "SH9" || version != IRRADIANCE_CACHE_VERSION || fileKey != key)
+            return false;
+
+        SphericalHarmonics loaded;
+        for (int i = 0; i < 9; i++)
+        {
+            if (!(file >> loaded.coefficients[i].x >> loaded.coefficients[i].y >> loaded.coefficients[i].z))
+                return false;
+        }
+        irradiance = loaded;
+        return true;
+    }
+    
+    void SkyBox::SaveIrradiance(const std::string& path, unsigned long long key)
+    {
+        std::ofstream file(path.c_str());
+        if (!file) {
+            fprintf(stderr, "ERROR: could not write %s\n", path.c_str());
+            return;
+        }
+
+        file.precision(9);
+        file << "SH9 " << IRRADIANCE_CACHE_VERSION << " " << key << "\n";
+        for (int i = 0; i < 9; i++)
+            file << irradiance.coefficients[i].x << " " << irradiance.coefficients[i].y << " " << irradiance.coefficients[i].z << "\n";
+    }
 }
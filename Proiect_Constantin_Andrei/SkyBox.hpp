@@ -11,28 +11,55 @@
 
 
 #include "Shader.hpp"
+#include "ThreadPool.hpp"
 #include "stb_image.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <string>
 #include <vector>
 #include <stdio.h>
 
 namespace gps {
+
+    //diffuse light of a sky as 9 (L2) spherical harmonics, already convolved with the cosine lobe:
+    //sum(coefficients[i] * Y[i](n)) is the light reaching a surface with world normal n
+    struct SphericalHarmonics {
+
+        glm::vec3 coefficients[9];
+    };
+
     class SkyBox
     {
     public:
         SkyBox();
-        void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        //the faces are also projected to spherical harmonics (one face per thread when threadPool is given),
+        //the coefficients are cached next to the first face
+        void Load(std::vector<const GLchar*> cubeMapFaces, ThreadPool* threadPool = NULL);
+        //view and projection come from the FrameUniforms block
+        void Draw(const gps::Shader& shader);
         GLuint GetTextureId();
+        const SphericalHarmonics& GetIrradiance();
     private:
+        static const int IRRADIANCE_CACHE_VERSION = 1;
+
+        struct Face {
+            int width;
+            int height;
+            //RGB8, NULL when the file could not be loaded
+            unsigned char* pixels;
+        };
+
         GLuint skyboxVAO;
         GLuint skyboxVBO;
         GLuint cubemapTexture;
-        GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        SphericalHarmonics irradiance;
+        GLuint LoadSkyBoxTextures(const std::vector<Face>& faces);
         void InitSkyBox();
+        void ComputeIrradiance(const std::vector<Face>& faces, ThreadPool* threadPool);
+        bool LoadIrradiance(const std::string& path, unsigned long long key);
+        void SaveIrradiance(const std::string& path, unsigned long long key);
     };
 }
 
@@ -0,0 +1,102 @@
+#include "StreamingVertexBuffer.hpp"
+
+namespace gps {
+
+    StreamingVertexBuffer::StreamingVertexBuffer() {
+
+        this->vertexArray = 0;
+        this->instanced = false;
+        this->vertexSize = 0;
+        this->maxVertices = 0;
+        this->first = 0;
+        this->count = 0;
+    }
+
+    void StreamingVertexBuffer::create(GLsizei vertexSize, int maxVertices, bool instanced) {
+
+        this->vertexSize = vertexSize;
+        this->maxVertices = maxVertices;
+        this->instanced = instanced;
+        this->attributes.clear();
+
+        //regions aligned to whole vertices, so every offset is a first vertex index
+        this->ring.create(GL_ARRAY_BUFFER, (GLsizeiptr)vertexSize * maxVertices, vertexSize);
+        glGenVertexArrays(1, &this->vertexArray);
+    }
+
+    void StreamingVertexBuffer::addAttribute(GLuint location, GLint components, GLsizei offset, GLenum type, GLboolean normalized) {
+
+        Attribute attribute = { location, components, offset, type, normalized };
+        this->attributes.push_back(attribute);
+
+        glBindVertexArray(this->vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, this->ring.getId());
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, components, type, normalized, this->vertexSize, (GLvoid*)(GLintptr)offset);
+        if (this->instanced) {
+            glVertexAttribDivisor(location, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void StreamingVertexBuffer::destroy() {
+
+        if (this->vertexArray) {
+            glDeleteVertexArrays(1, &this->vertexArray);
+            this->vertexArray = 0;
+        }
+        this->ring.destroy();
+    }
+
+    void* StreamingVertexBuffer::map() {
+
+        this->ring.beginFrame();
+
+        GLintptr offset = 0;
+        void* vertices = this->ring.allocate((GLsizeiptr)this->vertexSize * this->maxVertices, &offset);
+        this->first = (GLint)(offset / this->vertexSize);
+        this->count = 0;
+        return vertices;
+    }
+
+    void StreamingVertexBuffer::unmap(int count) {
+
+        this->count = count < this->maxVertices ? count : this->maxVertices;
+        this->ring.release((GLsizeiptr)this->vertexSize * (this->maxVertices - this->count));
+        this->ring.flush();
+    }
+
+    void StreamingVertexBuffer::draw(GLenum mode) {
+
+        if (this->count > 0) {
+            glBindVertexArray(this->vertexArray);
+            glDrawArrays(mode, this->first, this->count);
+            glBindVertexArray(0);
+        }
+        this->ring.endFrame();
+    }
+
+    void StreamingVertexBuffer::drawInstanced(GLenum mode, GLsizei vertexCount) {
+
+        if (this->count > 0) {
+            glBindVertexArray(this->vertexArray);
+            glBindBuffer(GL_ARRAY_BUFFER, this->ring.getId());
+            GLintptr base = (GLintptr)this->first * this->vertexSize;
+            for (size_t i = 0; i < this->attributes.size(); i++) {
+                const Attribute& attribute = this->attributes[i];
+                glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized,
+                    this->vertexSize, (GLvoid*)(base + attribute.offset));
+            }
+            glDrawArraysInstanced(mode, 0, vertexCount, this->count);
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        this->ring.endFrame();
+    }
+
+    int StreamingVertexBuffer::getMaxVertices() {
+
+        return this->maxVertices;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef StreamingVertexBuffer_hpp
+#define StreamingVertexBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "RingBuffer.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    //vertices rebuilt every frame (CPU rain, debug lines): one VAO over a RingBuffer that is created once
+    //the attribute pointers never change, each frame is drawn starting at the first vertex of its region
+    //one batch per frame: map, write, unmap, draw
+    //instanced buffers hold one element per instance instead; without base instances (GL 4.2) their
+    //attribute pointers are moved to the frame's region before the draw
+    class StreamingVertexBuffer {
+
+    public:
+        StreamingVertexBuffer();
+
+        //vertexSize - bytes per vertex, maxVertices - most vertices written in one frame
+        //instanced - every vertex is an instance, drawn with drawInstanced
+        void create(GLsizei vertexSize, int maxVertices, bool instanced = false);
+        //attribute of every vertex: location, component count and byte offset inside the vertex,
+        //integer types are read as floats, scaled to [0, 1] or [-1, 1] when normalized
+        void addAttribute(GLuint location, GLint components, GLsizei offset, GLenum type = GL_FLOAT, GLboolean normalized = GL_FALSE);
+        void destroy();
+
+        //room for maxVertices vertices of this frame, written in place (mapped memory when persistent)
+        void* map();
+        //count vertices were written, only those are uploaded and drawn
+        void unmap(int count);
+        //draws this frame's vertices with the current program, then fences the region
+        void draw(GLenum mode);
+        //draws vertexCount vertices for each of this frame's instances, then fences the region
+        void drawInstanced(GLenum mode, GLsizei vertexCount);
+
+        int getMaxVertices();
+
+    private:
+        struct Attribute {
+
+            GLuint location;
+            GLint components;
+            GLsizei offset;
+            GLenum type;
+            GLboolean normalized;
+        };
+
+        RingBuffer ring;
+        bool instanced;
+        std::vector<Attribute> attributes;
+        GLuint vertexArray;
+        GLsizei vertexSize;
+        int maxVertices;
+        //first vertex and vertex count of this frame
+        GLint first;
+        GLsizei count;
+    };
+}
+
+#endif /* StreamingVertexBuffer_hpp */
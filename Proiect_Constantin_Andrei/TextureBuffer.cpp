@@ -0,0 +1,63 @@
+#include "TextureBuffer.hpp"
+
+namespace gps {
+
+    TextureBuffer::TextureBuffer() {
+
+        this->bufferId = 0;
+        this->textureId = 0;
+        this->capacity = 0;
+    }
+
+    void TextureBuffer::create(GLenum internalFormat, GLsizeiptr initialSize) {
+
+        //a buffer texture needs storage to be complete, even when nothing is stored yet
+        this->capacity = initialSize > 16 ? initialSize : 16;
+
+        glGenBuffers(1, &this->bufferId);
+        glBindBuffer(GL_TEXTURE_BUFFER, this->bufferId);
+        glBufferData(GL_TEXTURE_BUFFER, this->capacity, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        glGenTextures(1, &this->textureId);
+        glBindTexture(GL_TEXTURE_BUFFER, this->textureId);
+        glTexBuffer(GL_TEXTURE_BUFFER, internalFormat, this->bufferId);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void TextureBuffer::update(const void* data, GLsizeiptr size) {
+
+        //grow geometrically so a slowly rising size does not reallocate every frame
+        while (this->capacity < size) {
+            this->capacity *= 2;
+        }
+
+        glBindBuffer(GL_TEXTURE_BUFFER, this->bufferId);
+        //orphan the old storage, frames still in flight keep reading it
+        glBufferData(GL_TEXTURE_BUFFER, this->capacity, NULL, GL_STREAM_DRAW);
+        if (size > 0) {
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void TextureBuffer::destroy() {
+
+        if (this->textureId) {
+            glDeleteTextures(1, &this->textureId);
+            this->textureId = 0;
+        }
+        if (this->bufferId) {
+            glDeleteBuffers(1, &this->bufferId);
+            this->bufferId = 0;
+        }
+    }
+
+    GLuint TextureBuffer::getTexture() {
+        return this->textureId;
+    }
+
+    GLsizeiptr TextureBuffer::getCapacity() {
+        return this->capacity;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef TextureBuffer_hpp
+#define TextureBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    //buffer read by the shaders through a buffer texture (samplerBuffer, texelFetch)
+    //for arrays too large for a uniform block; GL 4.1 has no shader storage buffers
+    class TextureBuffer {
+
+    public:
+        TextureBuffer();
+
+        //internalFormat - texel format seen by the shaders, e.g. GL_RGBA32F or GL_R16UI
+        void create(GLenum internalFormat, GLsizeiptr initialSize);
+        //replaces the content, orphaning the previous storage and growing it when needed
+        void update(const void* data, GLsizeiptr size);
+        void destroy();
+
+        GLuint getTexture();
+        GLsizeiptr getCapacity();
+
+    private:
+        GLuint bufferId;
+        GLuint textureId;
+        GLsizeiptr capacity;
+    };
+}
+
+#endif /* TextureBuffer_hpp */
@@ -0,0 +1,239 @@
+#include "TexturePacker.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace gps {
+
+    TexturePacker::TexturePacker() {
+
+        this->mode = RESAMPLE_UNIFORM;
+        this->uniformSize = 0;
+        this->maxLayers = 0;
+    }
+
+    void TexturePacker::setResampleMode(RESAMPLE_MODE mode, int uniformSize) {
+
+        this->mode = mode;
+        this->uniformSize = uniformSize;
+    }
+
+    TextureLayer TexturePacker::add(const unsigned char* pixels, int width, int height) {
+
+        int packedWidth = width;
+        int packedHeight = height;
+
+        if (mode == RESAMPLE_POWER_OF_TWO) {
+
+            packedWidth = nearestPowerOfTwo(width);
+            packedHeight = nearestPowerOfTwo(height);
+        }
+        else if (mode == RESAMPLE_UNIFORM) {
+
+            //the final size is decided by build() when it is automatic
+            packedWidth = uniformSize;
+            packedHeight = uniformSize;
+        }
+
+        Group& group = findGroup(packedWidth, packedHeight);
+
+        Image image;
+        image.width = width;
+        image.height = height;
+        image.pixels.assign(pixels, pixels + (size_t)width * height * 4);
+        group.images.push_back(image);
+
+        TextureLayer result;
+        result.arrayId = group.id;
+        result.layer = (GLint)group.images.size() - 1;
+        return result;
+    }
+
+    TexturePacker::Group& TexturePacker::findGroup(int width, int height) {
+
+        if (maxLayers == 0) {
+
+            glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        }
+
+        for (size_t i = 0; i < groups.size(); i++) {
+
+            if (!groups[i].built && groups[i].width == width && groups[i].height == height
+                && (GLint)groups[i].images.size() < maxLayers) {
+
+                return groups[i];
+            }
+        }
+
+        Group group;
+        glGenTextures(1, &group.id);
+        group.width = width;
+        group.height = height;
+        //same internal format the single textures used to have
+        group.internalFormat = GL_SRGB8;
+        group.built = false;
+        groups.push_back(group);
+
+        return groups.back();
+    }
+
+    void TexturePacker::build() {
+
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+
+        for (size_t g = 0; g < groups.size(); g++) {
+
+            Group& group = groups[g];
+            if (group.built || group.images.empty()) {
+                continue;
+            }
+
+            if (group.width == 0 || group.height == 0) {
+
+                int size = 1;
+                for (size_t i = 0; i < group.images.size(); i++) {
+
+                    size = std::max(size, nearestPowerOfTwo(std::max(group.images[i].width, group.images[i].height)));
+                }
+                group.width = std::min(std::min(size, (int)MAX_AUTO_UNIFORM_SIZE), (int)maxSize);
+                group.height = group.width;
+            }
+
+            glBindTexture(GL_TEXTURE_2D_ARRAY, group.id);
+            //glTexStorage3D needs GL 4.2, the context is 4.1
+            glTexImage3D(
+                GL_TEXTURE_2D_ARRAY,
+                0,
+                group.internalFormat,
+                group.width,
+                group.height,
+                (GLsizei)group.images.size(),
+                0,
+                GL_RGBA,
+                GL_UNSIGNED_BYTE,
+                NULL
+            );
+
+            for (size_t i = 0; i < group.images.size(); i++) {
+
+                const Image& image = group.images[i];
+                const unsigned char* data = image.pixels.data();
+                std::vector<unsigned char> resampled;
+
+                if (image.width != group.width || image.height != group.height) {
+
+                    resampled = resample(image, group.width, group.height);
+                    data = resampled.data();
+                }
+
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, group.width, group.height, 1,
+                    GL_RGBA, GL_UNSIGNED_BYTE, data);
+            }
+
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+            std::cout << "Texture array " << group.id << " : " << group.images.size() << " layers of "
+                << group.width << "x" << group.height << std::endl;
+
+            //the texels live on the GPU now
+            group.images.clear();
+            group.images.shrink_to_fit();
+            group.built = true;
+        }
+    }
+
+    void TexturePacker::release() {
+
+        for (size_t i = 0; i < groups.size(); i++) {
+
+            glDeleteTextures(1, &groups[i].id);
+        }
+        groups.clear();
+    }
+
+    std::vector<unsigned char> TexturePacker::resample(const Image& image, int width, int height) {
+
+        Image current;
+        const Image* source = &image;
+
+        //halve with a box filter first so large reductions do not alias
+        while (source->width >= 2 * width && source->height >= 2 * height) {
+
+            Image half;
+            half.width = source->width / 2;
+            half.height = source->height / 2;
+            half.pixels.resize((size_t)half.width * half.height * 4);
+
+            for (int y = 0; y < half.height; y++) {
+                for (int x = 0; x < half.width; x++) {
+                    for (int c = 0; c < 4; c++) {
+
+                        const unsigned char* row0 = &source->pixels[((size_t)(2 * y) * source->width) * 4];
+                        const unsigned char* row1 = &source->pixels[((size_t)(2 * y + 1) * source->width) * 4];
+                        int sum = row0[(2 * x) * 4 + c] + row0[(2 * x + 1) * 4 + c]
+                            + row1[(2 * x) * 4 + c] + row1[(2 * x + 1) * 4 + c];
+                        half.pixels[((size_t)y * half.width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                    }
+                }
+            }
+
+            current = std::move(half);
+            source = &current;
+        }
+
+        std::vector<unsigned char> result((size_t)width * height * 4);
+        float scaleX = (float)source->width / width;
+        float scaleY = (float)source->height / height;
+
+        for (int y = 0; y < height; y++) {
+
+            float sy = std::max((y + 0.5f) * scaleY - 0.5f, 0.0f);
+            int y0 = std::min((int)sy, source->height - 1);
+            int y1 = std::min(y0 + 1, source->height - 1);
+            float fy = sy - y0;
+
+            for (int x = 0; x < width; x++) {
+
+                float sx = std::max((x + 0.5f) * scaleX - 0.5f, 0.0f);
+                int x0 = std::min((int)sx, source->width - 1);
+                int x1 = std::min(x0 + 1, source->width - 1);
+                float fx = sx - x0;
+
+                for (int c = 0; c < 4; c++) {
+
+                    float p00 = source->pixels[((size_t)y0 * source->width + x0) * 4 + c];
+                    float p10 = source->pixels[((size_t)y0 * source->width + x1) * 4 + c];
+                    float p01 = source->pixels[((size_t)y1 * source->width + x0) * 4 + c];
+                    float p11 = source->pixels[((size_t)y1 * source->width + x1) * 4 + c];
+                    float top = p00 + (p10 - p00) * fx;
+                    float bottom = p01 + (p11 - p01) * fx;
+                    result[((size_t)y * width + x) * 4 + c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+                }
+            }
+        }
+
+        return result;
+    }
+
+    int TexturePacker::nearestPowerOfTwo(int value) {
+
+        if (value <= 1) {
+            return 1;
+        }
+
+        int lower = 1;
+        while (lower * 2 <= value) {
+            lower *= 2;
+        }
+
+        return (value - lower < lower * 2 - value) ? lower : lower * 2;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef TexturePacker_hpp
+#define TexturePacker_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <vector>
+
+namespace gps {
+
+    //how textures are resized before being packed into array layers
+    //RESAMPLE_NONE - keep the original size, one array per distinct size
+    //RESAMPLE_POWER_OF_TWO - round each side to the nearest power of two, one array per resulting size
+    //RESAMPLE_UNIFORM - resize everything to a single size, so every material lives in one array
+    enum RESAMPLE_MODE {RESAMPLE_NONE, RESAMPLE_POWER_OF_TWO, RESAMPLE_UNIFORM};
+
+    struct TextureLayer {
+
+        //GL_TEXTURE_2D_ARRAY holding the image
+        GLuint arrayId;
+        //layer of the image inside the array
+        GLint layer;
+    };
+
+    class TexturePacker {
+
+    public:
+        static const int MAX_AUTO_UNIFORM_SIZE = 1024;
+
+        TexturePacker();
+
+        //uniformSize is only used by RESAMPLE_UNIFORM, 0 picks the largest power of two among the added images
+        //(capped to MAX_AUTO_UNIFORM_SIZE so a single huge texture does not blow up every layer)
+        void setResampleMode(RESAMPLE_MODE mode, int uniformSize = 0);
+
+        //queues an RGBA8 image for packing and returns the array and layer it will occupy
+        //the array id is valid right away, the texels are uploaded by build()
+        TextureLayer add(const unsigned char* pixels, int width, int height);
+
+        //allocates the arrays, uploads (and resamples) all queued images and builds the mipmaps
+        void build();
+
+        //deletes all the arrays created by this packer
+        void release();
+
+    private:
+        struct Image {
+
+            int width;
+            int height;
+            std::vector<unsigned char> pixels;
+        };
+
+        struct Group {
+
+            GLuint id;
+            //size of the layers, 0 until build() for RESAMPLE_UNIFORM with an automatic size
+            int width;
+            int height;
+            GLenum internalFormat;
+            bool built;
+            std::vector<Image> images;
+        };
+
+        RESAMPLE_MODE mode;
+        int uniformSize;
+        GLint maxLayers;
+        std::vector<Group> groups;
+
+        //finds (or creates) a group that still has room for an image of the given packed size
+        Group& findGroup(int width, int height);
+
+        //resizes an RGBA8 image, box filtering while shrinking by more than 2x and bilinear for the rest
+        static std::vector<unsigned char> resample(const Image& image, int width, int height);
+
+        static int nearestPowerOfTwo(int value);
+    };
+}
+
+#endif /* TexturePacker_hpp */
@@ -0,0 +1,118 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    ThreadPool::ThreadPool() {
+
+        this->stopping = false;
+        this->task = NULL;
+        this->count = 0;
+        this->grain = 1;
+        this->next = 0;
+        this->generation = 0;
+        this->busyWorkers = 0;
+    }
+
+    ThreadPool::~ThreadPool() {
+
+        stop();
+    }
+
+    void ThreadPool::start(int threadCount) {
+
+        stop();
+
+        if (threadCount < 0) {
+            threadCount = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+        }
+
+        this->stopping = false;
+        for (int i = 0; i < threadCount; i++) {
+            this->workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    void ThreadPool::stop() {
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->wakeUp.notify_all();
+
+        for (size_t i = 0; i < this->workers.size(); i++) {
+            this->workers[i].join();
+        }
+        this->workers.clear();
+    }
+
+    int ThreadPool::getThreadCount() {
+        return (int)this->workers.size() + 1;
+    }
+
+    void ThreadPool::parallelFor(int count, int grain, const std::function<void(int, int)>& task) {
+
+        grain = std::max(grain, 1);
+
+        //not worth waking anybody up
+        if (this->workers.empty() || count <= grain) {
+            if (count > 0) {
+                task(0, count);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->task = &task;
+            this->count = count;
+            this->grain = grain;
+            this->next = 0;
+            this->busyWorkers = (int)this->workers.size();
+            this->generation++;
+        }
+        this->wakeUp.notify_all();
+
+        runChunks();
+
+        //the task object lives on the caller's stack, every worker has to be out of it
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->finished.wait(lock, [this] { return this->busyWorkers == 0; });
+        this->task = NULL;
+    }
+
+    void ThreadPool::workerLoop() {
+
+        unsigned int seenGeneration = 0;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->wakeUp.wait(lock, [this, seenGeneration] {
+                    return this->stopping || this->generation != seenGeneration;
+                });
+                if (this->stopping) {
+                    return;
+                }
+                seenGeneration = this->generation;
+            }
+
+            runChunks();
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (--this->busyWorkers == 0) {
+                this->finished.notify_one();
+            }
+        }
+    }
+
+    void ThreadPool::runChunks() {
+
+        int begin;
+        while ((begin = this->next.fetch_add(this->grain)) < this->count) {
+            (*this->task)(begin, std::min(begin + this->grain, this->count));
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    //fixed set of worker threads for data parallel CPU work (light clusters, particles, baking)
+    //parallelFor hands out chunks of an index range, the calling thread works too and returns
+    //once every chunk is done, so the caller can use the results right away
+    class ThreadPool {
+
+    public:
+        ThreadPool();
+        ~ThreadPool();
+
+        //threadCount - workers besides the calling thread, -1 for one less than the hardware threads
+        void start(int threadCount = -1);
+        void stop();
+
+        //threads running a parallelFor, the caller included
+        int getThreadCount();
+
+        //runs task(begin, end) over [0, count) in chunks of grain indices
+        //not reentrant: a task must not start another parallelFor on the same pool
+        void parallelFor(int count, int grain, const std::function<void(int, int)>& task);
+
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wakeUp;
+        std::condition_variable finished;
+        bool stopping;
+
+        //current job, replaced under the mutex when generation changes
+        const std::function<void(int, int)>* task;
+        int count;
+        int grain;
+        std::atomic<int> next;
+        unsigned int generation;
+        int busyWorkers;
+
+        void workerLoop();
+        void runChunks();
+    };
+}
+
+#endif /* ThreadPool_hpp */
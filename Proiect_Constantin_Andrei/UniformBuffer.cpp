@@ -0,0 +1,49 @@
+#include "UniformBuffer.hpp"
+
+namespace gps {
+
+    UniformBuffer::UniformBuffer() {
+
+        this->bufferId = 0;
+        this->bindingPoint = 0;
+        this->size = 0;
+    }
+
+    void UniformBuffer::create(GLsizeiptr size, GLuint bindingPoint) {
+
+        this->size = size;
+        this->bindingPoint = bindingPoint;
+
+        glGenBuffers(1, &this->bufferId);
+        glBindBuffer(GL_UNIFORM_BUFFER, this->bufferId);
+        glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, this->bufferId);
+    }
+
+    void UniformBuffer::update(const void* data, GLsizeiptr size) {
+
+        glBindBuffer(GL_UNIFORM_BUFFER, this->bufferId);
+        //orphan the old storage, frames still in flight keep reading it
+        glBufferData(GL_UNIFORM_BUFFER, this->size, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void UniformBuffer::destroy() {
+
+        if (this->bufferId) {
+            glDeleteBuffers(1, &this->bufferId);
+            this->bufferId = 0;
+        }
+    }
+
+    GLuint UniformBuffer::getId() {
+        return this->bufferId;
+    }
+
+    GLuint UniformBuffer::getBindingPoint() {
+        return this->bindingPoint;
+    }
+}
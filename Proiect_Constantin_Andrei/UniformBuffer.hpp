@@ -0,0 +1,37 @@
+#ifndef UniformBuffer_hpp
+#define UniformBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    //uniform buffer object attached to a fixed binding point
+    //programs reach it through Shader::bindUniformBlock with the same binding point
+    class UniformBuffer {
+
+    public:
+        UniformBuffer();
+
+        //allocates the buffer and attaches it to the binding point
+        void create(GLsizeiptr size, GLuint bindingPoint);
+        //replaces the whole content, orphaning the previous storage so the driver never waits for the GPU
+        void update(const void* data, GLsizeiptr size);
+        void destroy();
+
+        GLuint getId();
+        GLuint getBindingPoint();
+
+    private:
+        GLuint bufferId;
+        GLuint bindingPoint;
+        GLsizeiptr size;
+    };
+}
+
+#endif /* UniformBuffer_hpp */
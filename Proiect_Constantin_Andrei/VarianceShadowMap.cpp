@@ -0,0 +1,225 @@
+#include "VarianceShadowMap.hpp"
+
+#include <algorithm>
+
+namespace gps {
+
+    VarianceShadowMap::VarianceShadowMap() {
+
+        this->cascadeCount = 0;
+        this->depthResolution = 0;
+        this->resolution = 0;
+        this->exponent = 40.0f;
+        this->blurSigma = 1.5f;
+        this->momentTexture = 0;
+        this->blurTexture = 0;
+        this->framebuffer = 0;
+        this->depthSampler = 0;
+        this->emptyVAO = 0;
+        this->updating = false;
+        this->depthMapLoc = -1;
+        this->cascadeLoc = -1;
+        this->downsampleLoc = -1;
+        this->exponentLoc = -1;
+        this->sourceLoc = -1;
+        this->radiusLoc = -1;
+        this->sigmaLoc = -1;
+        this->sourceLayerLoc = -1;
+        this->directionLoc = -1;
+    }
+
+    void VarianceShadowMap::beginLoadShaders(std::vector<gps::Shader*>& shaders) {
+
+        this->resolveShader.beginLoadShader("shaders/fullScreen.vert", "shaders/momentResolve.frag");
+        this->blurShader.beginLoadShader("shaders/fullScreen.vert", "shaders/momentBlur.frag");
+        shaders.push_back(&this->resolveShader);
+        shaders.push_back(&this->blurShader);
+    }
+
+    void VarianceShadowMap::init(int cascadeCount, int depthResolution, int resolution) {
+
+        this->cascadeCount = cascadeCount;
+        this->depthResolution = depthResolution;
+        this->resolution = std::max(1, std::min(resolution, depthResolution));
+        if (depthResolution % this->resolution != 0) {
+            std::cerr << "WARNING: moment resolution " << resolution << " does not divide " << depthResolution << ", using "
+                << depthResolution << std::endl;
+            this->resolution = depthResolution;
+        }
+
+        int levels = 1;
+        while ((this->resolution >> levels) > 0) {
+            levels++;
+        }
+
+        //moments with a full mip chain, so distant receivers get a prefiltered lookup
+        glGenTextures(1, &this->momentTexture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->momentTexture);
+        for (int level = 0; level < levels; level++) {
+            int size = std::max(1, this->resolution >> level);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RG32F, size, size, cascadeCount, 0, GL_RG, GL_FLOAT, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        //a one layer array, so both blur directions read through the same sampler type
+        glGenTextures(1, &this->blurTexture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->blurTexture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG32F, this->resolution, this->resolution, 1, 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenFramebuffers(1, &this->framebuffer);
+
+        glGenSamplers(1, &this->depthSampler);
+        glSamplerParameteri(this->depthSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+        glSamplerParameteri(this->depthSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glSamplerParameteri(this->depthSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenVertexArrays(1, &this->emptyVAO);
+
+        //nothing left to wait for when the batch finished them
+        this->resolveShader.finishLoad();
+        this->blurShader.finishLoad();
+        this->depthMapLoc = glGetUniformLocation(this->resolveShader.shaderProgram, "depthMap");
+        this->cascadeLoc = glGetUniformLocation(this->resolveShader.shaderProgram, "cascade");
+        this->downsampleLoc = glGetUniformLocation(this->resolveShader.shaderProgram, "downsample");
+        this->exponentLoc = glGetUniformLocation(this->resolveShader.shaderProgram, "exponent");
+        this->sourceLoc = glGetUniformLocation(this->blurShader.shaderProgram, "source");
+        this->radiusLoc = glGetUniformLocation(this->blurShader.shaderProgram, "radius");
+        this->sigmaLoc = glGetUniformLocation(this->blurShader.shaderProgram, "sigma");
+        this->sourceLayerLoc = glGetUniformLocation(this->blurShader.shaderProgram, "sourceLayer");
+        this->directionLoc = glGetUniformLocation(this->blurShader.shaderProgram, "direction");
+
+        this->timer.create();
+    }
+
+    void VarianceShadowMap::destroy() {
+
+        this->timer.destroy();
+        glDeleteProgram(this->resolveShader.shaderProgram);
+        glDeleteProgram(this->blurShader.shaderProgram);
+        glDeleteVertexArrays(1, &this->emptyVAO);
+        glDeleteSamplers(1, &this->depthSampler);
+        glDeleteFramebuffers(1, &this->framebuffer);
+        glDeleteTextures(1, &this->blurTexture);
+        glDeleteTextures(1, &this->momentTexture);
+        this->emptyVAO = 0;
+        this->depthSampler = 0;
+        this->framebuffer = 0;
+        this->blurTexture = 0;
+        this->momentTexture = 0;
+    }
+
+    void VarianceShadowMap::setExponent(float exponent) {
+        this->exponent = std::max(0.0f, std::min(exponent, (float)MAX_EXPONENT));
+    }
+
+    float VarianceShadowMap::getExponent() {
+        return this->exponent;
+    }
+
+    void VarianceShadowMap::setBlurSigma(float sigma) {
+        //the kernel is cut at BLUR_RADIUS taps, about two standard deviations
+        this->blurSigma = std::max(0.0f, std::min(sigma, BLUR_RADIUS * 0.5f));
+    }
+
+    float VarianceShadowMap::getBlurSigma() {
+        return this->blurSigma;
+    }
+
+    void VarianceShadowMap::updateCascade(int cascade, GLuint depthTexture) {
+
+        if (!this->updating) {
+            this->updating = true;
+            this->timer.begin();
+
+            //full screen passes: no depth, no culling
+            glDisable(GL_DEPTH_TEST);
+            glDisable(GL_CULL_FACE);
+            glViewport(0, 0, this->resolution, this->resolution);
+            glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+            glBindVertexArray(this->emptyVAO);
+        }
+
+        //depth -> moments, averaging the depth texels that fall into one moment texel
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, this->momentTexture, 0, cascade);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+        this->resolveShader.useShaderProgram();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+        glBindSampler(0, this->depthSampler);
+        glUniform1i(this->depthMapLoc, 0);
+        glUniform1i(this->cascadeLoc, cascade);
+        glUniform1i(this->downsampleLoc, this->depthResolution / this->resolution);
+        glUniform1f(this->exponentLoc, this->exponent);
+        drawFullScreen();
+        glBindSampler(0, 0);
+
+        if (this->blurSigma <= 0.0f) {
+            return;
+        }
+
+        //separable Gaussian: moment layer -> blur texture -> moment layer
+        this->blurShader.useShaderProgram();
+        glUniform1i(this->sourceLoc, 0);
+        glUniform1i(this->radiusLoc, BLUR_RADIUS);
+        glUniform1f(this->sigmaLoc, this->blurSigma);
+
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, this->blurTexture, 0, 0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->momentTexture);
+        glUniform1i(this->sourceLayerLoc, cascade);
+        glUniform2i(this->directionLoc, 1, 0);
+        drawFullScreen();
+
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, this->momentTexture, 0, cascade);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->blurTexture);
+        glUniform1i(this->sourceLayerLoc, 0);
+        glUniform2i(this->directionLoc, 0, 1);
+        drawFullScreen();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void VarianceShadowMap::finishUpdate() {
+
+        if (!this->updating) {
+            return;
+        }
+        this->updating = false;
+
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        //one mip chain rebuild for all the updated layers
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->momentTexture);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+
+        this->timer.end();
+    }
+
+    void VarianceShadowMap::drawFullScreen() {
+
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    GLuint VarianceShadowMap::getMomentTexture() {
+        return this->momentTexture;
+    }
+
+    int VarianceShadowMap::getResolution() {
+        return this->resolution;
+    }
+
+    double VarianceShadowMap::getMilliseconds() {
+        return this->timer.getMilliseconds();
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef VarianceShadowMap_hpp
+#define VarianceShadowMap_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "GpuTimer.hpp"
+#include "Shader.hpp"
+
+namespace gps {
+
+    //filterable shadow moments built from the cascade depth maps
+    //every updated cascade is resolved into (warped) depth moments in an RG32F array, possibly at a lower
+    //resolution, blurred with a separable Gaussian and mipmapped; basic.frag then takes one filtered
+    //lookup and applies Chebyshev's inequality instead of running many PCF taps per fragment
+    //
+    //exponent 0 stores plain VSM moments (d, d^2), a positive exponent stores EVSM moments of exp(c * d)
+    class VarianceShadowMap {
+
+    public:
+        //fp32 overflows above this: exp(2 * c) must stay finite
+        static const int MAX_EXPONENT = 42;
+
+        VarianceShadowMap();
+
+        //queues the compile and link of the resolve and blur programs and adds them to shaders, to be
+        //finished with the rest of the startup batch (Shader::finishLoads) before init
+        void beginLoadShaders(std::vector<gps::Shader*>& shaders);
+        //depthResolution is the size of the cascade depth layers, it must be a multiple of resolution
+        void init(int cascadeCount, int depthResolution, int resolution);
+        void destroy();
+
+        //0 for VSM, otherwise the EVSM warp exponent, clamped to MAX_EXPONENT
+        void setExponent(float exponent);
+        float getExponent();
+        //standard deviation of the blur in moment texels (at most 2), 0 disables the blur
+        void setBlurSigma(float sigma);
+        float getBlurSigma();
+
+        //rebuilds the moments of one cascade from its depth layer
+        void updateCascade(int cascade, GLuint depthTexture);
+        //call once after the updated cascades, restores the state changed by updateCascade
+        void finishUpdate();
+
+        GLuint getMomentTexture();
+        int getResolution();
+        //GPU time of the resolves, blurs and mipmaps of the last frame
+        double getMilliseconds();
+
+    private:
+        static const int BLUR_RADIUS = 4;
+
+        int cascadeCount;
+        int depthResolution;
+        int resolution;
+        float exponent;
+        float blurSigma;
+
+        GLuint momentTexture;
+        //one layer, horizontal blur target
+        GLuint blurTexture;
+        GLuint framebuffer;
+        //samples the depth layers without the comparison mode set on the texture
+        GLuint depthSampler;
+        //the full screen triangle is generated from gl_VertexID
+        GLuint emptyVAO;
+
+        gps::Shader resolveShader;
+        gps::Shader blurShader;
+        //uniform locations, looked up once when the shaders load
+        GLint depthMapLoc;
+        GLint cascadeLoc;
+        GLint downsampleLoc;
+        GLint exponentLoc;
+        GLint sourceLoc;
+        GLint radiusLoc;
+        GLint sigmaLoc;
+        GLint sourceLayerLoc;
+        GLint directionLoc;
+        gps::GpuTimer timer;
+        bool updating;
+
+        void drawFullScreen();
+    };
+}
+
+#endif /* VarianceShadowMap_hpp */
@@ -17,43 +17,72 @@
 #include "Shader.hpp"
 #include "Camera.hpp"
 #include "Model3D.hpp"
+#include "UniformBuffer.hpp"
+#include "RingBuffer.hpp"
+#include "CascadedShadowMap.hpp"
+#include "GpuTimer.hpp"
+#include "VarianceShadowMap.hpp"
+#include "ShadowAtlas.hpp"
+#include "LightManager.hpp"
+#include "LightClusters.hpp"
+#include "ThreadPool.hpp"
+#include "GBuffer.hpp"
+#include "LightmapBaker.hpp"
+#include "GpuRain.hpp"
+#include "StreamingVertexBuffer.hpp"
+#include "ParticleSystem.hpp"
+#include "HeightMap.hpp"
 
 #include <iostream>
+#include <random>
 #include "SkyBox.hpp"
 
 #define MAX_PARTICLES 3000
 float velocity = 0.0f;
 float slowdown = 0.4f;
-typedef struct {
-    // Life
-    bool alive;	// is the particle alive?
-    float life;	// particle lifespan
-    float fade; // decay
-    // color
-    float red;
-    float green;
-    float blue;
-    // Position/direction
-    float xpos;
-    float ypos;
-    float zpos;
-    // Velocity/Direction, only goes down in y dir
-    float vel;
-    // Gravity
-    float gravity;
-}particles;
-// Paticle System
-particles par_sys[MAX_PARTICLES];
+// seed of the CPU effects, fixed so every run rains the same
+const unsigned int RAIN_SEED = 20240611u;
+// CPU rain, its splashes and dust, each with its own pool and budgets
+gps::ParticleSystem particleSystem;
+// the streak program of both rains and the particle effects, compiled once and shared
+gps::Shader rainShader;
+// a drop lives about this many frames (life 1 faded by 0.003 to 0.103 a frame), so this fraction of the
+// GPU drops ends every frame
+const int GPU_RAIN_DROP_FRAMES = 35;
+int rainEmitter;
+int splashEmitter;
+int dustEmitter;
+// most live CPU particles (--particle-budget N, -1 for no limit) and the update time the density
+// aims for (--particle-time-budget ms)
+int particleBudget = -1;
+double particleTimeBudget = 2.0;
+// highest surface of the city seen from above, both rains stop on it; captured once, again when the city moves
+gps::HeightMap cityHeightMap;
+const int HEIGHT_MAP_RESOLUTION = 1024;
+// the CPU rain reads a smaller grid of heights
+const int HEIGHT_MAP_GRID_RESOLUTION = 256;
+
+// the same rain simulated on the GPU with transform feedback (default), --cpu-rain or the R key use rainEmitter
+gps::GpuRain gpuRain;
+bool gpuRainEnabled = true;
+// drops of both rains (--rain-particles N), MAX_PARTICLES is only the default
+int rainParticleCount = MAX_PARTICLES;
+gps::GpuTimer rainTimer;
+double rainCpuMilliseconds;
 
 // window
 gps::Window myWindow;
 int retina_width, retina_height;
 
-const unsigned int SHADOW_WIDTH = 2048;
-const unsigned int SHADOW_HEIGHT = 2048;
+// shadow cascades, configurable from the command line (--cascades N --shadow-resolution N)
+// the cascades are fitted to the visible geometry, so 1024 is enough on weaker machines
+int shadowCascadeCount = 4;
+int shadowResolution = 2048;
 
 // matrices
 glm::mat4 model;
+glm::mat4 teapotModel;
+glm::mat4 cityModel;
 glm::mat4 view;
 glm::mat4 projection;
 glm::mat3 normalMatrix;
@@ -63,13 +92,57 @@ glm::vec3 lightDir;
 glm::vec3 lightColor;
 glm::mat4 lightRotation;
 
-// shader uniform locations
-GLint modelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-GLint lightDirLoc;
-GLint lightColorLoc;
+// uniform buffer binding points
+const GLuint FRAME_UNIFORMS_BINDING = 0;
+const GLuint DRAW_UNIFORMS_BINDING = 1;
+const GLuint LIGHT_UNIFORMS_BINDING = 2;
+
+// per-frame data shared by every program (std140 layout of the FrameUniforms block)
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    // one light space matrix per shadow cascade
+    glm::mat4 lightSpaceTrMatrix[gps::CascadedShadowMap::MAX_CASCADES];
+    // view distance where each cascade ends
+    glm::vec4 cascadeSplits;
+    // x - cascade count, y - fraction of a cascade blended into the next one,
+    // z - (E)VSM light bleeding reduction, w - EVSM exponent (0 for VSM)
+    glm::vec4 shadowParams;
+    glm::vec4 lightDir;
+    glm::vec4 lightColor;
+    // light of the visible sky as 9 spherical harmonics (rgb), convolved with the cosine lobe, see SkyBox
+    glm::vec4 skyIrradiance[9];
+};
+
+gps::UniformBuffer frameUniformBuffer;
+
+// per-draw data (std140 layout of the DrawUniforms block)
+struct DrawUniforms {
+    glm::mat4 model;
+    // mat3 stored as the upper-left of a mat4 to keep the std140 layout trivial
+    glm::mat4 normalMatrix;
+    // x - 1 when the draw samples the baked lightmap
+    glm::vec4 lightmapParams;
+};
+
+// the two blocks above in GLSL, the only declaration the shaders get: every program is compiled with
+// these defines and writes FRAME_UNIFORMS_BLOCK / DRAW_UNIFORMS_BLOCK where it needs the block
+// the members have to stay in the order of the structs
+std::string getUniformBlockDefines() {
+    return "#define MAX_CASCADES " + std::to_string(gps::CascadedShadowMap::MAX_CASCADES) + "\n"
+        "#define FRAME_UNIFORMS_BLOCK layout(std140) uniform FrameUniforms { mat4 view; mat4 projection;"
+        " mat4 lightSpaceTrMatrix[MAX_CASCADES]; vec4 cascadeSplits; vec4 shadowParams; vec4 lightDir;"
+        " vec4 lightColor; vec4 skyIrradiance[9]; };\n"
+        "#define DRAW_UNIFORMS_BLOCK layout(std140) uniform DrawUniforms { mat4 model; mat4 normalMatrix;"
+        " vec4 lightmapParams; };";
+}
+
+// draws of a frame, each one owns a DrawUniforms slot in the ring buffer
+enum SCENE_DRAW { DRAW_TEAPOT, DRAW_CITY, DRAW_COUNT };
+const int MAX_DRAWS_PER_FRAME = 256;
+
+gps::RingBuffer drawUniformBuffer;
+GLintptr drawUniformOffsets[DRAW_COUNT];
 
 //cube map texture
 GLuint textureID;
@@ -115,39 +188,130 @@ GLfloat lightAngle;
 //skybox
 gps::SkyBox mySkyBox;
 gps::SkyBox myNightSkyBox;
+// the ambient term comes from the skybox (spherical harmonics), --flat-ambient goes back to a constant
+bool flatAmbient = false;
 gps::Shader skyboxShader;
 
 
 
 
 //shadows
-GLuint shadowMapFBO;
-GLuint depthMapTexture;
+gps::CascadedShadowMap shadowMap;
+GLint cascadeIndexLoc;
+// fraction of each cascade cross-faded into the next one
+const float CASCADE_BLEND_FRACTION = 0.1f;
+
+// static casters (the city) are kept in a cached depth array, only the teapot is redrawn every frame
+bool shadowCaching = true;
+// near cascade every frame, the far ones round-robin
+bool shadowTimeSlicing = true;
+gps::GpuTimer shadowPassTimer;
+// meshes drawn / considered by the shadow pass of the last frame
+int shadowCastersDrawn;
+int shadowCastersTotal;
+
+// day/night cycle, the sun turns continuously
+bool animateSun;
+const float SUN_DEGREES_PER_SECOND = 6.0f;
+
+// PCF quality tier compiled into basic.frag: 1, 4, 9 or 16 taps
+int shadowPcfTaps = 4;
+
+// filterable (E)VSM shadows instead of PCF, built from the same cascade depth maps
+gps::VarianceShadowMap varianceShadowMap;
+bool shadowMoments;
+// every layer needs new moments, e.g. after switching technique or exponent
+bool shadowMomentsStale = true;
+// 0 = half the depth resolution
+int shadowMomentResolution;
+float lightBleedReduction = 0.3f;
+// basic.frag is recompiled before the next frame, after a compile time option changed
+bool basicShaderStale;
+
+// GPU time of the main (lit) pass
+gps::GpuTimer scenePassTimer;
+
+// --bench <name> renders a fixed number of frames in a hidden window and prints the results
+std::string benchmarkName;
+const int BENCHMARK_WARMUP_FRAMES = 30;
+const int BENCHMARK_FRAMES = 200;
+
+// spot light shadows, tiles of one atlas updated under a per-frame budget
+gps::ShadowAtlas spotShadowAtlas;
+gps::Shader spotShadowShader;
+GLint spotLightSpaceLoc;
+gps::GpuTimer spotShadowTimer;
+int spotAtlasSize = 2048;
+int spotAtlasBudget = 4;
+// atlas handle of each spot light of the light manager
+std::vector<int> spotShadowHandles;
+
+// point and spot lights, sent to basic.frag as one uniform block and a buffer texture
+gps::LightManager lightManager;
+
+// worker threads for the CPU side of the frame
+gps::ThreadPool workerPool;
+
+// point lights are assigned to view frustum clusters, basic.frag shades only its cluster's lights
+gps::LightClusters lightClusters;
+bool clusteredLights = true;
+// depth covered by the cluster slices, the fog hides everything further away
+const float CLUSTER_NEAR_PLANE = 0.1f;
+const float CLUSTER_FAR_PLANE = 100.0f;
+// lights of the light count benchmark, spread over a square around the camera
+const float BENCHMARK_LIGHT_AREA = 40.0f;
+
+// deferred path: the geometry pass fills the G-buffer, then basic.frag (compiled with DEFERRED_LIGHTING)
+// lights every pixel once in a full-screen pass; the forward path stays for comparison
+bool deferredShading;
+gps::GBuffer gBuffer;
+gps::Shader gBufferShader;
+gps::Shader deferredLightingShader;
+GLuint fullScreenVAO;
+gps::GpuTimer gBufferTimer;
+gps::GpuTimer lightingPassTimer;
+// the deferred benchmark flies through these (position, target) pairs, the same way for both paths
+const glm::vec3 BENCHMARK_CAMERA_PATH[][2] = {
+    { glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, -10.0f) },
+    { glm::vec3(4.0f, 0.5f, -2.0f), glm::vec3(-2.0f, 0.0f, -12.0f) },
+    { glm::vec3(-6.0f, 3.0f, -8.0f), glm::vec3(0.0f, -1.0f, -20.0f) },
+    { glm::vec3(0.0f, 12.0f, 10.0f), glm::vec3(0.0f, -1.0f, -8.0f) }
+};
+const int BENCHMARK_CAMERA_PATH_LENGTH = sizeof(BENCHMARK_CAMERA_PATH) / sizeof(BENCHMARK_CAMERA_PATH[0]);
+
+// sky light and ambient occlusion baked into a lightmap for the static city (--no-baked-lighting, B key)
+// the bake runs once on the worker threads and is cached next to the model
+gps::LightmapBaker cityLightmap;
+bool bakedLighting = true;
+int lightmapSize = 1024;
+int lightmapSamples = 64;
+const char* CITY_LIGHTMAP_CACHE = "models/city/city2.lightmap";
+
+// linked programs are cached here and loaded instead of compiled while nothing changed (--no-program-cache)
+bool programCache = true;
+const char* PROGRAM_CACHE_DIRECTORY = "shaders/cache";
+// when beginShaders queued the programs, for the startup report
+double shaderStartTime;
+// every program beginShaders queued, initShaders finishes them together
+std::vector<gps::Shader*> pendingShaders;
+
+// the street lamp spot light (world space)
+const glm::vec3 SPOT_LIGHT_POSITION = glm::vec3(0.0f, 0.5f, 1.5f);
+const glm::vec3 SPOT_LIGHT_DIRECTION = glm::vec3(0.0f, -0.5f, -1.0f);
+const float SPOT_LIGHT_CONSTANT = 1.0f;
+const float SPOT_LIGHT_LINEAR = 0.7f;
+const float SPOT_LIGHT_QUADRATIC = 1.8f;
+const float SPOT_LIGHT_CUTOFF_DEGREES = 5.5f;
+const float SPOT_LIGHT_OUTER_CUTOFF_DEGREES = 10.5f;
+
+// print the per-cascade GPU times once a second
+bool showTimings;
+float lastTimingsPrint = 0.0f;
 
 bool night;
 
 bool wireframe;
 
-struct PointLight {
-    glm::vec3 position;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    glm::vec3 ambient;
-    glm::vec3 diffuse;
-    glm::vec3 specular;
-};
-
-glm::vec3 pointLightPositions[] = {
-    glm::vec3(0.7f,  0.2f,  2.0f),
-    glm::vec3(2.3f, -3.3f, -4.0f),
-    glm::vec3(-4.0f,  2.0f, -12.0f),
-    glm::vec3(0.0f,  0.0f, -3.0f)
-};
-
-
 GLenum glCheckError_(const char* file, int line)
 {
     GLenum errorCode;
@@ -191,6 +355,59 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
     if (key == GLFW_KEY_EQUAL && action == GLFW_PRESS) {
         wireframe = !wireframe;
     }
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        showTimings = !showTimings;
+    }
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        shadowCaching = !shadowCaching;
+        shadowMap.setStaticCaching(shadowCaching);
+    }
+    if (key == GLFW_KEY_U && action == GLFW_PRESS) {
+        shadowTimeSlicing = !shadowTimeSlicing;
+        shadowMap.setTimeSlicing(shadowTimeSlicing);
+    }
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        animateSun = !animateSun;
+    }
+    if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+        // the technique is compiled into basic.frag
+        shadowMoments = !shadowMoments;
+        shadowMomentsStale = true;
+        basicShaderStale = true;
+        std::cout << (shadowMoments ? "(E)VSM shadows" : "PCF shadows") << std::endl;
+    }
+    // light bleeding reduction and EVSM exponent (0 = VSM)
+    if (key == GLFW_KEY_LEFT_BRACKET && action == GLFW_PRESS) {
+        lightBleedReduction = glm::max(lightBleedReduction - 0.05f, 0.0f);
+        std::cout << "light bleeding reduction " << lightBleedReduction << std::endl;
+    }
+    if (key == GLFW_KEY_RIGHT_BRACKET && action == GLFW_PRESS) {
+        lightBleedReduction = glm::min(lightBleedReduction + 0.05f, 0.95f);
+        std::cout << "light bleeding reduction " << lightBleedReduction << std::endl;
+    }
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        deferredShading = !deferredShading;
+        std::cout << (deferredShading ? "deferred shading" : "forward shading") << std::endl;
+    }
+    if (key == GLFW_KEY_B && action == GLFW_PRESS && cityLightmap.getTexture()) {
+        bakedLighting = !bakedLighting;
+        std::cout << (bakedLighting ? "baked sky light" : "flat ambient light") << std::endl;
+    }
+    if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+        gpuRainEnabled = !gpuRainEnabled;
+        std::cout << (gpuRainEnabled ? "GPU rain" : "CPU rain") << std::endl;
+    }
+    if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+        // the light loop is compiled into basic.frag
+        clusteredLights = !clusteredLights;
+        basicShaderStale = true;
+        std::cout << (clusteredLights ? "clustered point lights" : "every point light per fragment") << std::endl;
+    }
+    if ((key == GLFW_KEY_COMMA || key == GLFW_KEY_PERIOD) && action == GLFW_PRESS) {
+        varianceShadowMap.setExponent(varianceShadowMap.getExponent() + (key == GLFW_KEY_COMMA ? -5.0f : 5.0f));
+        shadowMomentsStale = true;
+        std::cout << "EVSM exponent " << varianceShadowMap.getExponent() << std::endl;
+    }
     
 
     if (key >= 0 && key < 1024) {
@@ -253,42 +470,18 @@ void processMovement() {
 
     if (pressedKeys[GLFW_KEY_W]) {
         myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
-        //update view matrix
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        // compute normal matrix for teapot
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
 
     if (pressedKeys[GLFW_KEY_S]) {
         myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
-        //update view matrix
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        // compute normal matrix for teapot
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
 
     if (pressedKeys[GLFW_KEY_A]) {
         myCamera.move(gps::MOVE_LEFT, cameraSpeed);
-        //update view matrix
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        // compute normal matrix for teapot
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
 
     if (pressedKeys[GLFW_KEY_D]) {
         myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
-        //update view matrix
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        // compute normal matrix for teapot
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     }
 
     if (pressedKeys[GLFW_KEY_Q]) {
@@ -315,6 +508,10 @@ void processMovement() {
         lightAngle += 1.0f;
     }
 
+    if (animateSun) {
+        lightAngle += SUN_DEGREES_PER_SECOND * deltaTime;
+    }
+
     
 }
 
@@ -327,9 +524,7 @@ void scrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
     projection = glm::perspective(glm::radians(fov),
         (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
         0.1f, 10000000.0f);
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    // send projection matrix to shader
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // uploaded with the rest of the frame uniforms
 }
 
 bool initOpenGLWindow() {
@@ -353,6 +548,11 @@ bool initOpenGLWindow() {
     //for antialising
     glfwWindowHint(GLFW_SAMPLES, 4);
 
+    //benchmarks run without showing anything
+    if (!benchmarkName.empty()) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
+
 
     myWindow.Create(1024, 768, "OpenGL Project Core");
     //myWindow.Create(1920, 1080, "OpenGL Project Core");
@@ -373,7 +573,8 @@ bool initOpenGLWindow() {
 
     glfwMakeContextCurrent(glWindow);
 
-    glfwSwapInterval(1);
+    //no vsync while benchmarking
+    glfwSwapInterval(benchmarkName.empty() ? 1 : 0);
 
 #if not defined (__APPLE__)
     // start GLEW extension handler
@@ -416,6 +617,8 @@ void initOpenGLState() {
 
 
 void initModels() {
+    //pack every city material into one texture array so the whole city draws with a single bind
+    hoonicorn.SetTextureResampleMode(gps::RESAMPLE_UNIFORM);
     teapot.LoadModel("models/teapot/teapot20segUT.obj");
     hoonicorn.LoadModel("models/city/city2.obj");
     lightCube.LoadModel("models/cube/cube.obj");
@@ -427,125 +630,188 @@ void initModels() {
     skyboxShader.useShaderProgram();
 }*/
 
-void initShaders() {
-    myBasicShader.loadShader("shaders/basic.vert", "shaders/basic.frag");
+// basic.frag is compiled per PCF tier, so it can be reloaded on its own
+void beginBasicShader() {
+    if (myBasicShader.shaderProgram) {
+        glDeleteProgram(myBasicShader.shaderProgram);
+        glDeleteProgram(deferredLightingShader.shaderProgram);
+    }
+
+    std::string defines = gps::LightManager::getShaderDefines();
+    defines += "\n#define SHADOW_PCF_TAPS " + std::to_string(shadowPcfTaps);
+    if (shadowMoments) {
+        defines += "\n#define SHADOW_MOMENTS";
+    }
+    if (clusteredLights) {
+        defines += "\n#define CLUSTERED_LIGHTS\n" + gps::LightClusters::getShaderDefines();
+    }
+    myBasicShader.beginLoadShader("shaders/basic.vert", "shaders/basic.frag", defines);
+    // the same lighting code, reading the surfaces from the G-buffer
+    deferredLightingShader.beginLoadShader("shaders/fullScreen.vert", "shaders/basic.frag", defines + "\n#define DEFERRED_LIGHTING");
+}
+
+void finishBasicShader() {
+    myBasicShader.finishLoad();
     myBasicShader.useShaderProgram();
-    lightShader.loadShader("shaders/lightCube.vert", "shaders/lightCube.frag");
+
+    myBasicShader.bindUniformBlock("FrameUniforms", FRAME_UNIFORMS_BINDING);
+    myBasicShader.bindUniformBlock("DrawUniforms", DRAW_UNIFORMS_BINDING);
+    myBasicShader.bindUniformBlock("LightUniforms", LIGHT_UNIFORMS_BINDING);
+
+    deferredLightingShader.finishLoad();
+    deferredLightingShader.bindUniformBlock("FrameUniforms", FRAME_UNIFORMS_BINDING);
+    deferredLightingShader.bindUniformBlock("LightUniforms", LIGHT_UNIFORMS_BINDING);
+}
+
+void loadBasicShader() {
+    beginBasicShader();
+    finishBasicShader();
+}
+
+// every scene program is queued before any status is read, the driver compiles them (on its own
+// threads where it can) while initModels loads the assets, then initShaders collects them
+void beginShaders() {
+    shaderStartTime = glfwGetTime();
+    gps::Shader::setBinaryCacheDirectory(programCache ? PROGRAM_CACHE_DIRECTORY : "");
+    gps::Shader::setSharedDefines(getUniformBlockDefines());
+    bool parallel = gps::Shader::enableParallelCompile();
+    std::cout << (parallel ? "parallel shader compilation" : "no parallel shader compilation") << std::endl;
+
+    beginBasicShader();
+    lightShader.beginLoadShader("shaders/lightCube.vert", "shaders/lightCube.frag");
+    depthMapShader.beginLoadShader("shaders/shadowShader.vert", "shaders/shadowShader.frag");
+    skyboxShader.beginLoadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
+    gBufferShader.beginLoadShader("shaders/basic.vert", "shaders/gBuffer.frag");
+    spotShadowShader.beginLoadShader("shaders/spotShadow.vert", "shaders/shadowShader.frag");
+    rainShader.beginLoadShader("shaders/rainShader.vert", "shaders/rainShader.frag");
+
+    pendingShaders = { &myBasicShader, &deferredLightingShader, &lightShader, &depthMapShader,
+        &skyboxShader, &gBufferShader, &spotShadowShader, &rainShader };
+    // the programs of the components join the batch, their init looks up the locations
+    gpuRain.beginLoadShaders(pendingShaders);
+    varianceShadowMap.beginLoadShaders(pendingShaders);
+}
+
+void initShaders() {
+    double waitStart = glfwGetTime();
+    gps::Shader::finishLoads(pendingShaders);
+    finishBasicShader();
+
     lightShader.useShaderProgram();
-    depthMapShader.loadShader("shaders/shadowShader.vert", "shaders/shadowShader.frag");
     depthMapShader.useShaderProgram();
-    skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
     skyboxShader.useShaderProgram();
+
+    lightShader.bindUniformBlock("FrameUniforms", FRAME_UNIFORMS_BINDING);
+    depthMapShader.bindUniformBlock("FrameUniforms", FRAME_UNIFORMS_BINDING);
+    skyboxShader.bindUniformBlock("FrameUniforms", FRAME_UNIFORMS_BINDING);
+
+    depthMapShader.bindUniformBlock("DrawUniforms", DRAW_UNIFORMS_BINDING);
+
+    gBufferShader.bindUniformBlock("FrameUniforms", FRAME_UNIFORMS_BINDING);
+    gBufferShader.bindUniformBlock("DrawUniforms", DRAW_UNIFORMS_BINDING);
+
+    spotShadowShader.bindUniformBlock("DrawUniforms", DRAW_UNIFORMS_BINDING);
+    spotLightSpaceLoc = glGetUniformLocation(spotShadowShader.shaderProgram, "lightSpaceMatrix");
+
+    rainShader.bindUniformBlock("FrameUniforms", FRAME_UNIFORMS_BINDING);
+
+    double now = glfwGetTime();
+    std::cout << "shaders " << pendingShaders.size() << " programs ready " << (now - shaderStartTime) * 1000.0
+        << " ms after submission (models loaded meanwhile), " << (now - waitStart) * 1000.0 << " ms waiting" << std::endl;
 }
 
 void initUniforms() {
     myBasicShader.useShaderProgram();
 
-    // create model matrix for teapot
-    model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-    modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
-
     // get view matrix for current camera
     view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-    // send view matrix to shader
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-    // compute normal matrix for teapot
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
     // create projection matrix
     projection = glm::perspective(glm::radians(fov),
         (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
         0.1f, 10000000.0f);
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    // send projection matrix to shader
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
     //set the light direction (direction towards the light)
     lightDir = glm::vec3(0.0f, 1.0f, 1.0f);
-    lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-    // send light dir to shader
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
 
-    //TODO REMOVE THIS BECAUSE IUN RENDERSCENE ALREADY
     //set light color
     lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-    lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-    // send light color to shader
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-
-    struct PointLight pointLights[4] = {{glm::vec3(0.0f, 0.5f, 1.5f),1.0f,1.0f,1.0f,glm::vec3(0.7f, 0.2f, 2.0f),glm::vec3(0.7f, 0.2f, 2.0f)},
-    {glm::vec3(-4.0f, 2.0f, -12.0f),1.0f,1.0f,1.0f,glm::vec3(0.7f, 0.2f, 2.0f),glm::vec3(0.7f, 0.2f, 2.0f)},
-    {glm::vec3(2.3f, -3.3f, -4.0f),1.0f,1.0f,1.0f,glm::vec3(0.7f, 0.2f, 2.0f),glm::vec3(0.7f, 0.2f, 2.0f)},
-    {glm::vec3(0.0f, 0.0f, -3.0f),1.0f,1.0f,1.0f,glm::vec3(0.7f, 0.2f, 2.0f),glm::vec3(0.7f, 0.2f, 2.0f)}
-    };
-    glm::vec3 spotLightPosition = glm::vec3(0.0f, 0.5f, 1.5f);
-    float constant = 1.0f;
-    float linear = 0.7f;
-    float quadratic = 1.8f;
-    float cutOff = glm::cos(glm::radians(5.5f));
-    float outerCutOff = glm::cos(glm::radians(10.5f));
-    glm::vec3 ambient = glm::vec3(0.0f, 0.0f, 0.0f);
-    glm::vec3 diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
-    glm::vec3 specular = glm::vec3(0.0f, 0.0f, 0.0f);
-    glm::vec3 direction= glm::vec3(0.0f, -0.5f, -1.0f);
-    
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLights[0].position"), 1, glm::value_ptr(spotLightPosition));
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLights[0].direction"), 1, glm::value_ptr(direction));
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "spotLights[0].constant"), constant);
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "spotLights[0].linear"), linear);
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "spotLights[0].quadratic"), quadratic);
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "spotLights[0].cutOff"), cutOff);
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "spotLights[0].outerCutOff"), outerCutOff);
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLights[0].ambient"), 1, glm::value_ptr(ambient));
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLights[0].diffuse"), 1, glm::value_ptr(diffuse));
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "spotLights[0].specular"), 1, glm::value_ptr(specular));
-
-    /*glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[0].position"), 1, glm::value_ptr(pointLights[0].position));
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[0].direction"), 1, glm::value_ptr(direction));
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[0].constant"), constant);
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[0].linear"), linear);
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[0].quadratic"), quadratic);
-    glUniform1f(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[0].cutOff"), theta);
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[0].ambient"), 1, glm::value_ptr(ambient));
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[0].diffuse"), 1, glm::value_ptr(diffuse));
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[0].specular"), 1, glm::value_ptr(specular));*/
-
-    //glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[0]"), 1,
-    //    glm::value_ptr(pointLightPositions[0]));
-    //
-    //glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[1]"), 1,
-    //    glm::value_ptr(pointLightPositions[1]));
-    //
-    //glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[2]"), 1,
-    //    glm::value_ptr(pointLightPositions[2]));
-    //
-    //glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "pointLights[3]"), 1,
-    //    glm::value_ptr(pointLightPositions[3]));
+
+    // view, projection and the light are sent once per frame through this buffer
+    frameUniformBuffer.create(sizeof(FrameUniforms), FRAME_UNIFORMS_BINDING);
+
+    // model and normal matrices of every draw, written once per frame
+    GLint uniformAlignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    GLsizeiptr drawSlotSize = (sizeof(DrawUniforms) + uniformAlignment - 1) / uniformAlignment * uniformAlignment;
+    drawUniformBuffer.create(GL_UNIFORM_BUFFER, drawSlotSize * MAX_DRAWS_PER_FRAME, uniformAlignment);
 }
 
 void initFBO() {
-    //generate FBO ID
-    glGenFramebuffers(1, &shadowMapFBO);
-    //create depth texture for FBO
-    glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-        SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    //attach texture to FBO
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    //depth texture array and FBO of the shadow cascades
+    shadowMap.init(shadowCascadeCount, shadowResolution);
+    shadowCascadeCount = shadowMap.getCascadeCount();
+    shadowMap.setStaticCaching(shadowCaching);
+    shadowMap.setTimeSlicing(shadowTimeSlicing);
+    varianceShadowMap.init(shadowCascadeCount, shadowResolution,
+        shadowMomentResolution > 0 ? shadowMomentResolution : shadowResolution / 2);
+    shadowPassTimer.create();
+    scenePassTimer.create();
+
+    gBuffer.init(retina_width, retina_height);
+    glGenVertexArrays(1, &fullScreenVAO);
+    gBufferTimer.create();
+    lightingPassTimer.create();
+
+    // a quarter of the atlas edge for the most important light, down to 64 texel tiles
+    spotShadowAtlas.init(spotAtlasSize, spotAtlasSize / 4, 64);
+    spotShadowAtlas.setUpdateBudget(spotAtlasBudget);
+    spotShadowTimer.create();
+
+    depthMapShader.useShaderProgram();
+    cascadeIndexLoc = glGetUniformLocation(depthMapShader.shaderProgram, "cascadeIndex");
+}
+
+// registers the scene lights, each spot light also gets a tile in the shadow atlas
+void initLights() {
+    lightManager.create(LIGHT_UNIFORMS_BINDING);
+    workerPool.start();
+    lightClusters.init(CLUSTER_NEAR_PLANE, CLUSTER_FAR_PLANE, &workerPool);
+
+    gps::SpotLight streetLamp;
+    streetLamp.position = SPOT_LIGHT_POSITION;
+    streetLamp.direction = SPOT_LIGHT_DIRECTION;
+    streetLamp.constant = SPOT_LIGHT_CONSTANT;
+    streetLamp.linear = SPOT_LIGHT_LINEAR;
+    streetLamp.quadratic = SPOT_LIGHT_QUADRATIC;
+    streetLamp.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+    streetLamp.diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+    streetLamp.specular = glm::vec3(0.0f, 0.0f, 0.0f);
+    streetLamp.cutOff = glm::cos(glm::radians(SPOT_LIGHT_CUTOFF_DEGREES));
+    streetLamp.outerCutOff = glm::cos(glm::radians(SPOT_LIGHT_OUTER_CUTOFF_DEGREES));
+    lightManager.addSpotLight(streetLamp);
+
+    for (int i = 0; i < lightManager.getSpotLightCount(); i++) {
+        const gps::SpotLight& light = lightManager.getSpotLight(i);
+        int handle = spotShadowAtlas.addLight(true, 1.0f);
+        spotShadowAtlas.setLight(handle, light.position, light.direction, light.outerCutOff,
+            gps::LightManager::computeRange(light.constant, light.linear, light.quadratic));
+        spotShadowHandles.push_back(handle);
+    }
+}
+
+// bakes (or loads) the city lightmap, needs the worker threads started by initLights
+void initLightmaps() {
+    if (!bakedLighting) {
+        return;
+    }
+
+    cityLightmap.setResolution(lightmapSize);
+    cityLightmap.setSamples(lightmapSamples);
+    if (!cityLightmap.bake(hoonicorn, CITY_LIGHTMAP_CACHE, &workerPool)) {
+        std::cerr << "WARNING: the city lightmap could not be baked, using a flat ambient term" << std::endl;
+        bakedLighting = false;
+    }
 }
 
 void initSkyBox() {
@@ -556,7 +822,7 @@ void initSkyBox() {
     faces.push_back("skybox/bottom.tga");
     faces.push_back("skybox/back.tga");
     faces.push_back("skybox/front.tga");
-    mySkyBox.Load(faces);
+    mySkyBox.Load(faces, &workerPool);
 }
 
 void initNightSkyBox() {
@@ -567,173 +833,369 @@ void initNightSkyBox() {
     faces.push_back("night_skybox/ny.tga");
     faces.push_back("night_skybox/nx.tga");
     faces.push_back("night_skybox/px.tga");
-    myNightSkyBox.Load(faces);
+    myNightSkyBox.Load(faces, &workerPool);
+}
+
+void updateModelMatrices() {
+    glm::mat4 newTeapotModel = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
+    if (newTeapotModel != teapotModel) {
+        // cached spot light tiles around the teapot are outdated
+        spotShadowAtlas.invalidate(teapot.GetBounds().transform(teapotModel));
+        spotShadowAtlas.invalidate(teapot.GetBounds().transform(newTeapotModel));
+        teapotModel = newTeapotModel;
+    }
+
+    glm::mat4 newCityModel = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+    if (newCityModel != cityModel) {
+        // the city is a static caster, re-render the cascades covering where it was and where it is now
+        shadowMap.invalidateStatic(hoonicorn.GetBounds().transform(cityModel));
+        shadowMap.invalidateStatic(hoonicorn.GetBounds().transform(newCityModel));
+        spotShadowAtlas.invalidate(hoonicorn.GetBounds().transform(cityModel));
+        spotShadowAtlas.invalidate(hoonicorn.GetBounds().transform(newCityModel));
+        cityHeightMap.invalidate();
+        cityModel = newCityModel;
+    }
 }
 
-glm::mat4 computeLightSpaceTrMatrix() {
-    glm::mat4 lightView = glm::lookAt(lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    const GLfloat near_plane = 0.1f, far_plane = 6.0f;
-    glm::mat4 lightProjection = glm::ortho(-1.0f, 1.0f, -1.0f, 1.0f, near_plane, far_plane);
-    glm::mat4 lightSpaceTrMatrix = lightProjection * lightView;
-    return lightSpaceTrMatrix;
+void updateShadowCascades() {
+    // fit the cascades to the geometry that is actually there
+    gps::BoundingBox sceneBounds = teapot.GetBounds().transform(teapotModel);
+    sceneBounds.extend(hoonicorn.GetBounds().transform(cityModel));
+    shadowMap.setSceneBounds(sceneBounds);
+
+    float aspect = (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height;
+    shadowMap.update(view, glm::radians(fov), aspect, 0.1f, lightDir);
 }
 
-void renderTeapot(gps::Shader shader) {
+void writeDrawUniforms(SCENE_DRAW draw, glm::mat4 drawModel, bool lightmapped = false) {
+    GLintptr offset = 0;
+    DrawUniforms* drawUniforms = (DrawUniforms*)drawUniformBuffer.allocate(sizeof(DrawUniforms), &offset);
+    if (drawUniforms == NULL) {
+        std::cerr << "ERROR: per-draw uniform buffer is full" << std::endl;
+        return;
+    }
+
+    drawUniforms->model = drawModel;
+    // world space, like the lighting
+    drawUniforms->normalMatrix = glm::mat4(glm::inverseTranspose(glm::mat3(drawModel)));
+    drawUniforms->lightmapParams = glm::vec4(lightmapped ? 1.0f : 0.0f, 0.0f, 0.0f, 0.0f);
+    drawUniformOffsets[draw] = offset;
+}
+
+// computes the transforms of every draw up front, the passes below only rebind offsets
+void updateDrawUniforms() {
+    drawUniformBuffer.beginFrame();
+
+    writeDrawUniforms(DRAW_TEAPOT, teapotModel);
+    writeDrawUniforms(DRAW_CITY, cityModel, bakedLighting);
+
+    drawUniformBuffer.flush();
+}
+
+void bindDrawUniforms(SCENE_DRAW draw) {
+    drawUniformBuffer.bindRange(DRAW_UNIFORMS_BINDING, drawUniformOffsets[draw], sizeof(DrawUniforms));
+}
+
+void renderTeapot(const gps::Shader& shader) {
     // select active shader program
     shader.useShaderProgram();
 
-    //send teapot model matrix data to shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    //send teapot normal matrix data to shader
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    // point the DrawUniforms block at the teapot's model/normal matrices
+    bindDrawUniforms(DRAW_TEAPOT);
 
     // draw teapot
     teapot.Draw(shader);
 }
 
-void renderHoonicorn(gps::Shader shader) {
+void renderHoonicorn(const gps::Shader& shader) {
     // select active shader program
     shader.useShaderProgram();
 
-    //send teapot model matrix data to shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    //send teapot normal matrix data to shader
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    // point the DrawUniforms block at the city's model/normal matrices
+    bindDrawUniforms(DRAW_CITY);
 
-    // draw teapot
+    // draw city
     hoonicorn.Draw(shader);
 }
 
-// Initialize/Reset Particles - give them their attributes
-void initParticles(int i) {
-    par_sys[i].alive = true;
-    par_sys[i].life = 1.0;
-    par_sys[i].fade = float(rand() % 100) / 1000.0f + 0.003f;
+// depth-only variants for the shadow pass: position stream only, culled against the cascade
+void renderTeapotDepth(int cascade) {
+    bindDrawUniforms(DRAW_TEAPOT);
+    shadowCastersDrawn += teapot.DrawDepth(teapotModel, shadowMap.getLightSpaceMatrix(cascade));
+    shadowCastersTotal += teapot.GetMeshCount();
+}
 
-    par_sys[i].xpos = (float)(rand() % 21) - 10;
-    par_sys[i].ypos = 10.0;
-    par_sys[i].zpos = (float)(rand() % 21) - 10;
+void renderHoonicornDepth(int cascade) {
+    bindDrawUniforms(DRAW_CITY);
+    shadowCastersDrawn += hoonicorn.DrawDepth(cityModel, shadowMap.getLightSpaceMatrix(cascade));
+    shadowCastersTotal += hoonicorn.GetMeshCount();
+}
 
-    /*par_sys[i].xpos = myPosition.x+(float)(rand()%2);
-    par_sys[i].ypos =  10.0;
-    par_sys[i].zpos = myPosition.z+(float)(rand()%2);*/
+// the CPU rain: drops start on a square 10 above the camera, follow it, and die 10 below it
+gps::ParticleEmitter getRainEmitter() {
+    gps::ParticleEmitter rain;
+    rain.cameraRelative = true;
+    rain.position = glm::vec3(0.0f);
+    rain.spawn.shape = gps::SPAWN_BOX;
+    rain.spawn.center = glm::vec3(0.0f, 10.0f, 0.0f);
+    rain.spawn.extent = glm::vec3(10.0f, 0.0f, 10.0f);
+    rain.spawn.velocity = glm::vec3(0.0f, velocity, 0.0f);
+    rain.spawn.velocitySpread = glm::vec3(0.0f);
+    rain.spawn.fadeMin = 0.003f;
+    rain.spawn.fadeMax = 0.103f;
+    // Adjust slowdown for speed!
+    rain.step.positionScale = 1.0f / (slowdown * 1000);
+    rain.step.gravity = glm::vec3(0.0f, -0.8f, 0.0f);
+    rain.step.floorHeight = -10.0f;
+    // roofs and streets stop the drops before that
+    rain.hitsGround = true;
+    // every dead drop is revived, half the pool at most in one frame
+    rain.capacity = rainParticleCount;
+    rain.spawnRate = (float)rainParticleCount;
+    rain.spawnBudget = glm::max(rainParticleCount / 2, 1);
+    rain.sourceEmitter = -1;
+    rain.spawnPerHit = 0;
+    rain.color = glm::vec4(1.0f, 1.0f, 1.0f, 0.6f);
+    rain.length = 0.1f;
+    rain.halfWidth = 0.004f;
+    // drops stay within 10 of the camera and move less than 0.3 a step
+    rain.positionRange = 16.0f;
+    rain.motionRange = 0.5f;
+    return rain;
+}
 
-    par_sys[i].red = 0.5;
-    par_sys[i].green = 0.5;
-    par_sys[i].blue = 1.0;
+// a few droplets thrown up where a drop hits its floor, in meters per second at 60 steps a second
+gps::ParticleEmitter getSplashEmitter() {
+    gps::ParticleEmitter splash;
+    splash.cameraRelative = true;
+    splash.position = glm::vec3(0.0f);
+    splash.spawn.shape = gps::SPAWN_SPHERE;
+    splash.spawn.center = glm::vec3(0.0f);
+    splash.spawn.extent = glm::vec3(0.05f);
+    splash.spawn.velocity = glm::vec3(0.0f, 1.5f, 0.0f);
+    splash.spawn.velocitySpread = glm::vec3(1.0f, 0.5f, 1.0f);
+    splash.spawn.fadeMin = 0.06f;
+    splash.spawn.fadeMax = 0.12f;
+    splash.step.positionScale = 1.0f / 60.0f;
+    splash.step.gravity = glm::vec3(0.0f, -9.8f / 60.0f, 0.0f);
+    // they die of age, not on the floor they came from
+    splash.step.floorHeight = -1000.0f;
+    splash.hitsGround = false;
+    splash.capacity = 4096;
+    splash.spawnRate = 0.0f;
+    splash.spawnBudget = 512;
+    splash.sourceEmitter = rainEmitter;
+    splash.spawnPerHit = 3;
+    splash.color = glm::vec4(0.8f, 0.85f, 0.9f, 0.5f);
+    splash.length = 0.02f;
+    splash.halfWidth = 0.006f;
+    splash.positionRange = 16.0f;
+    splash.motionRange = 0.1f;
+    return splash;
+}
 
-    par_sys[i].vel = velocity;
-    par_sys[i].gravity = -0.8;
+// slow dust motes drifting in the air over the middle of the city, in world space
+gps::ParticleEmitter getDustEmitter() {
+    gps::ParticleEmitter dust;
+    dust.cameraRelative = false;
+    dust.position = glm::vec3(0.0f, 2.0f, 0.0f);
+    dust.spawn.shape = gps::SPAWN_SPHERE;
+    dust.spawn.center = glm::vec3(0.0f);
+    dust.spawn.extent = glm::vec3(20.0f);
+    dust.spawn.velocity = glm::vec3(0.2f, 0.0f, 0.0f);
+    dust.spawn.velocitySpread = glm::vec3(0.3f, 0.1f, 0.3f);
+    // 5 to 15 seconds
+    dust.spawn.fadeMin = 1.0f / 900.0f;
+    dust.spawn.fadeMax = 1.0f / 300.0f;
+    dust.step.positionScale = 1.0f / 60.0f;
+    dust.step.gravity = glm::vec3(0.0f);
+    dust.step.floorHeight = -1000.0f;
+    dust.hitsGround = false;
+    dust.capacity = 2048;
+    dust.spawnRate = 4.0f;
+    dust.spawnBudget = 16;
+    dust.sourceEmitter = -1;
+    dust.spawnPerHit = 0;
+    dust.color = glm::vec4(0.75f, 0.65f, 0.5f, 0.35f);
+    dust.length = 0.03f;
+    dust.halfWidth = 0.015f;
+    dust.positionRange = 32.0f;
+    dust.motionRange = 0.02f;
+    return dust;
+}
 
+// CPU effects: update on the worker threads, every chunk writes its own range of the instance
+// streams, then one draw per emitter
+void drawParticles() {
+    particleSystem.update(myCamera.getPosition(), &workerPool);
+    particleSystem.draw(myCamera.getPosition(), retina_height);
 }
 
-void drawRain() {
-    float x, y, z;
+void initParticles() {
+    particleSystem.init(rainShader, RAIN_SEED);
+    rainEmitter = particleSystem.addEmitter(getRainEmitter());
+    splashEmitter = particleSystem.addEmitter(getSplashEmitter());
+    dustEmitter = particleSystem.addEmitter(getDustEmitter());
+    particleSystem.setParticleBudget(particleBudget);
+    particleSystem.setTimeBudget(particleTimeBudget);
+
+    cityHeightMap.init(HEIGHT_MAP_RESOLUTION, HEIGHT_MAP_GRID_RESOLUTION);
+    particleSystem.setGround(&cityHeightMap);
+    gpuRain.init(rainParticleCount, rainShader);
+    gpuRain.setHeightMap(&cityHeightMap);
+    rainTimer.create();
+}
 
-    GLfloat particlePositions[MAX_PARTICLES * 6]; // Each particle is represented by two vertices (start and end points)
-    int vertexIndex = 0;
-    glm::vec3 myPosition = myCamera.getPosition();
-    //std::cout << myPosition.x << " " << myPosition.y << " " << myPosition.z<<"\n";
+// CPU or GPU rain and the CPU effects, timed on both sides for the rain benchmark
+void renderRain() {
+    double start = glfwGetTime();
+    rainTimer.begin();
+    // the streaks are blended over the scene, seen from both sides, and do not hide each other
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable(GL_CULL_FACE);
+    glDepthMask(GL_FALSE);
+    if (gpuRainEnabled) {
+        gpuRain.update(velocity, slowdown, myCamera.getPosition());
+        gpuRain.draw(myCamera.getPosition(), retina_height);
+    }
+    // the splashes and the dust run either way, the GPU drops are never read back, so their splashes
+    // come from as many drops as end in a frame, scattered over the rain area on the height map
+    particleSystem.setEmitterEnabled(rainEmitter, !gpuRainEnabled);
+    if (gpuRainEnabled) {
+        particleSystem.scatterHits(rainEmitter, gpuRain.getParticleCount() / GPU_RAIN_DROP_FRAMES, myCamera.getPosition());
+    }
+    drawParticles();
+    glDepthMask(GL_TRUE);
+    glEnable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+    rainTimer.end();
+    rainCpuMilliseconds = (glfwGetTime() - start) * 1000.0;
+}
 
-    for (int loop = 0; loop < MAX_PARTICLES; loop = loop + 2) {
-        if (par_sys[loop].alive == true) {
-            x = myPosition.x + par_sys[loop].xpos;
-            y = myPosition.y + par_sys[loop].ypos;
-            z = myPosition.z + par_sys[loop].zpos;
+void renderShadowCascades() {
+    shadowPassTimer.begin();
+    shadowCastersDrawn = 0;
+    shadowCastersTotal = 0;
 
-            // Update particle positions
-            particlePositions[vertexIndex++] = x;
-            particlePositions[vertexIndex++] = y;
-            particlePositions[vertexIndex++] = z;
+    // casters between the light and the near plane are flattened onto it instead of clipped
+    glEnable(GL_DEPTH_CLAMP);
 
-            particlePositions[vertexIndex++] = x;
-            particlePositions[vertexIndex++] = y + 0.1;
-            particlePositions[vertexIndex++] = z;
+    depthMapShader.useShaderProgram();
+    for (int i = 0; i < shadowCascadeCount; i++) {
+        // stale cascades keep their depth and the matrix it was rendered with
+        if (!shadowMap.isCascadeScheduled(i)) {
+            continue;
+        }
 
-            // Update values
-            //Move
-            // Adjust slowdown for speed!
-            par_sys[loop].ypos += par_sys[loop].vel / (slowdown * 1000);
-            par_sys[loop].vel += par_sys[loop].gravity;
-            // Decay
-            par_sys[loop].life -= par_sys[loop].fade;
+        shadowMap.beginCascade(i);
+        glUniform1i(cascadeIndexLoc, i);
 
-            if (par_sys[loop].ypos <= -10) {
-                par_sys[loop].life = -1.0;
-            }
-            //Revive
-            if (par_sys[loop].life < 0.0) {
-                initParticles(loop);
+        // static casters, only when the cached layer is stale
+        if (shadowMap.beginStaticCasters(i)) {
+            renderHoonicornDepth(i);
+            shadowMap.endStaticCasters(i);
+        }
+
+        // dynamic casters on top of the cached depth
+        shadowMap.beginDynamicCasters(i);
+        renderTeapotDepth(i);
+        if (!shadowMap.isStaticCaching()) {
+            renderHoonicornDepth(i);
+        }
+        shadowMap.endCascade(i);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glDisable(GL_DEPTH_CLAMP);
+
+    // moments of the cascades that changed, blurred once here instead of filtered per fragment
+    if (shadowMoments) {
+        for (int i = 0; i < shadowCascadeCount; i++) {
+            if (shadowMomentsStale || shadowMap.isCascadeScheduled(i)) {
+                varianceShadowMap.updateCascade(i, shadowMap.getDepthTexture());
             }
         }
+        varianceShadowMap.finishUpdate();
+        shadowMomentsStale = false;
     }
 
-    // Create/update VBO and VAO
-    GLuint vbo, vao;
-    glGenBuffers(1, &vbo);
-    glGenVertexArrays(1, &vao);
+    shadowPassTimer.end();
+}
 
-    // Bind VAO
-    glBindVertexArray(vao);
+// renders the budgeted spot light tiles of this frame
+void renderSpotShadows() {
+    spotShadowTimer.begin();
 
-    // Bind VBO and update data
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(particlePositions), particlePositions, GL_DYNAMIC_DRAW);
+    spotShadowAtlas.update(view, projection);
 
-    // Specify vertex attribute pointers
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    spotShadowShader.useShaderProgram();
+    for (int i = 0; i < spotShadowAtlas.getUpdateCount(); i++) {
+        int light = spotShadowAtlas.getUpdate(i);
+        glm::mat4 lightSpaceMatrix = spotShadowAtlas.getRenderMatrix(light);
 
-    // Draw particles
-    glDrawArrays(GL_LINES, 0, vertexIndex / 3);
+        spotShadowAtlas.beginTile(light);
+        glUniformMatrix4fv(spotLightSpaceLoc, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
 
-    // Clean up
-    glDisableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-    glDeleteBuffers(1, &vbo);
-    glDeleteVertexArrays(1, &vao);
-}
+        bindDrawUniforms(DRAW_TEAPOT);
+        teapot.DrawDepth(teapotModel, lightSpaceMatrix);
+        bindDrawUniforms(DRAW_CITY);
+        hoonicorn.DrawDepth(cityModel, lightSpaceMatrix);
 
-void initParticles() {
-    for (int loop = 0; loop < MAX_PARTICLES; loop++) {
-        initParticles(loop);
+        spotShadowAtlas.endTile(light);
     }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    spotShadowTimer.end();
 }
 
-void drawObjects(gps::Shader shader, bool depthPass) {
+// depth of the city from straight above, for the rain; static, so it is only rendered when invalid
+void renderHeightMap() {
+    if (cityHeightMap.isValid()) {
+        return;
+    }
 
-    //shader.useShaderProgram();
+    glm::mat4 heightMapMatrix = cityHeightMap.begin(hoonicorn.GetBounds().transform(cityModel));
+    spotShadowShader.useShaderProgram();
+    glUniformMatrix4fv(spotLightSpaceLoc, 1, GL_FALSE, glm::value_ptr(heightMapMatrix));
+    bindDrawUniforms(DRAW_CITY);
+    hoonicorn.DrawDepth(cityModel, heightMapMatrix);
+    cityHeightMap.end();
+}
 
-    model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+// hands the tiles rendered this frame to the lights, sends every light in one buffer update
+// and sorts the point lights into the clusters of this view
+void updateLightUniforms() {
+    for (int i = 0; i < lightManager.getSpotLightCount(); i++) {
+        lightManager.setSpotShadow(i, spotShadowAtlas.getLightSpaceMatrix(spotShadowHandles[i]),
+            spotShadowAtlas.getTileRect(spotShadowHandles[i]));
+    }
+    lightManager.upload();
 
-    // do not send the normal matrix if we are rendering in the depth map
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    if (clusteredLights) {
+        lightClusters.update(view, projection, retina_width, retina_height, lightManager);
     }
-    if (!depthPass) {
-        if (night) {
-            myNightSkyBox.Draw(skyboxShader, view, projection);
-        }else {
-            mySkyBox.Draw(skyboxShader, view, projection);
-        }
+}
+
+void drawSkyBox() {
+    if (night) {
+        myNightSkyBox.Draw(skyboxShader);
+    }else {
+        mySkyBox.Draw(skyboxShader);
     }
-    teapot.Draw(shader);
+}
+
+void drawObjects(const gps::Shader& shader, bool depthPass) {
 
-    model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
-    //model = glm::scale(model, glm::vec3(0.5f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    //shader.useShaderProgram();
 
-    // do not send the normal matrix if we are rendering in the depth map
     if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        drawSkyBox();
     }
-    hoonicorn.Draw(shader);
+
+    renderTeapot(shader);
+
+    renderHoonicorn(shader);
 }
 
 /*void renderScene() {
@@ -751,77 +1213,489 @@ void drawObjects(gps::Shader shader, bool depthPass) {
 
 }*/
 
-void renderScene() {
+void updateFrameUniforms() {
     if (night) {
         lightColor = glm::vec3(0.0f, 0.0f, 0.0f); //black light
     }
     else {
         lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
     }
-    glUniform3fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightColor"), 1, glm::value_ptr(lightColor));
 
-    // depth maps creation pass
-    //TODO - Send the light-space transformation matrix to the depth map creation shader and
-    //		 render the scene in the depth map
-    depthMapShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(computeLightSpaceTrMatrix()));
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    drawObjects(depthMapShader, true);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    view = myCamera.getViewMatrix();
 
-    // final scene rendering pass (with shadows)
+    lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    lightDir = lightRotation * glm::vec4(0.0f, 1.0f, 1.0f, 1.0f);
+
+    updateShadowCascades();
+
+    FrameUniforms frameUniforms;
+    frameUniforms.view = view;
+    frameUniforms.projection = projection;
+    for (int i = 0; i < shadowCascadeCount; i++) {
+        frameUniforms.lightSpaceTrMatrix[i] = shadowMap.getLightSpaceMatrix(i);
+        frameUniforms.cascadeSplits[i] = shadowMap.getSplitDistance(i);
+    }
+    frameUniforms.shadowParams = glm::vec4((float)shadowCascadeCount, CASCADE_BLEND_FRACTION,
+        lightBleedReduction, varianceShadowMap.getExponent());
+    frameUniforms.lightDir = glm::vec4(glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir, 0.0f);
+    frameUniforms.lightColor = glm::vec4(lightColor, 1.0f);
+    // ambient light from the sky being shown
+    const gps::SphericalHarmonics& skyIrradiance = night ? myNightSkyBox.GetIrradiance() : mySkyBox.GetIrradiance();
+    for (int i = 0; i < 9; i++) {
+        frameUniforms.skyIrradiance[i] = glm::vec4(flatAmbient ? glm::vec3(0.0f) : skyIrradiance.coefficients[i], 0.0f);
+    }
+    if (flatAmbient) {
+        // only the constant harmonic, scaled by 1 / Y00 so it evaluates to lightColor for every normal
+        frameUniforms.skyIrradiance[0] = glm::vec4(lightColor * 3.5449077f, 0.0f);
+    }
+
+    // single upload shared by the basic, depth, skybox and light cube programs
+    frameUniformBuffer.update(&frameUniforms, sizeof(FrameUniforms));
+}
+
+// shadow maps, lights and clusters read by both the forward and the deferred lighting
+void bindLightingTextures(const gps::Shader& shader) {
+    //bind the shadow cascades
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMoments ? varianceShadowMap.getMomentTexture() : shadowMap.getDepthTexture());
+    glUniform1i(shader.getUniformLocation("shadowMap"), 3);
+
+    //bind the spot light atlas, the tile of each light is in the light uniforms
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, spotShadowAtlas.getDepthTexture());
+    glUniform1i(shader.getUniformLocation("spotShadowAtlas"), 4);
+
+    //bind the point lights and their clusters
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_BUFFER, lightManager.getPointLightTexture());
+    glUniform1i(shader.getUniformLocation("pointLightData"), 5);
+    if (clusteredLights) {
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_BUFFER, lightClusters.getRangeTexture());
+        glUniform1i(shader.getUniformLocation("clusterRanges"), 6);
+        glActiveTexture(GL_TEXTURE7);
+        glBindTexture(GL_TEXTURE_BUFFER, lightClusters.getIndexTexture());
+        glUniform1i(shader.getUniformLocation("clusterLightIndices"), 7);
+        glUniform2fv(shader.getUniformLocation("clusterTileScale"), 1,
+            glm::value_ptr(lightClusters.getTileScale()));
+        glUniform2fv(shader.getUniformLocation("clusterDepthScale"), 1,
+            glm::value_ptr(lightClusters.getDepthScale()));
+    }
+}
+
+// the city lightmap, sampled by the forward pass and the G-buffer pass
+void bindLightmap(const gps::Shader& shader) {
+    glActiveTexture(GL_TEXTURE13);
+    glBindTexture(GL_TEXTURE_2D, cityLightmap.getTexture());
+    glUniform1i(shader.getUniformLocation("lightmap"), 13);
+}
+
+// geometry pass into the G-buffer, then one lighting pass over the whole screen
+void renderDeferred() {
+    gBuffer.resize(retina_width, retina_height);
+
+    gBufferTimer.begin();
+    gBuffer.begin();
+    gBufferShader.useShaderProgram();
+    bindLightmap(gBufferShader);
+    drawObjects(gBufferShader, true);
+    gBuffer.end();
+    gBufferTimer.end();
 
-    //TO CHANGE-window width height
     glViewport(0, 0, retina_width, retina_height);
+    drawSkyBox();
+
+    lightingPassTimer.begin();
+    deferredLightingShader.useShaderProgram();
+    bindLightingTextures(deferredLightingShader);
+
+    GLuint gBufferTextures[] = { gBuffer.getAlbedoTexture(), gBuffer.getNormalTexture(),
+        gBuffer.getSpecularTexture(), gBuffer.getDepthTexture(), gBuffer.getAmbientTexture() };
+    static const std::string gBufferNames[] = { "gBufferAlbedo", "gBufferNormal", "gBufferSpecular", "gBufferDepth", "gBufferAmbient" };
+    for (int i = 0; i < 5; i++) {
+        glActiveTexture(GL_TEXTURE8 + i);
+        glBindTexture(GL_TEXTURE_2D, gBufferTextures[i]);
+        glUniform1i(deferredLightingShader.getUniformLocation(gBufferNames[i]), 8 + i);
+    }
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // pixel centers and window depth to normalized device coordinates, then back through the camera
+    glm::mat4 windowToNdc = glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f))
+        * glm::scale(glm::mat4(1.0f), glm::vec3(2.0f / retina_width, 2.0f / retina_height, 2.0f));
+    glm::mat4 windowToWorld = glm::inverse(projection * view) * windowToNdc;
+    glUniformMatrix4fv(deferredLightingShader.getUniformLocation("windowToWorld"), 1, GL_FALSE,
+        glm::value_ptr(windowToWorld));
+
+    // the lighting pass writes the scene depth for the forward passes that follow (rain)
+    glDepthFunc(GL_ALWAYS);
+    glBindVertexArray(fullScreenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glDepthFunc(GL_LESS);
+    lightingPassTimer.end();
+}
+
+void renderScene() {
     float currentFrame = glfwGetTime();
     deltaTime = currentFrame - lastFrameTime;
     lastFrameTime = currentFrame;
 
-    myBasicShader.useShaderProgram();
-
-    view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
+    if (basicShaderStale) {
+        loadBasicShader();
+        basicShaderStale = false;
+    }
 
-    lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+    updateModelMatrices();
+    updateFrameUniforms();
+    updateDrawUniforms();
 
-    lightDir = lightRotation * glm::vec4(0.0f, 1.0f, 1.0f, 1.0f);
+    // depth maps creation pass, one per cascade
+    renderShadowCascades();
+    renderSpotShadows();
+    renderHeightMap();
+    updateLightUniforms();
 
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir));
+    // final scene rendering pass (with shadows)
 
-    //bind the shadow map
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
+    //TO CHANGE-window width height
+    glViewport(0, 0, retina_width, retina_height);
 
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"),
-        1,
-        GL_FALSE,
-        glm::value_ptr(computeLightSpaceTrMatrix()));
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    drawObjects(myBasicShader, false);
+    scenePassTimer.begin();
+    if (deferredShading) {
+        renderDeferred();
+    }
+    else {
+        myBasicShader.useShaderProgram();
+        bindLightingTextures(myBasicShader);
+        bindLightmap(myBasicShader);
+        drawObjects(myBasicShader, false);
+    }
+    scenePassTimer.end();
 
-    drawRain();
+    renderRain();
 
     //draw a white cube around the light
 
     /*lightShader.useShaderProgram();
 
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-
     model = lightRotation;
     model = glm::translate(model, 1.0f * lightDir);
     model = glm::scale(model, glm::vec3(0.05f, 0.05f, 0.05f));
     glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
 
     lightCube.Draw(lightShader);*/
+
+    // every command reading this frame's draw uniforms has been issued
+    drawUniformBuffer.endFrame();
+
+    if (showTimings && currentFrame - lastTimingsPrint > 1.0f) {
+        lastTimingsPrint = currentFrame;
+        std::cout << "shadow pass " << shadowPassTimer.getMilliseconds() << " ms, cascades (ms):";
+        for (int i = 0; i < shadowCascadeCount; i++) {
+            std::cout << " [" << i << "] " << shadowMap.getCascadeMilliseconds(i);
+        }
+        std::cout << ", static refreshes " << shadowMap.getStaticRefreshCount();
+        std::cout << ", casters " << shadowCastersDrawn << "/" << shadowCastersTotal;
+        std::cout << ", rendered";
+        for (int i = 0; i < shadowCascadeCount; i++) {
+            if (shadowMap.isCascadeScheduled(i)) {
+                std::cout << " " << i;
+            }
+        }
+        std::cout << (shadowCaching ? "" : " (caching off)") << std::endl;
+        if (shadowMoments) {
+            std::cout << "moments " << varianceShadowMap.getMilliseconds() << " ms, ";
+        }
+        std::cout << "spot shadows " << spotShadowTimer.getMilliseconds() << " ms, " << spotShadowAtlas.getUpdateCount()
+            << " tiles rendered, " << spotShadowAtlas.getAllocatedCount() << " allocated" << std::endl;
+        std::cout << "scene pass " << scenePassTimer.getMilliseconds() << " ms (";
+        if (deferredShading) {
+            std::cout << "G-buffer " << gBufferTimer.getMilliseconds() << " ms, lighting "
+                << lightingPassTimer.getMilliseconds() << " ms, ";
+        }
+        if (shadowMoments) {
+            std::cout << (varianceShadowMap.getExponent() > 0.0f ? "EVSM" : "VSM") << ")" << std::endl;
+        }
+        else {
+            std::cout << shadowPcfTaps << " PCF taps)" << std::endl;
+        }
+        std::cout << "particles " << particleSystem.getParticleCount() << " at " << particleSystem.getDensity() * 100.0f
+            << "% density, " << particleSystem.getMilliseconds() << " ms" << std::endl;
+        std::cout << lightManager.getPointLightCount() << " point lights";
+        if (clusteredLights) {
+            std::cout << ", clusters " << lightClusters.getMilliseconds() << " ms on " << workerPool.getThreadCount()
+                << " threads, " << lightClusters.getIndexCount() << " light indices";
+        }
+        std::cout << std::endl;
+    }
+}
+
+// average GPU time of the main pass over BENCHMARK_FRAMES frames, from the current camera
+// frameMilliseconds, when given, receives the average wall clock time of a whole frame
+double measureScenePass(double* frameMilliseconds = NULL) {
+    double total = 0.0;
+    double frameStart = 0.0;
+    for (int frame = 0; frame < BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES; frame++) {
+        if (frame == BENCHMARK_WARMUP_FRAMES) {
+            glFinish();
+            frameStart = glfwGetTime();
+        }
+        renderScene();
+        glfwSwapBuffers(myWindow.getWindow());
+        // results lag a few frames behind, the warm-up frames flush the previous configuration
+        if (frame >= BENCHMARK_WARMUP_FRAMES) {
+            total += scenePassTimer.getMilliseconds();
+        }
+    }
+
+    if (frameMilliseconds) {
+        glFinish();
+        *frameMilliseconds = (glfwGetTime() - frameStart) * 1000.0 / BENCHMARK_FRAMES;
+    }
+    return total / BENCHMARK_FRAMES;
+}
+
+// fragment cost of every PCF tier, e.g. on headless Mesa:
+// LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./Proiect_Constantin_Andrei --bench pcf
+void benchmarkPcf() {
+    const int tiers[] = { 1, 4, 9, 16 };
+    double pixels = (double)retina_width * retina_height;
+    double baseline = 0.0;
+
+    std::cout << "PCF benchmark, " << retina_width << "x" << retina_height << ", "
+        << BENCHMARK_FRAMES << " frames per tier" << std::endl;
+    std::cout << "taps\tscene ms\tns/pixel\tvs 1 tap" << std::endl;
+
+    for (int i = 0; i < 4; i++) {
+        shadowPcfTaps = tiers[i];
+        loadBasicShader();
+
+        double milliseconds = measureScenePass();
+        if (i == 0) {
+            baseline = milliseconds;
+        }
+        std::cout << tiers[i] << "\t" << milliseconds << "\t" << milliseconds * 1.0e6 / pixels
+            << "\t" << "x" << milliseconds / baseline << std::endl;
+    }
+}
+
+// frame and main pass time from 1 to 1024 street lamps, clustered against every light per fragment
+void benchmarkLights() {
+    // same lamps in every run
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> spread(-0.5f * BENCHMARK_LIGHT_AREA, 0.5f * BENCHMARK_LIGHT_AREA);
+    std::uniform_real_distribution<float> height(-1.0f, 2.0f);
+    std::uniform_real_distribution<float> tint(0.5f, 1.0f);
+
+    std::vector<gps::PointLight> lamps;
+    for (int i = 0; i < gps::LightManager::MAX_POINT_LIGHTS; i++) {
+        gps::PointLight lamp;
+        lamp.position = myCamera.getPosition() + glm::vec3(spread(random), height(random), spread(random));
+        lamp.constant = 1.0f;
+        lamp.linear = 0.7f;
+        lamp.quadratic = 1.8f;
+        lamp.ambient = glm::vec3(0.0f);
+        lamp.diffuse = glm::vec3(1.0f, tint(random), tint(random) * 0.5f);
+        lamp.specular = lamp.diffuse;
+        lamps.push_back(lamp);
+    }
+
+    std::cout << "Light count benchmark, " << retina_width << "x" << retina_height << ", "
+        << BENCHMARK_FRAMES << " frames per run, " << workerPool.getThreadCount() << " cluster threads" << std::endl;
+    std::cout << "lights\tclustered frame ms\tscene ms\tclusters ms\tall lights frame ms\tscene ms" << std::endl;
+
+    bool clustered = clusteredLights;
+    for (int count = 1; count <= gps::LightManager::MAX_POINT_LIGHTS; count *= 2) {
+        lightManager.removePointLights();
+        for (int i = 0; i < count; i++) {
+            lightManager.addPointLight(lamps[i]);
+        }
+
+        double frameMilliseconds[2];
+        double sceneMilliseconds[2];
+        double clusterMilliseconds = 0.0;
+        for (int run = 0; run < 2; run++) {
+            clusteredLights = run == 0;
+            loadBasicShader();
+            sceneMilliseconds[run] = measureScenePass(&frameMilliseconds[run]);
+            if (clusteredLights) {
+                clusterMilliseconds = lightClusters.getMilliseconds();
+            }
+        }
+
+        std::cout << count << "\t" << frameMilliseconds[0] << "\t" << sceneMilliseconds[0] << "\t" << clusterMilliseconds
+            << "\t" << frameMilliseconds[1] << "\t" << sceneMilliseconds[1] << std::endl;
+    }
+
+    lightManager.removePointLights();
+    clusteredLights = clustered;
+    loadBasicShader();
+}
+
+// forward against deferred along BENCHMARK_CAMERA_PATH, with the GPU time of every pass
+void benchmarkDeferred() {
+    std::cout << "Forward/deferred benchmark, " << retina_width << "x" << retina_height << ", "
+        << BENCHMARK_FRAMES << " frames along " << BENCHMARK_CAMERA_PATH_LENGTH << " camera positions, "
+        << lightManager.getPointLightCount() << " point lights" << std::endl;
+    std::cout << "path\tframe ms\tscene ms\tG-buffer ms\tlighting ms" << std::endl;
+
+    bool deferred = deferredShading;
+    gps::Camera camera = myCamera;
+    for (int run = 0; run < 2; run++) {
+        deferredShading = run == 1;
+
+        double frameStart = 0.0;
+        double scene = 0.0;
+        double geometry = 0.0;
+        double lighting = 0.0;
+        for (int frame = 0; frame < BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES; frame++) {
+            // the warm-up frames stay at the start of the path
+            float t = frame < BENCHMARK_WARMUP_FRAMES ? 0.0f
+                : (float)(frame - BENCHMARK_WARMUP_FRAMES) / BENCHMARK_FRAMES * (BENCHMARK_CAMERA_PATH_LENGTH - 1);
+            int segment = glm::min((int)t, BENCHMARK_CAMERA_PATH_LENGTH - 2);
+            float blend = t - segment;
+            myCamera = gps::Camera(
+                glm::mix(BENCHMARK_CAMERA_PATH[segment][0], BENCHMARK_CAMERA_PATH[segment + 1][0], blend),
+                glm::mix(BENCHMARK_CAMERA_PATH[segment][1], BENCHMARK_CAMERA_PATH[segment + 1][1], blend),
+                glm::vec3(0.0f, 1.0f, 0.0f));
+
+            if (frame == BENCHMARK_WARMUP_FRAMES) {
+                glFinish();
+                frameStart = glfwGetTime();
+            }
+            renderScene();
+            glfwSwapBuffers(myWindow.getWindow());
+            if (frame >= BENCHMARK_WARMUP_FRAMES) {
+                scene += scenePassTimer.getMilliseconds();
+                geometry += gBufferTimer.getMilliseconds();
+                lighting += lightingPassTimer.getMilliseconds();
+            }
+        }
+        glFinish();
+        double frameMilliseconds = (glfwGetTime() - frameStart) * 1000.0 / BENCHMARK_FRAMES;
+
+        std::cout << (deferredShading ? "deferred" : "forward") << "\t" << frameMilliseconds << "\t"
+            << scene / BENCHMARK_FRAMES << "\t";
+        if (deferredShading) {
+            std::cout << geometry / BENCHMARK_FRAMES << "\t" << lighting / BENCHMARK_FRAMES << std::endl;
+        }
+        else {
+            std::cout << "-\t-" << std::endl;
+        }
+    }
+
+    myCamera = camera;
+    deferredShading = deferred;
+}
+
+// rain cost against the drop count; the CPU rain keeps the --rain-particles pool
+void benchmarkRain() {
+    const int dropCounts[] = { 3000, 30000, 300000, 1000000, 2000000 };
+    const int runCount = sizeof(dropCounts) / sizeof(dropCounts[0]);
+
+    std::cout << "Rain benchmark, " << BENCHMARK_FRAMES << " frames per run" << std::endl;
+    std::cout << "path	drops	frame ms	rain GPU ms	rain CPU ms	ns/drop (GPU)" << std::endl;
+
+    bool gpu = gpuRainEnabled;
+    int particleCount = gpuRain.getParticleCount();
+    // run -1 is the CPU rain
+    for (int run = -1; run < runCount; run++) {
+        gpuRainEnabled = run >= 0;
+        int drops = gpuRainEnabled ? dropCounts[run] : particleSystem.getEmitter(rainEmitter).capacity;
+        if (gpuRainEnabled) {
+            gpuRain.setParticleCount(drops);
+        }
+
+        double frameStart = 0.0;
+        double gpuMilliseconds = 0.0;
+        double cpuMilliseconds = 0.0;
+        for (int frame = 0; frame < BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES; frame++) {
+            if (frame == BENCHMARK_WARMUP_FRAMES) {
+                glFinish();
+                frameStart = glfwGetTime();
+            }
+            renderScene();
+            glfwSwapBuffers(myWindow.getWindow());
+            if (frame >= BENCHMARK_WARMUP_FRAMES) {
+                gpuMilliseconds += rainTimer.getMilliseconds();
+                cpuMilliseconds += rainCpuMilliseconds;
+            }
+        }
+        glFinish();
+        double frameMilliseconds = (glfwGetTime() - frameStart) * 1000.0 / BENCHMARK_FRAMES;
+        gpuMilliseconds /= BENCHMARK_FRAMES;
+        cpuMilliseconds /= BENCHMARK_FRAMES;
+
+        std::cout << (gpuRainEnabled ? "GPU" : "CPU") << "\t" << drops << "\t" << frameMilliseconds << "\t"
+            << gpuMilliseconds << "\t" << cpuMilliseconds << "\t" << gpuMilliseconds * 1.0e6 / drops << std::endl;
+    }
+
+    gpuRainEnabled = gpu;
+    gpuRain.setParticleCount(particleCount);
+}
+
+// CPU rain update alone (move, decay, drop and revive): the plain loop, the SIMD kernel, and the SIMD kernel on the worker threads
+void benchmarkParticles() {
+    const int dropCounts[] = { 3000, 100000, 1000000 };
+    const int runCount = sizeof(dropCounts) / sizeof(dropCounts[0]);
+    const char* kernels[] = { "scalar", "SIMD", "threads" };
+
+    std::cout << "Particle benchmark, " << BENCHMARK_FRAMES << " steps per run, SIMD: "
+        << gps::ParticlePool::getSimdName() << ", " << workerPool.getThreadCount() << " threads" << std::endl;
+    std::cout << "drops";
+    for (int kernel = 0; kernel < 3; kernel++) {
+        std::cout << "\t" << kernels[kernel] << " ms\t" << kernels[kernel] << " particles/ms";
+    }
+    std::cout << std::endl;
+
+    gps::ParticleStep step = getRainEmitter().step;
+    gps::ParticleSpawn spawn = getRainEmitter().spawn;
+    for (int run = 0; run < runCount; run++) {
+        int drops = dropCounts[run];
+        std::cout << drops;
+        for (int kernel = 0; kernel < 3; kernel++) {
+            gps::ThreadPool* threadPool = kernel == 2 ? &workerPool : NULL;
+            gps::ParticlePool pool;
+            pool.create(drops, RAIN_SEED);
+            pool.setSimd(kernel > 0);
+            pool.spawn(drops, spawn);
+
+            double start = 0.0;
+            for (int frame = 0; frame < BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES; frame++) {
+                if (frame == BENCHMARK_WARMUP_FRAMES) {
+                    start = glfwGetTime();
+                }
+                pool.update(step, threadPool);
+                pool.spawn(drops - pool.getCount(), spawn, threadPool);
+            }
+            double milliseconds = (glfwGetTime() - start) * 1000.0 / BENCHMARK_FRAMES;
+            std::cout << "\t" << milliseconds << "\t" << drops / milliseconds;
+        }
+        std::cout << std::endl;
+    }
+}
+
+void runBenchmark() {
+    if (benchmarkName == "pcf") {
+        benchmarkPcf();
+    }
+    else if (benchmarkName == "lights") {
+        benchmarkLights();
+    }
+    else if (benchmarkName == "deferred") {
+        benchmarkDeferred();
+    }
+    else if (benchmarkName == "rain") {
+        benchmarkRain();
+    }
+    else if (benchmarkName == "particles") {
+        benchmarkParticles();
+    }
+    else {
+        std::cerr << "ERROR: unknown benchmark " << benchmarkName << " (available: pcf, lights, deferred, rain, particles)" << std::endl;
+    }
 }
 
 void updateOpenGLState() {
@@ -835,12 +1709,118 @@ void updateOpenGLState() {
 }
 
 void cleanup() {
+    rainTimer.destroy();
+    particleSystem.destroy();
+    cityHeightMap.destroy();
+    gpuRain.destroy();
+    glDeleteProgram(rainShader.shaderProgram);
+    cityLightmap.destroy();
+    glDeleteProgram(gBufferShader.shaderProgram);
+    glDeleteVertexArrays(1, &fullScreenVAO);
+    lightingPassTimer.destroy();
+    gBufferTimer.destroy();
+    gBuffer.destroy();
+    lightClusters.destroy();
+    workerPool.stop();
+    lightManager.destroy();
+    spotShadowTimer.destroy();
+    spotShadowAtlas.destroy();
+    varianceShadowMap.destroy();
+    scenePassTimer.destroy();
+    shadowPassTimer.destroy();
+    shadowMap.destroy();
+    frameUniformBuffer.destroy();
+    drawUniformBuffer.destroy();
     myWindow.Delete();
     //cleanup code for your own data
 }
 
+void parseArguments(int argc, const char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--cascades" && i + 1 < argc) {
+            shadowCascadeCount = atoi(argv[++i]);
+        }
+        else if (argument == "--shadow-resolution" && i + 1 < argc) {
+            shadowResolution = atoi(argv[++i]);
+        }
+        else if (argument == "--no-shadow-cache") {
+            shadowCaching = false;
+        }
+        else if (argument == "--no-time-slicing") {
+            shadowTimeSlicing = false;
+        }
+        else if (argument == "--animate-sun") {
+            animateSun = true;
+        }
+        else if (argument == "--pcf-taps" && i + 1 < argc) {
+            shadowPcfTaps = atoi(argv[++i]);
+            if (shadowPcfTaps != 1 && shadowPcfTaps != 4 && shadowPcfTaps != 9 && shadowPcfTaps != 16) {
+                std::cerr << "WARNING: --pcf-taps must be 1, 4, 9 or 16, using 4" << std::endl;
+                shadowPcfTaps = 4;
+            }
+        }
+        else if (argument == "--shadow-moments") {
+            shadowMoments = true;
+        }
+        else if (argument == "--moment-resolution" && i + 1 < argc) {
+            shadowMomentResolution = atoi(argv[++i]);
+        }
+        else if (argument == "--evsm-exponent" && i + 1 < argc) {
+            varianceShadowMap.setExponent((float)atof(argv[++i]));
+        }
+        else if (argument == "--light-bleed" && i + 1 < argc) {
+            lightBleedReduction = glm::clamp((float)atof(argv[++i]), 0.0f, 0.95f);
+        }
+        else if (argument == "--spot-atlas-size" && i + 1 < argc) {
+            spotAtlasSize = atoi(argv[++i]);
+        }
+        else if (argument == "--spot-atlas-budget" && i + 1 < argc) {
+            spotAtlasBudget = atoi(argv[++i]);
+        }
+        else if (argument == "--deferred") {
+            deferredShading = true;
+        }
+        else if (argument == "--no-clustered-lights") {
+            clusteredLights = false;
+        }
+        else if (argument == "--flat-ambient") {
+            flatAmbient = true;
+        }
+        else if (argument == "--no-program-cache") {
+            programCache = false;
+        }
+        else if (argument == "--no-baked-lighting") {
+            bakedLighting = false;
+        }
+        else if (argument == "--lightmap-size" && i + 1 < argc) {
+            lightmapSize = atoi(argv[++i]);
+        }
+        else if (argument == "--lightmap-samples" && i + 1 < argc) {
+            lightmapSamples = atoi(argv[++i]);
+        }
+        else if (argument == "--cpu-rain") {
+            gpuRainEnabled = false;
+        }
+        else if (argument == "--rain-particles" && i + 1 < argc) {
+            rainParticleCount = atoi(argv[++i]);
+        }
+        else if (argument == "--particle-budget" && i + 1 < argc) {
+            particleBudget = atoi(argv[++i]);
+        }
+        else if (argument == "--particle-time-budget" && i + 1 < argc) {
+            particleTimeBudget = atof(argv[++i]);
+        }
+        else if (argument == "--bench" && i + 1 < argc) {
+            benchmarkName = argv[++i];
+        }
+    }
+}
+
 int main(int argc, const char* argv[]) {
 
+    parseArguments(argc, argv);
+
     try {
         initOpenGLWindow();
     }
@@ -850,16 +1830,26 @@ int main(int argc, const char* argv[]) {
     }
 
     initOpenGLState();
+    beginShaders();
     initModels();
     initShaders();
     initUniforms();
     initFBO();
+    initLights();
+    initLightmaps();
     initSkyBox();
     initNightSkyBox();
     setWindowCallbacks();
     initParticles();
 
     glCheckError();
+
+    if (!benchmarkName.empty()) {
+        runBenchmark();
+        cleanup();
+        return EXIT_SUCCESS;
+    }
+
     // application loop
     while (!glfwWindowShouldClose(myWindow.getWindow())) {
         processMovement();
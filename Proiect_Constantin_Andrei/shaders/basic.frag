@@ -1,61 +1,127 @@
 #version 410 core
 
+#ifdef DEFERRED_LIGHTING
+//the surfaces come from the G-buffer (see GBuffer), one full-screen triangle lights every pixel once
+uniform sampler2D gBufferAlbedo;
+uniform sampler2D gBufferNormal;
+uniform sampler2D gBufferSpecular;
+uniform sampler2D gBufferAmbient;
+uniform sampler2D gBufferDepth;
+//window coordinates (pixels, depth) back to world space
+uniform mat4 windowToWorld;
+#else
 in vec3 fPosition;
 in vec3 fNormal;
 in vec2 fTexCoords;
+in vec2 fLightmapCoords;
 in vec4 fEyePos;
-in vec4 fragPosLightSpace;
+in vec3 fWorldPos;
+in float fViewDepth;
+#endif
 
 out vec4 fColor;
 
 //matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat3 normalMatrix;
-//lighting
-uniform vec3 lightDir;
-uniform vec3 lightColor;
-// textures
-uniform sampler2D diffuseTexture;
-uniform sampler2D specularTexture;
-//shadow
-uniform sampler2D shadowMap;
-//point lights
-struct PointLight {    
-    vec3 position;
-    vec3 direction;
-    
-    float constant;
-    float linear;
-    float quadratic;  
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
-    float cutOff;
-};  
-#define NR_POINT_LIGHTS 1  
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-
-//spot lights
-struct SpotLight {    
-    vec3 position;
-    vec3 direction;
-    
-    float constant;
-    float linear;
-    float quadratic;  
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
-    float cutOff;
-    float outerCutOff;
-};  
-#define NR_SPOT_LIGHTS 1  
-uniform SpotLight spotLights[NR_SPOT_LIGHTS];
+//per-draw data, bound from the per-draw ring buffer, declared once in main.cpp (DrawUniforms)
+DRAW_UNIFORMS_BLOCK
+//per-frame data shared by all programs, declared once in main.cpp (FrameUniforms)
+FRAME_UNIFORMS_BLOCK
+// textures - layers of the material texture arrays
+uniform sampler2DArray diffuseTexture;
+uniform sampler2DArray specularTexture;
+uniform float diffuseTextureLayer;
+uniform float specularTextureLayer;
+#ifndef DEFERRED_LIGHTING
+//rgb - baked sky light, a - ambient occlusion, see LightmapBaker
+uniform sampler2D lightmap;
+#endif
+#ifdef SHADOW_MOMENTS
+//shadow - blurred and mipmapped (E)VSM moments, one layer per cascade
+uniform sampler2DArray shadowMap;
+//variance floor, keeps flat receivers from self shadowing
+const float SHADOW_MIN_VARIANCE = 0.00002f;
+#else
+//shadow - one layer per cascade, depth compare done by the sampler (bilinear PCF)
+uniform sampler2DArrayShadow shadowMap;
+#endif
+
+//PCF quality tier, set at compile time by main.cpp: 1, 4, 9 or 16 hardware filtered taps
+#ifndef SHADOW_PCF_TAPS
+#define SHADOW_PCF_TAPS 4
+#endif
+//radius of the tap pattern in shadow map texels
+const float SHADOW_FILTER_RADIUS = 1.5f;
+
+#if SHADOW_PCF_TAPS == 4
+//rotated grid
+const vec2 shadowTaps[4] = vec2[](
+    vec2(-0.25f, -0.75f), vec2(0.75f, -0.25f), vec2(0.25f, 0.75f), vec2(-0.75f, 0.25f));
+#elif SHADOW_PCF_TAPS == 9
+//Poisson disk
+const vec2 shadowTaps[9] = vec2[](
+    vec2(0.0082f, -0.1023f), vec2(-0.7071f, 0.5562f), vec2(0.4327f, 0.7446f),
+    vec2(-0.5792f, -0.8152f), vec2(0.8549f, -0.3701f), vec2(0.2260f, -0.9612f),
+    vec2(-0.8933f, -0.1530f), vec2(0.8118f, 0.2876f), vec2(-0.1541f, 0.8134f));
+#elif SHADOW_PCF_TAPS == 16
+//Poisson disk
+const vec2 shadowTaps[16] = vec2[](
+    vec2(-0.0094f, -0.0689f), vec2(-0.9417f, -0.2619f), vec2(0.2998f, 0.8166f), vec2(0.0272f, -0.9996f),
+    vec2(0.8799f, 0.1182f), vec2(-0.6126f, 0.6393f), vec2(0.6826f, -0.6399f), vec2(-0.4392f, -0.6093f),
+    vec2(-0.5553f, 0.0875f), vec2(0.3855f, 0.3174f), vec2(-0.1299f, 0.4515f), vec2(0.4601f, -0.1925f),
+    vec2(0.0950f, -0.5399f), vec2(-0.1549f, 0.8643f), vec2(-0.8521f, 0.3364f), vec2(0.8651f, -0.3191f));
+#endif
+//spot light array capacity, set at compile time by main.cpp from LightManager
+#ifndef MAX_SPOT_LIGHTS
+#define MAX_SPOT_LIGHTS 32
+#endif
+
+//point lights, world space, POINT_LIGHT_TEXELS texels each in pointLightData
+struct PointLight {
+    //w - range, the light is skipped beyond it
+    vec4 position;
+    //x - constant, y - linear, z - quadratic
+    vec4 attenuation;
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+};
+const int POINT_LIGHT_TEXELS = 5;
+uniform samplerBuffer pointLightData;
+
+#ifdef CLUSTERED_LIGHTS
+//light clusters, see LightClusters: (offset, count) of each cluster in clusterLightIndices
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterLightIndices;
+//clusters per pixel, and slice = log(view depth) * x + y
+uniform vec2 clusterTileScale;
+uniform vec2 clusterDepthScale;
+#endif
+
+//spot lights, world space
+struct SpotLight {
+    //w - range
+    vec4 position;
+    //w - cos of the inner cone angle
+    vec4 direction;
+    //x - constant, y - linear, z - quadratic, w - cos of the outer cone angle
+    vec4 attenuation;
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+
+    //light space matrix of the atlas tile and the tile (xy offset, zw size), zw = 0 when unshadowed
+    mat4 shadowMatrix;
+    vec4 shadowRect;
+};
+
+//live light counts and the spot lights, see LightManager
+layout(std140) uniform LightUniforms {
+    //x - point lights, y - spot lights
+    ivec4 lightCounts;
+    SpotLight spotLights[MAX_SPOT_LIGHTS];
+};
+//spot light shadow tiles, see ShadowAtlas
+uniform sampler2DShadow spotShadowAtlas;
 
 //components
 vec3 ambient;
@@ -65,150 +131,313 @@ vec3 specular;
 float specularStrength = 0.5f;
 float shadow;
 
+//surface being shaded, world space
+vec3 surfacePosition;
+vec3 surfaceNormal;
+float surfaceViewDepth;
+vec3 surfaceAlbedo;
+vec3 surfaceSpecular;
+//rgb - baked sky light relative to an open sky, a - ambient occlusion, 1 for draws without a lightmap
+vec4 surfaceAmbient;
+
+//sky light reaching a surface with the given world normal, a few multiply-adds and no texture fetch
+vec3 computeSkyIrradiance(vec3 normal)
+{
+    vec3 irradiance = skyIrradiance[0].rgb * 0.282095f
+        + skyIrradiance[1].rgb * (0.488603f * normal.y)
+        + skyIrradiance[2].rgb * (0.488603f * normal.z)
+        + skyIrradiance[3].rgb * (0.488603f * normal.x)
+        + skyIrradiance[4].rgb * (1.092548f * normal.x * normal.y)
+        + skyIrradiance[5].rgb * (1.092548f * normal.y * normal.z)
+        + skyIrradiance[6].rgb * (0.315392f * (3.0f * normal.z * normal.z - 1.0f))
+        + skyIrradiance[7].rgb * (1.092548f * normal.x * normal.z)
+        + skyIrradiance[8].rgb * (0.546274f * (normal.x * normal.x - normal.y * normal.y));
+    //band limited ringing can dip below zero opposite a bright sun
+    return max(irradiance, 0.0f);
+}
+
 void computeDirLight()
 {
     //compute eye space coordinates
-    vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-    vec3 normalEye = normalize(normalMatrix * fNormal);
+    vec4 fPosEye = view * vec4(surfacePosition, 1.0f);
+    vec3 normalEye = normalize(mat3(view) * surfaceNormal);
 
     //normalize light direction
-    vec3 lightDirN = vec3(normalize(view * vec4(lightDir, 0.0f)));
+    vec3 lightDirN = vec3(normalize(view * vec4(lightDir.xyz, 0.0f)));
 
     //compute view direction (in eye coordinates, the viewer is situated at the origin
     vec3 viewDir = normalize(- fPosEye.xyz);
 
-    //compute ambient light
-    ambient = ambientStrength * lightColor;
+    //compute ambient light, only the sky the surface can see
+    ambient = ambientStrength * computeSkyIrradiance(surfaceNormal) * surfaceAmbient.rgb;
 
     //compute diffuse light
-    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor.rgb;
 
     //compute specular light
     vec3 reflectDir = reflect(-lightDirN, normalEye);
     float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
-    specular = specularStrength * specCoeff * lightColor;
+    specular = specularStrength * specCoeff * lightColor.rgb;
 }
 
 float computeFog(){
     float fogDensity=0.05f;
-    float fragmentDistance = length(fEyePos);
+    float fragmentDistance = length(projection * view * vec4(surfacePosition, 1.0f));
     float fogFactor = exp(-pow(fragmentDistance * fogDensity, 2));
 
     return clamp(fogFactor, 0.0f, 1.0f);
 }
 
-float computeShadow(){
+#ifdef SHADOW_MOMENTS
+// Chebyshev upper bound of the lit fraction, bleedReduction cuts off the low tail that causes light bleeding
+float chebyshevUpperBound(vec2 moments, float depth, float minVariance, float bleedReduction){
+	if (depth <= moments.x)
+		return 1.0f;
+
+	float variance = max(moments.y - moments.x * moments.x, minVariance);
+	float distance = depth - moments.x;
+	float pMax = variance / (variance + distance * distance);
+
+	return clamp((pMax - bleedReduction) / (1.0f - bleedReduction), 0.0f, 1.0f);
+}
+
+float computeCascadeShadow(int cascade){
+	vec4 fragPosLightSpace = lightSpaceTrMatrix[cascade] * vec4(surfacePosition, 1.0f);
+	vec3 normalizedCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+	normalizedCoords = normalizedCoords * 0.5 + 0.5;
+	if (normalizedCoords.z > 1.0f)
+		return 0.0f;
+
+	// one trilinear lookup replaces the PCF taps
+	vec2 moments = texture(shadowMap, vec3(normalizedCoords.xy, cascade)).rg;
+	float depth = clamp(normalizedCoords.z, 0.0f, 1.0f);
+
+	float exponent = shadowParams.w;
+	float minVariance = SHADOW_MIN_VARIANCE;
+	if (exponent > 0.0f) {
+		// same warp as momentResolve.frag, the variance floor scales with the warp slope
+		depth = exp(exponent * (depth * 2.0f - 1.0f));
+		float slope = 2.0f * exponent * depth;
+		minVariance *= slope * slope;
+	}
+
+	return 1.0f - chebyshevUpperBound(moments, depth, minVariance, shadowParams.z);
+}
+#else
+float computeCascadeShadow(int cascade){
+	vec4 fragPosLightSpace = lightSpaceTrMatrix[cascade] * vec4(surfacePosition, 1.0f);
 	// perform perspective divide
 	vec3 normalizedCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
 	// Transform to [0,1] range
 	normalizedCoords = normalizedCoords * 0.5 + 0.5;
 	if (normalizedCoords.z > 1.0f)
 		return 0.0f;
-	// Get closest depth value from light's perspective
-	float closestDepth = texture(shadowMap, normalizedCoords.xy).r;
-	// Get depth of current fragment from light's perspective
-	float currentDepth = normalizedCoords.z;
-	// Check whether current frag pos is in shadow
-	float bias = max(0.05f * (1.0f - dot(fNormal, lightDir)), 0.005f);
-	float shadow = currentDepth - bias > closestDepth ? 1.0f : 0.0f;
+	// Depth of current fragment from light's perspective, biased against acne
+	float bias = max(0.05f * (1.0f - dot(surfaceNormal, lightDir.xyz)), 0.005f);
+	float currentDepth = normalizedCoords.z - bias;
+
+	// every tap returns the bilinear weighted fraction of the 2x2 texels that are lit
+#if SHADOW_PCF_TAPS == 1
+	float lit = texture(shadowMap, vec4(normalizedCoords.xy, cascade, currentDepth));
+#else
+	// rotate the pattern per pixel so the banding of few taps turns into fine noise
+	float angle = 6.2831853f * fract(52.9829189f * fract(dot(gl_FragCoord.xy, vec2(0.06711056f, 0.00583715f))));
+	mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+	vec2 radius = SHADOW_FILTER_RADIUS / vec2(textureSize(shadowMap, 0).xy);
+
+	float lit = 0.0f;
+	for (int i = 0; i < SHADOW_PCF_TAPS; i++) {
+		vec2 offset = rotation * shadowTaps[i] * radius;
+		lit += texture(shadowMap, vec4(normalizedCoords.xy + offset, cascade, currentDepth));
+	}
+	lit /= float(SHADOW_PCF_TAPS);
+#endif
+
+	return 1.0f - lit;
+}
+#endif
+
+float computeShadow(){
+	int cascadeCount = int(shadowParams.x);
+
+	// first cascade that reaches the fragment
+	int cascade = 0;
+	while (cascade < cascadeCount && surfaceViewDepth > cascadeSplits[cascade])
+		cascade++;
+	if (cascade == cascadeCount)
+		return 0.0f;
+
+	float shadow = computeCascadeShadow(cascade);
+
+	// fade into the next cascade over the last part of this one to hide the seam
+	float cascadeStart = cascade == 0 ? 0.0f : cascadeSplits[cascade - 1];
+	float blendLength = shadowParams.y * (cascadeSplits[cascade] - cascadeStart);
+	float blend = (cascadeSplits[cascade] - surfaceViewDepth) / blendLength;
+	if (blend < 1.0f) {
+		float nextShadow = cascade + 1 < cascadeCount ? computeCascadeShadow(cascade + 1) : 0.0f;
+		shadow = mix(nextShadow, shadow, blend);
+	}
 
 	return shadow;
 }
 
-vec3 computeSpotLight(SpotLight light, vec3 normal, vec3 fragPos)
+float computeSpotShadow(SpotLight light, vec3 normal, vec3 fragPos)
 {
-    vec3 lightDir = normalize(light.position - fragPos);
-    float theta = dot(lightDir, normalize(-light.direction));
-    float epsilon   = light.cutOff - light.outerCutOff;
-    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
-
-    if(theta > light.outerCutOff){
-        //TO CHANGE THIS-move outside, func param
-        vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-        vec3 viewDir = normalize(- fPosEye.xyz);
-    
-        // diffuse shading
-        float diff = max(dot(normal, lightDir), 0.0);
-        // specular shading
-        vec3 reflectDir = reflect(-lightDir, normal);
-        float spec = pow(max(dot(viewDir, reflectDir), 0.0), specularStrength);
-        // attenuation
-        float distance    = length(light.position - fragPos);
-        float attenuation = 1.0 / (light.constant + light.linear * distance + 
-  			         light.quadratic * (distance * distance));    
-        // combine results
-        vec3 ambient  = light.ambient  * vec3(texture(diffuseTexture, fTexCoords));
-        vec3 diffuse  = light.diffuse  * diff * vec3(texture(diffuseTexture, fTexCoords));
-        vec3 specular = light.specular * spec * vec3(texture(specularTexture, fTexCoords));
-        ambient  *= attenuation;
-        diffuse  *= attenuation;
-        specular *= attenuation;
-        diffuse  *= intensity;
-        specular *= intensity;
-        return (ambient + diffuse + specular);
-    }else{
-        return vec3(0.0f,0.0f,0.0f);
-    }
+    if (light.shadowRect.z <= 0.0f)
+        return 0.0f;
+
+    //push the lookup along the normal, the perspective depth is too uneven for a constant bias
+    vec4 fragPosLightSpace = light.shadowMatrix * vec4(fragPos + normal * 0.02f, 1.0f);
+    if (fragPosLightSpace.w <= 0.0f)
+        return 0.0f;
+    vec3 normalizedCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5f + 0.5f;
+    if (normalizedCoords.z > 1.0f)
+        return 0.0f;
+
+    //stay half a texel inside the tile so the bilinear compare never reads a neighbour
+    vec2 halfTexel = 0.5f / vec2(textureSize(spotShadowAtlas, 0));
+    vec2 atlasCoords = clamp(light.shadowRect.xy + normalizedCoords.xy * light.shadowRect.zw,
+        light.shadowRect.xy + halfTexel, light.shadowRect.xy + light.shadowRect.zw - halfTexel);
+
+    return 1.0f - texture(spotShadowAtlas, vec3(atlasCoords, normalizedCoords.z - 0.0005f));
 }
 
-vec3 computePointLight(PointLight light, vec3 normal, vec3 fragPos)
+//fragPos and normal in world space, like the lights
+vec3 computeSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
-    vec3 lightDir = normalize(light.position - fragPos);
-    
-    //TO CHANGE THIS-move outside, func param
-    vec4 fPosEye = view * model * vec4(fPosition, 1.0f);
-    vec3 viewDir = normalize(- fPosEye.xyz);
-    
-    
+    vec3 lightVector = light.position.xyz - fragPos;
+    float distance = length(lightVector);
+    if (distance > light.position.w)
+        return vec3(0.0f);
+
+    vec3 lightDir = lightVector / distance;
+    float theta = dot(lightDir, normalize(-light.direction.xyz));
+    float cutOff = light.direction.w;
+    float outerCutOff = light.attenuation.w;
+    if (theta <= outerCutOff)
+        return vec3(0.0f);
+    float intensity = clamp((theta - outerCutOff) / (cutOff - outerCutOff), 0.0, 1.0);
+
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), specularStrength);
     // attenuation
-    float distance    = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + 
-  			     light.quadratic * (distance * distance));    
+    float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance +
+                 light.attenuation.z * (distance * distance));
     // combine results
-    vec3 ambient  = light.ambient  * vec3(texture(diffuseTexture, fTexCoords));
-    vec3 diffuse  = light.diffuse  * diff * vec3(texture(diffuseTexture, fTexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(specularTexture, fTexCoords));
+    vec3 ambient  = light.ambient.rgb  * surfaceAlbedo * surfaceAmbient.a;
+    vec3 diffuse  = light.diffuse.rgb  * diff * surfaceAlbedo;
+    vec3 specular = light.specular.rgb * spec * surfaceSpecular;
     ambient  *= attenuation;
     diffuse  *= attenuation;
     specular *= attenuation;
-    return (ambient + diffuse + specular);
+    diffuse  *= intensity;
+    specular *= intensity;
+
+    float shadow = computeSpotShadow(light, normal, fragPos);
+    return (ambient + (1.0f - shadow) * (diffuse + specular));
 }
 
+PointLight fetchPointLight(int index)
+{
+    int texel = index * POINT_LIGHT_TEXELS;
+    PointLight light;
+    light.position = texelFetch(pointLightData, texel);
+    light.attenuation = texelFetch(pointLightData, texel + 1);
+    light.ambient = texelFetch(pointLightData, texel + 2);
+    light.diffuse = texelFetch(pointLightData, texel + 3);
+    light.specular = texelFetch(pointLightData, texel + 4);
+    return light;
+}
+
+//fragPos and normal in world space, like the lights
+vec3 computePointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightVector = light.position.xyz - fragPos;
+    float distance = length(lightVector);
+    if (distance > light.position.w)
+        return vec3(0.0f);
 
+    vec3 lightDir = lightVector / distance;
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), specularStrength);
+    // attenuation
+    float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance +
+                 light.attenuation.z * (distance * distance));
+    // combine results
+    vec3 ambient  = light.ambient.rgb  * surfaceAlbedo * surfaceAmbient.a;
+    vec3 diffuse  = light.diffuse.rgb  * diff * surfaceAlbedo;
+    vec3 specular = light.specular.rgb * spec * surfaceSpecular;
+    ambient  *= attenuation;
+    diffuse  *= attenuation;
+    specular *= attenuation;
+    return (ambient + diffuse + specular);
+}
 
 void main() 
 {
-    computeDirLight();
+#ifdef DEFERRED_LIGHTING
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gBufferDepth, pixel, 0).r;
+    //nothing was drawn here, the sky stays
+    if (depth == 1.0f)
+        discard;
+    //the rain and the other forward passes test against the scene depth
+    gl_FragDepth = depth;
 
-    //compute final vertex color
-    vec4 colorFromTexture = texture(diffuseTexture, fTexCoords);
-    if(colorFromTexture.a<0.1)
+    vec4 worldPos = windowToWorld * vec4(vec2(pixel) + 0.5f, depth, 1.0f);
+    surfacePosition = worldPos.xyz / worldPos.w;
+    surfaceNormal = normalize(texelFetch(gBufferNormal, pixel, 0).xyz);
+    surfaceViewDepth = -(view * vec4(surfacePosition, 1.0f)).z;
+    surfaceAlbedo = texelFetch(gBufferAlbedo, pixel, 0).rgb;
+    surfaceSpecular = texelFetch(gBufferSpecular, pixel, 0).rgb;
+    surfaceAmbient = texelFetch(gBufferAmbient, pixel, 0);
+#else
+    vec4 colorFromTexture = texture(diffuseTexture, vec3(fTexCoords, diffuseTextureLayer));
+    if (colorFromTexture.a < 0.1)
         discard;
-    else{
-        shadow = computeShadow();
-
-        vec3 color = min((ambient + (1.0f - shadow)*diffuse) * colorFromTexture.rgb + (1.0f - shadow)*specular * texture(specularTexture, fTexCoords).rgb, 1.0f);
-        //vec3 color = min((ambient + diffuse) * colorFromTexture.rgb + specular * texture(specularTexture, fTexCoords).rgb, 1.0f);
-        
-        for(int i = 0; i < NR_SPOT_LIGHTS; i++)
-            color += computeSpotLight(spotLights[i], fNormal, fPosition);
-
-        //for(int i = 0; i < NR_POINT_LIGHTS; i++)
-            //color += computePointLight(pointLights[i], fNormal, fPosition);
-            
-        float fogFactor = computeFog();
-        vec4 fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
-        fColor = fogColor * (1 - fogFactor) + vec4(color,1.0f) * fogFactor;
-
-         
-
-        //without fog
-        //fColor = vec4(color, 1.0f);
-    }
-    
+
+    surfacePosition = fWorldPos;
+    surfaceNormal = normalize(mat3(normalMatrix) * fNormal);
+    surfaceViewDepth = fViewDepth;
+    surfaceAlbedo = colorFromTexture.rgb;
+    surfaceSpecular = texture(specularTexture, vec3(fTexCoords, specularTextureLayer)).rgb;
+    surfaceAmbient = lightmapParams.x > 0.0f ? texture(lightmap, fLightmapCoords) : vec4(1.0f);
+#endif
+
+    computeDirLight();
+    shadow = computeShadow();
+
+    vec3 color = min((ambient + (1.0f - shadow)*diffuse) * surfaceAlbedo + (1.0f - shadow)*specular * surfaceSpecular, 1.0f);
+    //vec3 color = min((ambient + diffuse) * surfaceAlbedo + specular * surfaceSpecular, 1.0f);
+
+    //camera position is the inverse view translation
+    vec3 cameraPos = -transpose(mat3(view)) * view[3].xyz;
+    vec3 viewDir = normalize(cameraPos - surfacePosition);
+    for(int i = 0; i < lightCounts.y; i++)
+        color += computeSpotLight(spotLights[i], surfaceNormal, surfacePosition, viewDir);
+
+#ifdef CLUSTERED_LIGHTS
+    //only the lights assigned to this fragment's cluster
+    ivec3 cluster = ivec3(gl_FragCoord.xy * clusterTileScale, log(max(surfaceViewDepth, 1e-4f)) * clusterDepthScale.x + clusterDepthScale.y);
+    cluster = clamp(cluster, ivec3(0), ivec3(CLUSTER_GRID_X, CLUSTER_GRID_Y, CLUSTER_GRID_Z) - 1);
+    uvec2 range = texelFetch(clusterRanges, (cluster.z * CLUSTER_GRID_Y + cluster.y) * CLUSTER_GRID_X + cluster.x).rg;
+    for(uint i = 0u; i < range.y; i++)
+        color += computePointLight(fetchPointLight(int(texelFetch(clusterLightIndices, int(range.x + i)).r)), surfaceNormal, surfacePosition, viewDir);
+#else
+    for(int i = 0; i < lightCounts.x; i++)
+        color += computePointLight(fetchPointLight(i), surfaceNormal, surfacePosition, viewDir);
+#endif
+
+    float fogFactor = computeFog();
+    vec4 fogColor = vec4(0.5f, 0.5f, 0.5f, 1.0f);
+    fColor = fogColor * (1 - fogFactor) + vec4(color,1.0f) * fogFactor;
+
+    //without fog
+    //fColor = vec4(color, 1.0f);
 }
@@ -3,17 +3,20 @@
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+layout(location=3) in vec2 vLightmapCoords;
 
 out vec3 fPosition;
 out vec3 fNormal;
 out vec2 fTexCoords;
+out vec2 fLightmapCoords;
 out vec4 fEyePos;
-out vec4 fragPosLightSpace;
+out vec3 fWorldPos;
+out float fViewDepth;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceTrMatrix;
+//per-draw data, bound from the per-draw ring buffer, declared once in main.cpp (DrawUniforms)
+DRAW_UNIFORMS_BLOCK
+//per-frame data shared by all programs, declared once in main.cpp (FrameUniforms)
+FRAME_UNIFORMS_BLOCK
 
 void main() 
 {
@@ -22,5 +25,8 @@ void main()
 	fPosition = vPosition;
 	fNormal = vNormal;
 	fTexCoords = vTexCoords;
-	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	fLightmapCoords = vLightmapCoords;
+	//the shadow cascade is picked per fragment, from the world position and the view depth
+	fWorldPos = vec3(model * vec4(vPosition, 1.0f));
+	fViewDepth = -(view * vec4(fWorldPos, 1.0f)).z;
 }
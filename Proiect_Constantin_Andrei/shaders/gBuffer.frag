@@ -0,0 +1,35 @@
+#version 410 core
+
+in vec3 fPosition;
+in vec3 fNormal;
+in vec2 fTexCoords;
+in vec2 fLightmapCoords;
+
+//albedo, world space normal, specular, baked light - see GBuffer
+layout(location = 0) out vec4 gAlbedo;
+layout(location = 1) out vec4 gNormal;
+layout(location = 2) out vec4 gSpecular;
+layout(location = 3) out vec4 gAmbient;
+
+//per-draw data, bound from the per-draw ring buffer, declared once in main.cpp (DrawUniforms)
+DRAW_UNIFORMS_BLOCK
+// textures - layers of the material texture arrays
+uniform sampler2DArray diffuseTexture;
+uniform sampler2DArray specularTexture;
+uniform float diffuseTextureLayer;
+uniform float specularTextureLayer;
+//rgb - baked sky light, a - ambient occlusion, see LightmapBaker
+uniform sampler2D lightmap;
+
+//geometry pass of the deferred path: only the surface, the lighting is done once per pixel by basic.frag
+void main()
+{
+    vec4 colorFromTexture = texture(diffuseTexture, vec3(fTexCoords, diffuseTextureLayer));
+    if (colorFromTexture.a < 0.1)
+        discard;
+
+    gAlbedo = vec4(colorFromTexture.rgb, 1.0f);
+    gNormal = vec4(normalize(mat3(normalMatrix) * fNormal), 0.0f);
+    gSpecular = vec4(texture(specularTexture, vec3(fTexCoords, specularTextureLayer)).rgb, 1.0f);
+    gAmbient = lightmapParams.x > 0.0f ? texture(lightmap, fLightmapCoords) : vec4(1.0f);
+}
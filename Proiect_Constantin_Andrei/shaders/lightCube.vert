@@ -5,8 +5,8 @@ layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+//per-frame data shared by all programs, declared once in main.cpp (FrameUniforms)
+FRAME_UNIFORMS_BLOCK
 
 void main() 
 {
@@ -0,0 +1,27 @@
+#version 410 core
+
+out vec2 fMoments;
+
+uniform sampler2DArray source;
+uniform int sourceLayer;
+//(1, 0) horizontal, (0, 1) vertical
+uniform ivec2 direction;
+uniform int radius;
+uniform float sigma;
+
+void main()
+{
+    ivec2 center = ivec2(gl_FragCoord.xy);
+    ivec2 maxCoord = textureSize(source, 0).xy - 1;
+
+    vec2 sum = vec2(0.0f);
+    float weightSum = 0.0f;
+    for (int i = -radius; i <= radius; i++) {
+        float weight = exp(-float(i * i) / (2.0f * sigma * sigma));
+        ivec2 coord = clamp(center + direction * i, ivec2(0), maxCoord);
+        sum += weight * texelFetch(source, ivec3(coord, sourceLayer), 0).rg;
+        weightSum += weight;
+    }
+
+    fMoments = sum / weightSum;
+}
@@ -0,0 +1,28 @@
+#version 410 core
+
+out vec2 fMoments;
+
+//cascade depth layers, read without depth comparison
+uniform sampler2DArray depthMap;
+uniform int cascade;
+//depth texels per moment texel along each axis
+uniform int downsample;
+//0 - VSM moments of the depth, otherwise EVSM moments of exp(exponent * depth)
+uniform float exponent;
+
+void main()
+{
+    ivec2 origin = ivec2(gl_FragCoord.xy) * downsample;
+    vec2 moments = vec2(0.0f);
+
+    for (int y = 0; y < downsample; y++) {
+        for (int x = 0; x < downsample; x++) {
+            float depth = texelFetch(depthMap, ivec3(origin + ivec2(x, y), cascade), 0).r;
+            //warp [0,1] depth to [-1,1] before the exponential to use the whole fp32 range
+            float warped = exponent > 0.0f ? exp(exponent * (depth * 2.0f - 1.0f)) : depth;
+            moments += vec2(warped, warped * warped);
+        }
+    }
+
+    fMoments = moments / float(downsample * downsample);
+}
@@ -1,8 +1,19 @@
 #version 410 core
 
+in vec2 fStreakCoordinates;
+in float fLife;
+in float fCoverage;
+
 out vec4 fColor;
 
+//rgb, a - opacity of the brightest part of a streak, drawn with alpha blending
+uniform vec4 color;
+
 void main()
 {
-    fColor = vec4(1.0f);
-}
\ No newline at end of file
+    //soft edges, a tail fading out behind the head, and drops fading out at the end of their life
+    float edge = 1.0f - abs(fStreakCoordinates.x);
+    float tail = 1.0f - fStreakCoordinates.y;
+    float life = smoothstep(0.0f, 0.2f, fLife);
+    fColor = vec4(color.rgb, color.a * edge * tail * life * fCoverage);
+}
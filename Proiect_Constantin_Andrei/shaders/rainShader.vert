@@ -1,15 +1,59 @@
 #version 410 core
 
-layout (location = 0) in vec3 vertexPosition;
-out vec3 textureCoordinates;
+//one particle per instance, packed by ParticleSystem or straight from GpuRain's buffer
+//xyz - position relative to origin (times positionScale), w - life
+layout(location = 0) in vec4 dropPosition;
+//xyz - how far the drop moves in one step (times motionScale)
+layout(location = 1) in vec4 dropMotion;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+//per-frame data shared by all programs, declared once in main.cpp (FrameUniforms)
+FRAME_UNIFORMS_BLOCK
+
+//where the positions start from: the camera for the rain, the emitter for world space effects
+uniform vec3 origin;
+//undo the packing, 1 for float data
+uniform float positionScale;
+uniform float motionScale;
+//in pixels, thin drops are widened to a pixel so they do not fall between the samples
+uniform float viewportHeight;
+//x - streak length at rest, y - half width
+uniform vec2 particleSize;
+
+//x - across the streak (-1 to 1), y - from the head (0) to the tail (1)
+out vec2 fStreakCoordinates;
+out float fLife;
+//fraction of the quad the drop really covers after widening
+out float fCoverage;
+
+//a moving particle's streak also covers this many steps of its motion
+const float STREAK_STEPS = 2.0f;
 
 void main()
 {
-    vec4 tempPos = projection * view * vec4(vertexPosition, 1.0);
-    gl_Position = tempPos.xyww;
-    textureCoordinates = vertexPosition;
+    vec3 position = origin + dropPosition.xyz * positionScale;
+    vec3 motion = dropMotion.xyz * motionScale;
+    //camera position out of the view matrix
+    vec3 eye = -transpose(mat3(view)) * view[3].xyz;
+
+    //the tail trails the motion, straight up while the drop is still
+    float speed = length(motion);
+    vec3 axis = speed > 1.0e-5f ? -motion / speed : vec3(0.0f, 1.0f, 0.0f);
+    float streakLength = particleSize.x + speed * STREAK_STEPS;
+
+    //turned around the axis to face the camera
+    vec3 side = cross(axis, position - eye);
+    float sideLength = length(side);
+    side = sideLength > 1.0e-5f ? side / sideLength : vec3(view[0][0], view[1][0], view[2][0]);
+    float pixelHalfWidth = length(position - eye) / (projection[1][1] * viewportHeight);
+    float halfWidth = max(particleSize.y, pixelHalfWidth);
+
+    //triangle strip of 4 vertices: 0 and 1 at the head, 2 and 3 at the tail
+    float across = (gl_VertexID & 1) == 0 ? -1.0f : 1.0f;
+    float along = float(gl_VertexID >> 1);
+    vec3 corner = position + axis * (along * streakLength) + side * (across * halfWidth);
+    gl_Position = projection * view * vec4(corner, 1.0f);
+
+    fStreakCoordinates = vec2(across, along);
+    fLife = dropPosition.w;
+    fCoverage = particleSize.y / halfWidth;
 }
@@ -0,0 +1,81 @@
+#version 410 core
+
+//one rain drop, see GpuRain: position relative to the camera and life, velocity and fade per step
+layout(location = 0) in vec4 positionLife;
+layout(location = 1) in vec4 velocityFade;
+
+//captured by transform feedback into the other buffer
+out vec4 outPositionLife;
+out vec4 outVelocityFade;
+
+//velocity of a new drop and the divisor of the fall step, like the CPU rain
+uniform float startVelocity;
+uniform float slowdown;
+//step counter, new random numbers every step
+uniform uint seed;
+//drops are relative to the camera, they also die on the highest surface of the height map
+//(depth seen from above, see HeightMap) when hasHeightMap is set
+uniform vec3 cameraPosition;
+uniform bool hasHeightMap;
+uniform mat4 heightMapMatrix;
+uniform sampler2D heightMap;
+
+const float GRAVITY = -0.8f;
+//drops spawn on a 20x20 square at this height around the camera and die below the floor
+const float SPAWN_HALF_SIZE = 10.0f;
+const float SPAWN_HEIGHT = 10.0f;
+const float FLOOR_HEIGHT = -10.0f;
+
+//integer hash (lowbias32), cheap and well mixed enough for placement
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+//uniform in [0, 1), advances the state
+float random(inout uint state)
+{
+    state = hash(state);
+    return float(state >> 8) * (1.0f / 16777216.0f);
+}
+
+void main()
+{
+    vec3 position = positionLife.xyz;
+    float life = positionLife.w;
+    vec3 velocity = velocityFade.xyz;
+    float fade = velocityFade.w;
+
+    //move and age, the same steps as drawRain
+    position += velocity / (slowdown * 1000.0f);
+    velocity.y += GRAVITY;
+    life -= fade;
+    if (position.y <= FLOOR_HEIGHT)
+        life = -1.0f;
+    if (hasHeightMap) {
+        //one fetch: below the surface is deeper than it, seen from above
+        vec3 ground = (heightMapMatrix * vec4(cameraPosition + position, 1.0f)).xyz * 0.5f + 0.5f;
+        if (all(greaterThanEqual(ground.xy, vec2(0.0f))) && all(lessThanEqual(ground.xy, vec2(1.0f)))
+            && ground.z >= texture(heightMap, ground.xy).r)
+            life = -1.0f;
+    }
+
+    //revive with numbers that depend only on the drop and the step
+    if (life < 0.0f) {
+        uint state = hash(uint(gl_VertexID) ^ hash(seed));
+        position.x = (random(state) * 2.0f - 1.0f) * SPAWN_HALF_SIZE;
+        position.y = SPAWN_HEIGHT;
+        position.z = (random(state) * 2.0f - 1.0f) * SPAWN_HALF_SIZE;
+        life = 1.0f;
+        velocity = vec3(0.0f, startVelocity, 0.0f);
+        fade = random(state) * 0.1f + 0.003f;
+    }
+
+    outPositionLife = vec4(position, life);
+    outVelocityFade = vec4(velocity, fade);
+}
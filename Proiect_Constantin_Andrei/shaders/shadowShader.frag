@@ -1,8 +1,6 @@
 #version 410 core
 
-out vec4 fColor;
-
+//depth only, the shadow framebuffer has no color attachment
 void main()
 {
-	fColor = vec4(1.0f);	
 }
@@ -2,10 +2,15 @@
 
 layout(location=0) in vec3 vPosition;
 
-uniform mat4 lightSpaceTrMatrix;
-uniform mat4 model;
+//per-draw data, bound from the per-draw ring buffer, declared once in main.cpp (DrawUniforms)
+DRAW_UNIFORMS_BLOCK
+//per-frame data shared by all programs, declared once in main.cpp (FrameUniforms)
+FRAME_UNIFORMS_BLOCK
+
+//cascade being rendered
+uniform int cascadeIndex;
 
 void main()
 {
-	gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	gl_Position = lightSpaceTrMatrix[cascadeIndex] * model * vec4(vPosition, 1.0f);
 }
@@ -0,0 +1,14 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+
+//per-draw data, bound from the per-draw ring buffer, declared once in main.cpp (DrawUniforms)
+DRAW_UNIFORMS_BLOCK
+
+//perspective matrix of the spot light whose atlas tile is rendered
+uniform mat4 lightSpaceMatrix;
+
+void main()
+{
+	gl_Position = lightSpaceMatrix * model * vec4(vPosition, 1.0f);
+}